@@ -0,0 +1,141 @@
+
+#include "question_exp.h"
+
+#include <chrono>
+#include <iomanip>
+
+//a benchmark harness based on a monotonic clock, one sample times a round of calls since single calls are too short to be timed
+// precisely, latencies are per call (averaged within each sample), warm-up rounds are not sampled.
+class bench
+{
+public:
+	bench(size_t _warm_up = 3, size_t _samples = 30) : warm_up(_warm_up), samples(_samples) {}
+
+	static void print_header()
+	{
+		std::cout << std::left << std::setw(48) << "benchmark" << std::right << std::setw(8) << "calls"
+			<< std::setw(14) << "p50 (ns)" << std::setw(14) << "p99 (ns)" << std::setw(16) << "calls/s" << std::endl;
+	}
+
+	//f(n) performs the nth call of a round, setup(calls) prepares a round and is not timed.
+	template<typename SETUP, typename F> void run(const std::string& name, size_t calls, const SETUP& setup, const F& f) const
+	{
+		std::vector<double> latencies;
+		double total = .0;
+		for (size_t round = 0; round < warm_up + samples; ++round)
+		{
+			setup(calls);
+			auto start = std::chrono::steady_clock::now();
+			for (size_t n = 0; n < calls; ++n)
+				f(n);
+			auto elapsed = std::chrono::duration_cast<std::chrono::duration<double, std::nano>>(std::chrono::steady_clock::now() - start).count();
+			if (round >= warm_up)
+			{
+				latencies.push_back(elapsed / calls);
+				total += elapsed;
+			}
+		}
+
+		std::sort(std::begin(latencies), std::end(latencies));
+		auto percentile = [&](double p) {return latencies[std::min(latencies.size() - 1, (size_t) (p * latencies.size()))];};
+		std::cout << std::left << std::setw(48) << name << std::right << std::setw(8) << calls << std::fixed << std::setprecision(1)
+			<< std::setw(14) << percentile(.5) << std::setw(14) << percentile(.99)
+			<< std::setw(16) << std::setprecision(0) << 1e9 * calls * samples / total << std::endl;
+	}
+	template<typename F> void run(const std::string& name, size_t calls, const F& f) const {run(name, calls, [](size_t) {}, f);}
+
+private:
+	size_t warm_up, samples;
+};
+
+//keep results alive, so the calls will not be optimized out
+template<typename T> inline void consume(T v) {static volatile T sink; sink = v; (void) sink;}
+
+//synthetic statements
+std::string make_nested(size_t depth) //'((a + b) * c) - a ...', parenthesized and left deep
+{
+	const char* tails[] = {" + b)", " * c)", " - a)"};
+	std::string statement(depth, '(');
+	statement += "a";
+	for (size_t i = 0; i < depth; ++i)
+		statement += tails[i % 3];
+	return statement;
+}
+
+std::string make_chain(size_t length) //'a + b * c - a + b * c ...', flat
+{
+	const char* terms[] = {" + b", " * c", " - a"};
+	std::string statement = "a";
+	for (size_t i = 0; i < length; ++i)
+		statement += terms[i % 3];
+	return statement;
+}
+
+std::string make_cascade(size_t width) //'a < 0 ? 0 : a < 1 ? 1 : ... : width', the false branches are nested question mark expressions
+{
+	std::string statement;
+	for (size_t i = 0; i < width; ++i)
+		statement += "a < " + std::to_string(i) + " ? " + std::to_string(i) + " : ";
+	return statement + std::to_string(width);
+}
+
+template<typename D, typename O> void bench_compile(const bench& b, const char* level, const std::pair<std::string, std::string>* statements, size_t num)
+{
+	for (size_t i = 0; i < num; ++i)
+		b.run(std::string("compile ") + level + ' ' + statements[i].first, 10,
+			[&](size_t) {consume(qme::compiler<D, O>::compile(statements[i].second)->get_node_count());});
+}
+
+int main(int argc, const char* argv[])
+{
+	typedef float D;
+	typedef qme::O3 O;
+
+	bench b;
+	const size_t size = 1000; //depth of nesting, length of chains and width of question mark cascades
+	const std::pair<std::string, std::string> statements[] = {
+		std::make_pair("nested(" + std::to_string(size) + ')', make_nested(size)),
+		std::make_pair("chain(" + std::to_string(size) + ')', make_chain(size)),
+		std::make_pair("cascade(" + std::to_string(size) + ')', make_cascade(size)),
+		std::make_pair("rule", std::string("a > 0 && b < 1 ? a * b + c : (c - a) / (b + 2)")),
+	};
+	const size_t statement_num = sizeof(statements) / sizeof(statements[0]);
+
+	std::map<std::string, D> record;
+	record["a"] = (D) size / 2; //half of the cascade will be traveled
+	record["b"] = .5f;
+	record["c"] = 3.f;
+	std::function<D(const std::string&)> cb = [&](const std::string& variable_name) {return record[variable_name];};
+
+	bench::print_header();
+	bench_compile<D, qme::O0>(b, "O0", statements, statement_num);
+	bench_compile<D, qme::O1>(b, "O1", statements, statement_num);
+	bench_compile<D, qme::O2>(b, "O2", statements, statement_num);
+	bench_compile<D, qme::O3>(b, "O3", statements, statement_num);
+
+	for (auto& item : statements)
+	{
+		qme::symbol_table symbols;
+		auto exp = qme::compiler<D, O>::compile(item.second, symbols);
+		std::vector<D> values;
+		for (auto& variable_name : symbols.names())
+			values.push_back(record[variable_name]);
+		qme::eval_context<D> context(exp);
+		qme::program<D> prog(exp);
+		auto calls = std::max((size_t) 10, 100000 / exp->get_node_count());
+
+		b.run("operator() with callback " + item.first, calls, [&](size_t) {consume((*exp)(cb));});
+		b.run("operator() with values " + item.first, calls, [&](size_t) {consume((*exp)(values.data()));});
+		b.run("safe_data with callback " + item.first, calls, [&](size_t) {consume(qme::safe_data(exp, cb, context).first);});
+		b.run("safe_data with values " + item.first, calls, [&](size_t) {consume(qme::safe_data(exp, values.data(), context).first);});
+		b.run("program with values " + item.first, calls, [&](size_t) {consume(prog(values.data()));});
+
+		//compile copies of the expression before each round, then destroy them one by one
+		std::vector<qme::exp_type<D>> exps;
+		auto setup = [&](size_t calls) {exps.clear(); for (size_t n = 0; n < calls; ++n) exps.push_back(qme::compiler<D, O>::compile(item.second));};
+		b.run("destruction " + item.first, 10, setup, [&](size_t n) {exps[n].reset();});
+		b.run("safe_delete " + item.first, 10, setup, [&](size_t n) {consume(qme::safe_delete(exps[n]));});
+	}
+
+	return 0;
+}
@@ -0,0 +1,115 @@
+#include "question_exp_gen.h"
+
+#include <fstream>
+
+//compile rules into a c++ header, one inline function per rule:
+// qme_gen <rule file> [namespace] [float|double|int|long long] [O0|O1|O2|O3]
+//each non-empty line of the rule file is a rule, 'name: statement' or just 'statement' (named as rule_N, N starts from 1),
+// lines start with '#' are comments.
+template<typename T, typename O> int generate(const std::string& name_space, const std::string& type_name,
+	const std::vector<std::string>& names, const std::vector<std::string>& statements)
+{
+	try
+	{
+		qme::rule_set<T, O> rules(statements);
+		qme::generator<T>(type_name).generate(std::cout, name_space, names, statements, rules.get_exps(), rules.get_symbols());
+		return 0;
+	}
+	catch (const std::exception& e) {std::cerr << e.what() << std::endl;}
+	catch (const std::string& e) {std::cerr << e << std::endl;}
+	catch (const char* e) {std::cerr << e << std::endl;}
+	catch (...) {std::cerr << "unknown exception happened!" << std::endl;}
+
+	return 1;
+}
+
+template<typename T> int generate(const std::string& level, const std::string& name_space, const std::string& type_name,
+	const std::vector<std::string>& names, const std::vector<std::string>& statements)
+{
+	if ("O0" == level)
+		return generate<T, qme::O0>(name_space, type_name, names, statements);
+	else if ("O1" == level)
+		return generate<T, qme::O1>(name_space, type_name, names, statements);
+	else if ("O2" == level)
+		return generate<T, qme::O2>(name_space, type_name, names, statements);
+	else if ("O3" == level)
+		return generate<T, qme::O3>(name_space, type_name, names, statements);
+
+	std::cerr << "undefined optimization level " << level << std::endl;
+	return 1;
+}
+
+int main(int argc, const char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cerr << "usage: " << argv[0] << " <rule file> [namespace] [float|double|int|long long] [O0|O1|O2|O3]" << std::endl;
+		return 1;
+	}
+
+	std::ifstream file(argv[1]);
+	if (!file)
+	{
+		std::cerr << "cannot open " << argv[1] << std::endl;
+		return 1;
+	}
+
+	std::string name_space = argc > 2 ? argv[2] : "rules", type_name = argc > 3 ? argv[3] : "float", level = argc > 4 ? argv[4] : "O3";
+	//names used by the generated header
+	const char* const reserved[] = {"value_type", "wide_type", "function", "variable_count", "variable_names", "record", "divide", "raise",
+		"rule_count", "rule_names", "statements", "functions"};
+	std::vector<std::string> names, statements;
+	std::string line;
+	for (auto line_no = 1; std::getline(file, line); ++line_no)
+	{
+		auto first = line.find_first_not_of(" \t\r");
+		if (std::string::npos == first || '#' == line[first])
+			continue;
+
+		line.erase(line.find_last_not_of(" \t\r") + 1);
+		std::string name;
+		auto colon = line.find(':');
+		if (std::string::npos != colon)
+		{
+			name = line.substr(first, colon - first);
+			name.erase(name.find_last_not_of(" \t") + 1);
+			if (qme::generator<float>::is_identifier(name))
+				line.erase(0, colon + 1);
+			else
+				name.clear(); //the colon belongs to a question mark expression
+		}
+		if (name.empty())
+			name = "rule_" + std::to_string(names.size() + 1);
+
+		auto begin = line.find_first_not_of(" \t");
+		if (std::string::npos == begin)
+		{
+			std::cerr << "empty rule " << name << " at line " << line_no << std::endl;
+			return 1;
+		}
+		else if (std::end(reserved) != std::find(std::begin(reserved), std::end(reserved), name))
+		{
+			std::cerr << "reserved rule name " << name << " at line " << line_no << std::endl;
+			return 1;
+		}
+		else if (std::end(names) != std::find(std::begin(names), std::end(names), name))
+		{
+			std::cerr << "duplicated rule name " << name << " at line " << line_no << std::endl;
+			return 1;
+		}
+		names.push_back(name);
+		statements.push_back(line.substr(begin));
+	}
+
+	if ("float" == type_name)
+		return generate<float>(level, name_space, type_name, names, statements);
+	else if ("double" == type_name)
+		return generate<double>(level, name_space, type_name, names, statements);
+	else if ("int" == type_name)
+		return generate<int>(level, name_space, type_name, names, statements);
+	else if ("long long" == type_name)
+		return generate<long long>(level, name_space, type_name, names, statements);
+
+	std::cerr << "unsupported type " << type_name << std::endl;
+	return 1;
+}
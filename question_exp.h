@@ -1,30 +1,45 @@
+#ifndef _QUESTION_EXP_H_
+#define _QUESTION_EXP_H_
+
 
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 
 #include <type_traits>
+#include <typeinfo>
+#include <limits>
+#include <chrono>
+#include <sstream>
 #include <functional>
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <memory>
 #include <vector>
 #include <list>
 #include <map>
+#include <mutex>
 
 #if defined(_MSC_VER) && defined(_DEBUG) && !defined(DEBUG)
 #define DEBUG
 #endif
 
+//SIMD kernels for batch execution, define QME_NO_SIMD to disable them.
+#if !defined(QME_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QME_SIMD
+#endif
+
 namespace qme
 {
 
 //without any exchange between any data, nor merging of immediate values.
-class O0 {public: static int level() {return 0;}};
+class O0 {public: static constexpr int level() {return 0;}};
 
 //without any exchange between any data, but merge adjacent immediate values.
-class O1 {public: static int level() {return 1;}};
+class O1 {public: static constexpr int level() {return 1;}};
 
 //don't exchange the data order for divide operations, nor transform them to multiply operations, for example:
 // 'b / (b / 3)' will not be transformed to '3', because the latter never triggers divide zero for integer (1 ~ 8 bytes)
@@ -32,10 +47,10 @@ class O1 {public: static int level() {return 1;}};
 // 'a * 2 / 3' will not be transformed to 'a * (2 / 3)', because the latter will always be zero for integer (1 ~ 8 bytes)
 // 'a / 2 * 3' will not be transformed to '(3 / 2) * a'
 // '2 / a * 3' will not be transformed to '(2 * 3) / a'
-class O2 {public: static int level() {return 2;}};
+class O2 {public: static constexpr int level() {return 2;}};
 
 //full optimization
-class O3 {public: static int level() {return 3;}};
+class O3 {public: static constexpr int level() {return 3;}};
 
 /////////////////////////////////////////////////////////////////////////////////////////
 inline bool is_operator_1(char input) {return '+' == input || '-' == input;}
@@ -77,29 +92,550 @@ template<typename O> inline bool is_same_operator_level(char op_1, char op_2)
 		return (is_operator_1(op_1) && is_operator_1(op_2)) || (is_operator_2(op_1) && is_operator_2(op_2));
 	return (is_operator_1(op_1) && is_operator_1(op_2)) || ('*' == op_1 && '*' == op_2);
 }
+
+//operators carried by binary expressions, they're parsed from strings only once (at compile time).
+enum class operator_type : unsigned char
+{
+	add, sub, multi, div, //calculators
+	bigger, bigger_equal, smaller, smaller_equal, equal, not_equal, //comparers
+	logical_and, logical_or, //logical operators
+};
+
+inline bool is_calculator(operator_type op) {return op <= operator_type::div;}
+inline bool is_comparer(operator_type op) {return operator_type::bigger <= op && op <= operator_type::not_equal;}
+inline bool is_logical_operator(operator_type op) {return operator_type::logical_and <= op;}
+
+inline operator_type to_operator_type(char op)
+{
+	switch (op)
+	{
+	case '+': return operator_type::add;
+	case '-': return operator_type::sub;
+	case '*': return operator_type::multi;
+	case '/': return operator_type::div;
+	default: throw("undefined operator " + std::string(1, op));
+	}
+}
+
+inline operator_type to_operator_type(const std::string& op)
+{
+	if (1 == op.size())
+		switch (op.front())
+		{
+		case '>': return operator_type::bigger;
+		case '<': return operator_type::smaller;
+		default: return to_operator_type(op.front());
+		}
+	else if (">=" == op)
+		return operator_type::bigger_equal;
+	else if ("<=" == op)
+		return operator_type::smaller_equal;
+	else if ("==" == op)
+		return operator_type::equal;
+	else if ("!=" == op)
+		return operator_type::not_equal;
+	else if ("&&" == op)
+		return operator_type::logical_and;
+	else if ("||" == op)
+		return operator_type::logical_or;
+	else
+		throw("undefined operator " + op);
+}
+
+inline const std::string& to_string(operator_type op)
+{
+	static const std::string ops[] = {"+", "-", "*", "/", ">", ">=", "<", "<=", "==", "!=", "&&", "||"};
+	return ops[(size_t) op];
+}
+/////////////////////////////////////////////////////////////////////////////////////////
+
+//assign each distinct variable a dense slot (0, 1, 2, ...), then expressions can be executed with an array of values indexed by
+// these slots instead of a callback which will be invoked with variable names.
+class symbol_table
+{
+public:
+	static const size_t npos = (size_t) -1;
+
+public:
+	size_t insert(const std::string& variable_name) //return the slot of the variable, assign a new one if it's absent
+	{
+		auto re = slots.insert(std::make_pair(variable_name, variable_names.size()));
+		if (re.second)
+			variable_names.push_back(variable_name);
+		return re.first->second;
+	}
+
+	size_t find(const std::string& variable_name) const
+		{auto iter = slots.find(variable_name); return iter == std::end(slots) ? npos : iter->second;}
+
+	bool empty() const {return variable_names.empty();}
+	size_t size() const {return variable_names.size();}
+	const std::string& operator[](size_t slot) const {return variable_names[slot];}
+	const std::vector<std::string>& names() const {return variable_names;}
+	void clear() {variable_names.clear(); slots.clear();}
+
+private:
+	std::vector<std::string> variable_names;
+	std::map<std::string, size_t> slots;
+};
+/////////////////////////////////////////////////////////////////////////////////////////
+
+//a callback which fetches each distinct variable at most once and reuses the value for all of its occurrences, values are cached
+// in this object, so use a new one (or reset it) for each evaluation, for example:
+// (*exp)(qme::fetch_once<float>(cb)) or qme::safe_data(exp, qme::fetch_once<float>(cb))
+template <typename T> class fetch_once
+{
+public:
+	fetch_once(const std::function<T(const std::string&)>& _cb) : cb(_cb) {}
+
+	T operator()(const std::string& variable_name) const
+	{
+		auto iter = values.find(variable_name);
+		if (iter == std::end(values))
+			iter = values.insert(std::make_pair(variable_name, cb(variable_name))).first;
+		return iter->second;
+	}
+
+	void reset() {values.clear();}
+
+private:
+	std::function<T(const std::string&)> cb;
+	mutable std::map<std::string, T> values;
+};
 /////////////////////////////////////////////////////////////////////////////////////////
 
+//kernels which handle a whole block of rows during batch execution, for float and double, SIMD instructions will be used if
+// supported by the CPU (checked at runtime), so the same binary can run on CPUs with different instruction sets.
+enum class simd_isa {scalar, sse2, avx2, avx512};
+
+inline simd_isa best_simd_isa()
+{
+#ifdef QME_SIMD
+	static const simd_isa isa = (__builtin_cpu_init(),
+		__builtin_cpu_supports("avx512f") ? simd_isa::avx512 :
+		__builtin_cpu_supports("avx2") ? simd_isa::avx2 :
+		__builtin_cpu_supports("sse2") ? simd_isa::sse2 : simd_isa::scalar);
+	return isa;
+#else
+	return simd_isa::scalar;
+#endif
+}
+
+template <typename T> struct scalar_kernels
+{
+	static void add(T* out, const T* r, size_t num) {for (size_t n = 0; n < num; ++n) out[n] += r[n];}
+	static void sub(T* out, const T* r, size_t num) {for (size_t n = 0; n < num; ++n) out[n] -= r[n];}
+	static void multi(T* out, const T* r, size_t num) {for (size_t n = 0; n < num; ++n) out[n] *= r[n];}
+	static void div(T* out, const T* r, size_t num) {for (size_t n = 0; n < num; ++n) out[n] /= r[n];}
+	static void bigger(T* out, const T* r, size_t num) {for (size_t n = 0; n < num; ++n) out[n] = (T) (out[n] > r[n]);}
+	static void bigger_equal(T* out, const T* r, size_t num) {for (size_t n = 0; n < num; ++n) out[n] = (T) (out[n] >= r[n]);}
+	static void smaller(T* out, const T* r, size_t num) {for (size_t n = 0; n < num; ++n) out[n] = (T) (out[n] < r[n]);}
+	static void smaller_equal(T* out, const T* r, size_t num) {for (size_t n = 0; n < num; ++n) out[n] = (T) (out[n] <= r[n]);}
+	static void equal(T* out, const T* r, size_t num) {for (size_t n = 0; n < num; ++n) out[n] = (T) (out[n] == r[n]);}
+	static void not_equal(T* out, const T* r, size_t num) {for (size_t n = 0; n < num; ++n) out[n] = (T) (out[n] != r[n]);}
+	static bool has_zero(const T* r, size_t num) {for (size_t n = 0; n < num; ++n) if (0 == r[n]) return true; return false;}
+	static void select(T* out, const T* j, const T* l, const T* r, size_t num)
+		{for (size_t n = 0; n < num; ++n) out[n] = 0 != j[n] ? l[n] : r[n];}
+	static size_t filter(T* m, const T* mask, const T* j, size_t num)
+	{
+		size_t active = 0;
+		for (size_t n = 0; n < num; ++n)
+			active += (size_t) (0 != (m[n] = (T) ((nullptr == mask || 0 != mask[n]) && 0 != j[n])));
+		return active;
+	}
+	static size_t filter_not(T* m, const T* mask, const T* j, size_t num)
+	{
+		size_t active = 0;
+		for (size_t n = 0; n < num; ++n)
+			active += (size_t) (0 != (m[n] = (T) ((nullptr == mask || 0 != mask[n]) && 0 == j[n])));
+		return active;
+	}
+};
+
+#ifdef QME_SIMD
+//out[n] = out[n] op r[n], a and b are the operands (vectors or scalars).
+#define QME_SIMD_CALCULATOR(target_name, name, vector_exp, scalar_exp) \
+	__attribute__((target(target_name))) static void name(T* out, const T* r, size_t num) \
+	{ \
+		size_t n = 0; \
+		for (vec a, b; n + width <= num; n += width) \
+		{ \
+			memcpy(&a, out + n, sizeof(vec)); \
+			memcpy(&b, r + n, sizeof(vec)); \
+			a = vector_exp; \
+			memcpy(out + n, &a, sizeof(vec)); \
+		} \
+		for (T a, b; n < num; ++n) \
+		{ \
+			a = out[n]; \
+			b = r[n]; \
+			out[n] = scalar_exp; \
+		} \
+	}
+
+//m[n] = active(n) && j[n] op 0, return the number of rows which are still active.
+#define QME_SIMD_FILTER(target_name, name, op) \
+	__attribute__((target(target_name))) static size_t name(T* m, const T* mask, const T* j, size_t num) \
+	{ \
+		size_t n = 0; \
+		vec active = vec(); \
+		for (vec a, c; n + width <= num; n += width) \
+		{ \
+			memcpy(&c, j + n, sizeof(vec)); \
+			auto x = c op vec(); \
+			if (nullptr != mask) \
+			{ \
+				memcpy(&a, mask + n, sizeof(vec)); \
+				x &= a != vec(); \
+			} \
+			a = to_judgment(x); \
+			active += a; \
+			memcpy(m + n, &a, sizeof(vec)); \
+		} \
+		size_t re = 0; \
+		for (size_t i = 0; i < width; ++i) \
+			re += (size_t) active[i]; \
+		for (; n < num; ++n) \
+			re += (size_t) (0 != (m[n] = (T) ((nullptr == mask || 0 != mask[n]) && 0 op j[n]))); \
+		return re; \
+	}
+
+//judgments are lane masks (all bits are set or not) inside the kernels, they will be transformed to 1 or 0 before storing.
+#define QME_SIMD_KERNELS(isa_name, target_name, bytes) \
+template <typename T> struct isa_name \
+{ \
+	typedef T vec __attribute__((vector_size(bytes))); \
+	typedef decltype(vec() != vec()) mask; \
+	static const size_t width = bytes / sizeof(T); \
+\
+	__attribute__((target(target_name), always_inline)) static inline vec to_judgment(mask m) \
+		{return (vec) (m & (mask) (vec() + (T) 1));} \
+\
+	QME_SIMD_CALCULATOR(target_name, add, a + b, a + b) \
+	QME_SIMD_CALCULATOR(target_name, sub, a - b, a - b) \
+	QME_SIMD_CALCULATOR(target_name, multi, a * b, a * b) \
+	QME_SIMD_CALCULATOR(target_name, div, a / b, a / b) \
+	QME_SIMD_CALCULATOR(target_name, bigger, to_judgment(a > b), (T) (a > b)) \
+	QME_SIMD_CALCULATOR(target_name, bigger_equal, to_judgment(a >= b), (T) (a >= b)) \
+	QME_SIMD_CALCULATOR(target_name, smaller, to_judgment(a < b), (T) (a < b)) \
+	QME_SIMD_CALCULATOR(target_name, smaller_equal, to_judgment(a <= b), (T) (a <= b)) \
+	QME_SIMD_CALCULATOR(target_name, equal, to_judgment(a == b), (T) (a == b)) \
+	QME_SIMD_CALCULATOR(target_name, not_equal, to_judgment(a != b), (T) (a != b)) \
+\
+	__attribute__((target(target_name))) static bool has_zero(const T* r, size_t num) \
+	{ \
+		size_t n = 0; \
+		mask zero = mask(); \
+		for (vec b; n + width <= num; n += width) \
+		{ \
+			memcpy(&b, r + n, sizeof(vec)); \
+			zero |= b == vec(); \
+		} \
+		for (size_t i = 0; i < width; ++i) \
+			if (0 != zero[i]) \
+				return true; \
+		for (; n < num; ++n) \
+			if (0 == r[n]) \
+				return true; \
+		return false; \
+	} \
+	__attribute__((target(target_name))) static void select(T* out, const T* j, const T* l, const T* r, size_t num) \
+	{ \
+		size_t n = 0; \
+		for (vec a, b, c; n + width <= num; n += width) \
+		{ \
+			memcpy(&a, l + n, sizeof(vec)); \
+			memcpy(&b, r + n, sizeof(vec)); \
+			memcpy(&c, j + n, sizeof(vec)); \
+			mask m = c != vec(); \
+			a = (vec) (((mask) a & m) | ((mask) b & ~m)); \
+			memcpy(out + n, &a, sizeof(vec)); \
+		} \
+		for (; n < num; ++n) \
+			out[n] = 0 != j[n] ? l[n] : r[n]; \
+	} \
+	QME_SIMD_FILTER(target_name, filter, !=) \
+	QME_SIMD_FILTER(target_name, filter_not, ==) \
+};
+
+QME_SIMD_KERNELS(sse2_kernels, "sse2", 16)
+QME_SIMD_KERNELS(avx2_kernels, "avx2", 32)
+QME_SIMD_KERNELS(avx512_kernels, "avx512f", 64)
+#undef QME_SIMD_KERNELS
+#undef QME_SIMD_CALCULATOR
+#undef QME_SIMD_FILTER
+#endif
+
+template <typename T> struct kernels
+{
+	typedef void (*calculator)(T* out, const T* r, size_t num); //out[n] = out[n] op r[n], comparisons get 1 or 0
+	calculator add, sub, multi, div, bigger, bigger_equal, smaller, smaller_equal, equal, not_equal;
+	bool (*has_zero)(const T* r, size_t num);
+	void (*select)(T* out, const T* j, const T* l, const T* r, size_t num); //out[n] = 0 != j[n] ? l[n] : r[n]
+	//m[n] = active(n) && 0 != j[n] (or 0 == j[n] for filter_not), masks are judgments, nullptr means all rows are active,
+	// return the number of rows which are still active.
+	size_t (*filter)(T* m, const T* mask, const T* j, size_t num);
+	size_t (*filter_not)(T* m, const T* mask, const T* j, size_t num);
+
+	template <template <typename> class K> static kernels make()
+	{
+		kernels k = {&K<T>::add, &K<T>::sub, &K<T>::multi, &K<T>::div,
+			&K<T>::bigger, &K<T>::bigger_equal, &K<T>::smaller, &K<T>::smaller_equal, &K<T>::equal, &K<T>::not_equal,
+			&K<T>::has_zero, &K<T>::select, &K<T>::filter, &K<T>::filter_not};
+		return k;
+	}
+
+	static const kernels& get(simd_isa isa) {return get(isa, std::integral_constant<bool,
+		std::is_same<T, float>::value || std::is_same<T, double>::value>());}
+
+private:
+	static const kernels& get(simd_isa, std::false_type) {static const kernels k = make<scalar_kernels>(); return k;}
+	static const kernels& get(simd_isa isa, std::true_type)
+	{
+#ifdef QME_SIMD
+		static const kernels k[] = {make<scalar_kernels>(), make<sse2_kernels>(), make<avx2_kernels>(), make<avx512_kernels>()};
+		return k[(int) std::min(isa, best_simd_isa())];
+#else
+		return get(isa, std::false_type());
+#endif
+	}
+};
+
+//the context of batch execution (see batch_data), rows are handled block by block, and each expression handles a whole block at a time.
+template <typename T> class batch
+{
+public:
+	static const size_t block_size = 256;
+
+	//a temporary buffer which can hold a whole block, it must be released in the reverse order of acquisition (just define it as
+	// a local variable).
+	class buffer
+	{
+	public:
+		buffer(batch& _b) : b(_b), data(b.acquire()) {}
+		~buffer() {b.release();}
+
+		operator T*() const {return data;}
+
+	private:
+		batch& b;
+		T* data;
+	};
+
+public:
+	batch(const T* const* _columns, simd_isa isa = best_simd_isa()) :
+		columns(_columns), first(0), num(0), used(0), k(kernels<T>::get(isa)) {}
+
+	const kernels<T>& get_kernels() const {return k;}
+
+	void select(size_t _first, size_t _num) {assert(_num <= block_size); first = _first; num = _num;}
+	const T* column(size_t slot) const {return columns[slot] + first;} //indexed by slots, see symbol_table for more details
+	size_t size() const {return num;}
+
+private:
+	T* acquire() {if (used == buffers.size()) buffers.emplace_back(block_size); return buffers[used++].data();}
+	void release() {assert(used > 0); --used;}
+
+private:
+	const T* const* columns;
+	size_t first, num, used;
+	std::vector<std::vector<T>> buffers;
+	const kernels<T>& k;
+};
+template <typename T> const size_t batch<T>::block_size;
+
+//nodes of an expression are bump-allocated from an arena during its compilation (see compiler::compile), they will not be
+// deallocated one by one, instead, all memory of the arena will be freed at once after all nodes have been destroyed.
+class arena
+{
+public:
+	static const size_t chunk_size = 16 * 1024;
+
+	//make an arena the current one of this thread during the life cycle of the scope.
+	class scope
+	{
+	public:
+		scope(const std::shared_ptr<arena>& a) : previous(current()) {current() = a;}
+		~scope() {current() = previous;}
+
+	private:
+		std::shared_ptr<arena> previous;
+	};
+
+	static std::shared_ptr<arena>& current() {static thread_local std::shared_ptr<arena> a; return a;}
+
+public:
+	arena() : used(chunk_size), total(0) {}
+	arena(const arena&) = delete;
+	arena& operator=(const arena&) = delete;
+
+	void* allocate(size_t bytes, size_t alignment)
+	{
+		total += bytes;
+		if (bytes > chunk_size / 4) //big block, allocate it separately and keep using current chunk
+		{
+			big_blocks.emplace_back(new char[bytes]);
+			return big_blocks.back().get();
+		}
+
+		used = (used + alignment - 1) & ~(alignment - 1);
+		if (used + bytes > chunk_size)
+		{
+			chunks.emplace_back(new char[chunk_size]);
+			used = 0;
+		}
+
+		auto re = std::next(chunks.back().get(), used);
+		used += bytes;
+		return re;
+	}
+
+	size_t size() const {return total;} //allocated bytes
+
+private:
+	std::vector<std::unique_ptr<char[]>> chunks; //the last one is the current chunk
+	std::vector<std::unique_ptr<char[]>> big_blocks;
+	size_t used, total;
+};
+
+template <typename U> class arena_allocator
+{
+public:
+	typedef U value_type;
+
+	arena_allocator(const std::shared_ptr<arena>& _a) : a(_a) {}
+	template <typename V> arena_allocator(const arena_allocator<V>& other) : a(other.get_arena()) {}
+
+	U* allocate(size_t n) {return static_cast<U*>(a->allocate(n * sizeof(U), alignof(U)));}
+	void deallocate(U*, size_t) {} //the whole arena will be freed at once
+
+	const std::shared_ptr<arena>& get_arena() const {return a;}
+	template <typename V> bool operator==(const arena_allocator<V>& other) const {return a == other.get_arena();}
+	template <typename V> bool operator!=(const arena_allocator<V>& other) const {return a != other.get_arena();}
+
+private:
+	std::shared_ptr<arena> a;
+};
+
+//create an expression in the current arena of this thread, or on the heap if there's no current arena.
+template <typename E, typename... ARGS> inline std::shared_ptr<E> make_exp(ARGS&&... args)
+{
+	auto& a = arena::current();
+	return a ? std::allocate_shared<E>(arena_allocator<E>(a), std::forward<ARGS>(args)...) : std::make_shared<E>(std::forward<ARGS>(args)...);
+}
+
+//raise values to integer exponents, small exponents are handled by multiplications (exponentiation by squaring) and reciprocals,
+// libm pow is only used for big exponents and negative exponents of integers. float is raised in double precision just like pow,
+// so its results are the same as pow's (except rare double rounding with exponentiation by squaring), but double has no wider
+// type, the results of cube and by_squaring can differ from pow's by rounding in the last bit.
+//integers are multiplied as unsigned long long, so overflows wrap around instead of undefined behaviour.
+template <typename T> struct power
+{
+	typedef typename std::conditional<std::is_same<T, float>::value, double,
+		typename std::conditional<std::is_integral<T>::value, unsigned long long, T>::type>::type wide_type;
+	typedef T (*function)(T, int);
+	static const int max_small_exponent = 32;
+
+	static T zero(T, int) {return 1;}
+	static T one(T v, int) {return v;}
+	static T square(T v, int) {auto w = (wide_type) v; return (T) (w * w);}
+	static T cube(T v, int) {auto w = (wide_type) v; return (T) (w * w * w);}
+	static T reciprocal(T v, int) {return (T) (1 / (wide_type) v);}
+	static T by_squaring(T v, int exponent)
+	{
+		wide_type base = v, re = 1;
+		for (auto n = exponent < 0 ? -exponent : exponent; n > 0; n >>= 1, base *= base)
+			if (n & 1)
+				re *= base;
+		return (T) (exponent < 0 ? 1 / re : re);
+	}
+	static T libm(T v, int exponent) {return (T) pow(v, exponent);}
+
+	//select the function once (at compile time) for an exponent.
+	static function get(int exponent)
+	{
+		if (exponent < 0 && !std::is_floating_point<T>::value)
+			return &libm;
+
+		switch (exponent)
+		{
+		case 0: return &zero;
+		case 1: return &one;
+		case 2: return &square;
+		case 3: return &cube;
+		case -1: return &reciprocal;
+		default: return exponent >= -max_small_exponent && exponent <= max_small_exponent ? &by_squaring : &libm;
+		}
+	}
+
+	static T raise(T v, int exponent) {return get(exponent)(v, exponent);}
+	static void raise(const T* in, T* out, size_t num, int exponent) //the loops of the most common exponents can be vectorized
+	{
+		auto f = get(exponent);
+		if (&square == f)
+			for (size_t n = 0; n < num; ++n)
+				out[n] = square(in[n], exponent);
+		else if (&cube == f)
+			for (size_t n = 0; n < num; ++n)
+				out[n] = cube(in[n], exponent);
+		else if (&reciprocal == f)
+			for (size_t n = 0; n < num; ++n)
+				out[n] = reciprocal(in[n], exponent);
+		else
+			for (size_t n = 0; n < num; ++n)
+				out[n] = f(in[n], exponent);
+	}
+};
+
+template <typename T> inline bool to_not(T& operand) {return (bool) (operand = (T) (0 == operand));}
+template <typename T> inline bool to_bool(T& operand) {return (bool) (operand = (T) (0 != operand));}
+template <typename T> inline T negate(T& operand) {return operand = -operand;}
+
+//variables in an expression are recorded in a 64 bits mask (bit 0 is for immediate values, others are for variables hashed by their
+// names), different variables may share the same bit, so it only tells which variables cannot be found in the expression.
+inline uint64_t to_variable_mask(const std::string& variable_name) {return (uint64_t) 2 << std::hash<std::string>()(variable_name) % 63;}
+
 template <typename T> class exp;
 template <typename T> using exp_type = std::shared_ptr<exp<T>>;
 template <typename T> using exp_ctype = const exp_type<T>;
 template <typename T> class negative_data_exp;
 template <typename T> class not_judge_exp;
+//expressions are only changed during their compilation (and by functions which take exp_type<T>& like final_optimize or
+// apply_bounds), a compiled expression is immutable: data and judge (all overloads) never change any node and keep no state
+// in them, so they're reentrant and one expression can be executed by many threads at the same time, so are qme::program
+// and qme::jit. the callback and the context (see eval_context, batch, fetch_once and profiler) of an execution must not be
+// shared by threads.
 template <typename T> class exp
 {
 public:
-	static inline bool final_optimize_1(exp_type<T>& exp) {auto e = exp->final_optimize(); return e ? (exp = e, true) : false;}
-	static inline exp_type<T> final_optimize_1(exp_type<T>& exp, const std::function<exp_type<T>(exp_ctype<T>&)>& transformer)
-		{final_optimize_1(exp); return transformer(exp);}
-	static inline bool final_optimize_2(exp_type<T>& exp_l, exp_type<T>& exp_r)
-		{auto re = final_optimize_1(exp_l); return final_optimize_1(exp_r) || re;}
-	static inline exp_type<T> final_optimize_2(exp_type<T>& exp_l, exp_type<T>& exp_r, const std::function<exp_type<T>(exp_ctype<T>&, exp_ctype<T>&)>& transformer)
-		{final_optimize_1(exp_l); final_optimize_1(exp_r); return transformer(exp_l, exp_r);}
-
 	static inline exp_ctype<T>& null() {static exp_ctype<T> na; return na;}
 
 protected:
 	virtual ~exp() {}
 
+	//called by destructors to release sub expressions without recursion, then expressions with any depth can be destroyed
+	// directly, safe_delete is not needed anymore.
+	static void release(exp_type<T>& exp)
+	{
+		if (!exp || exp.use_count() > 1)
+			return;
+
+		static thread_local std::vector<exp_type<T>> releasing;
+		static thread_local bool draining = false;
+		releasing.push_back(std::move(exp));
+		if (draining) //called by the following loop (via destructors)
+			return;
+
+		draining = true;
+		while (!releasing.empty())
+		{
+			auto e = std::move(releasing.back());
+			releasing.pop_back();
+			e.reset(); //may push more expressions into releasing
+		}
+		draining = false;
+	}
+
 public:
 	inline bool is_judge() const {return !is_data();}
 	inline bool is_selector() const {return (bool) get_road_map();} //selector always has left item, which means it's a parent node
@@ -109,40 +645,61 @@ public:
 	inline bool is_valid() const //after safe_delete, this check is not right anymore, you may still get a positive result
 		{return is_judge() ? (bool) get_left_item() : get_road_map() ? get_left_item() && get_right_item() : get_left_item() ? true : !get_right_item();}
 	inline T operator()(const std::function<T(const std::string&)>& cb) const {return data(cb);}
+	inline T operator()(const T* values) const {return data(values);} //values are indexed by slots, see symbol_table for more details
 
 	virtual bool is_data() const = 0;
 	virtual bool is_composite() const {return false;} //used for O::level() < 2 to avoid recursion, operator, left item and right item must be valid
 	virtual bool is_reverser() const {return false;} //true to false, value to -value, and vice versa, just left item is valid
 	virtual bool need_to_bool() const {return false;} //value to bool (via (bool) (0 != value)), just left item is valid
-	virtual int get_depth() const {return 1;}
 	virtual void show_immediate_value() const {}
+	//following properties are cached by parent expressions, see update
+	virtual int get_depth() const {return 1;}
+	virtual size_t get_node_count() const {return 1;} //shared sub expressions are counted repeatedly
+	virtual uint64_t get_variable_mask() const {return 0;} //see to_variable_mask
 
 	virtual exp_type<T> clone() const = 0;
 	virtual const std::string& get_operator() const {throw("unsupported get operator operation");} // * / + - > >= < <= == != && ||
+	virtual operator_type get_operator_type() const {throw("unsupported get operator operation");}
 	virtual exp_ctype<T>& get_road_map() const {return null();}
 	virtual exp_ctype<T>& get_left_item() const {return null();}
 	virtual exp_ctype<T>& get_right_item() const {return null();}
 
 	virtual T data(const std::function<T(const std::string&)>&) const = 0;
 	virtual bool judge(const std::function<T(const std::string&)>&) const = 0;
-	virtual exp_type<T> to_negative() const {return std::make_shared<negative_data_exp<T>>(clone());}
-	virtual exp_type<T> bang() const {return std::make_shared<not_judge_exp<T>>(clone());}
+	virtual T data(const T*) const = 0;
+	virtual bool judge(const T*) const = 0;
+	//handle a block of rows at a time, only active rows (0 != mask[n]) need to be handled, nullptr means all rows are active,
+	// outcomes of other rows are undefined.
+	virtual void data(batch<T>&, const T* mask, T* out) const = 0;
+	virtual void judge(batch<T>&, const T* mask, T* out) const = 0; //outcomes are 0 or 1
+	virtual exp_type<T> to_negative() const {return make_exp<negative_data_exp<T>>(clone());}
+	virtual exp_type<T> bang() const {return make_exp<not_judge_exp<T>>(clone());}
 
 	virtual void clear() {}
-	virtual exp_type<T> final_optimize() {return exp_type<T>();} //may return a new expression, or change myself directly
+	virtual void replace_items(const std::function<void(exp_type<T>&)>&) {} //replacer may replace road map, left and right items
+	//recalculate cached properties from sub expressions, must be called after any of them has been replaced or changed,
+	// and then for all ancestors bottom up (expressions never know their parents).
+	virtual void update() {}
+	//called after all sub expressions have been optimized (see qme::final_optimize), the parameter tells whether any of them
+	// has been replaced, may return a new expression, or change myself directly.
+	virtual exp_type<T> final_optimize(bool) {return exp_type<T>();}
 
 	//for data expression only
 	/////////////////////////////////////////////////////////////////////////////////////////
 	virtual bool is_immediate() const {return false;}
+	virtual bool is_variable() const {return false;}
 	virtual bool is_composite_variable() const {return false;}
 	//whether this expression can be transformed to negative without introducing negation operations, for example '2 * a' to '-2 * a' or
 	//with reducing existed negation operations, for example '-a to a'.
 	virtual bool is_easy_to_negative() const {return false;}
 	virtual bool is_negative() const {return false;} //needs negation operation at runtime
 	virtual T get_immediate_value() const {throw("unsupported get immediate value operation!");} //valid if is_immediate()
-	virtual int get_exponent() const {throw("unsupported get exponent operation!");} //valid if is_composite_variable()
-	virtual T get_multiplier() const {throw("unsupported get multiplier operation!");} //valid if is_composite_variable()
-	virtual const std::string& get_variable_name() const {throw("unsupported get variable name operation!");} //valid if is_composite_variable()
+	virtual int get_exponent() const {throw("unsupported get exponent operation!");} //valid if is_variable()
+	virtual T get_multiplier() const {throw("unsupported get multiplier operation!");} //valid if is_variable()
+	virtual const std::string& get_variable_name() const {throw("unsupported get variable name operation!");} //valid if is_variable()
+	virtual size_t get_slot() const {throw("unsupported get slot operation!");} //valid if is_variable()
+	virtual void bind(size_t) {throw("unsupported bind operation!");} //valid if is_variable()
+	virtual void freeze() {throw("unsupported freeze operation!");} //valid if is_variable(), the slot can't be changed anymore
 
 	virtual bool merge_with(char, exp_ctype<T>&) {return false;}
 	virtual bool merge_with(exp_ctype<T>&, char) {return false;}
@@ -154,42 +711,63 @@ public:
 template <typename T, template <typename> class EXP> class unitary_exp : public EXP<T>
 {
 protected:
-	unitary_exp(exp_ctype<T>& _exp_l) : exp_l(_exp_l) {}
+	unitary_exp(exp_ctype<T>& _exp_l) : exp_l(_exp_l) {update();}
+	~unitary_exp() {exp<T>::release(exp_l);}
 
 	exp_type<T>& left() {return exp_l;}
 
 public:
-	virtual int get_depth() const {return 1 + exp_l->get_depth();}
 	virtual void show_immediate_value() const {exp_l->show_immediate_value();}
+	virtual int get_depth() const {return depth;}
+	virtual size_t get_node_count() const {return node_count;}
+	virtual uint64_t get_variable_mask() const {return variable_mask;}
 	virtual exp_ctype<T>& get_left_item() const {return exp_l;}
 
 	virtual void clear() {exp_l.reset();}
+	virtual void replace_items(const std::function<void(exp_type<T>&)>& replacer) {replacer(exp_l);}
+	virtual void update() {depth = 1 + exp_l->get_depth(); node_count = 1 + exp_l->get_node_count(); variable_mask = exp_l->get_variable_mask();}
 
 private:
 	exp_type<T> exp_l;
+	int depth;
+	size_t node_count;
+	uint64_t variable_mask;
 };
 
 template <typename T, template <typename> class EXP> class binary_exp : public EXP<T>
 {
 protected:
-	binary_exp(exp_ctype<T>& _exp_l, exp_ctype<T>& _exp_r, char c) : op(1, c), exp_l(_exp_l), exp_r(_exp_r) {}
-	binary_exp(exp_ctype<T>& _exp_l, exp_ctype<T>& _exp_r, const std::string& _op) : op(_op), exp_l(_exp_l), exp_r(_exp_r) {}
+	binary_exp(exp_ctype<T>& _exp_l, exp_ctype<T>& _exp_r, operator_type _op) : op(_op), exp_l(_exp_l), exp_r(_exp_r) {update();}
+	~binary_exp() {exp<T>::release(exp_l); exp<T>::release(exp_r);}
 
 	exp_type<T>& left() {return exp_l;}
 	exp_type<T>& right() {return exp_r;}
 
 public:
-	virtual int get_depth() const {return 1 + std::max(exp_l->get_depth(), exp_r->get_depth());}
 	virtual void show_immediate_value() const {exp_l->show_immediate_value(); exp_r->show_immediate_value();}
-	virtual const std::string& get_operator() const {return op;}
+	virtual int get_depth() const {return depth;}
+	virtual size_t get_node_count() const {return node_count;}
+	virtual uint64_t get_variable_mask() const {return variable_mask;}
+	virtual const std::string& get_operator() const {return to_string(op);}
+	virtual operator_type get_operator_type() const {return op;}
 	virtual exp_ctype<T>& get_left_item() const {return exp_l;}
 	virtual exp_ctype<T>& get_right_item() const {return exp_r;}
 
 	virtual void clear() {exp_l.reset(); exp_r.reset();}
+	virtual void replace_items(const std::function<void(exp_type<T>&)>& replacer) {replacer(exp_l); replacer(exp_r);}
+	virtual void update()
+	{
+		depth = 1 + std::max(exp_l->get_depth(), exp_r->get_depth());
+		node_count = 1 + exp_l->get_node_count() + exp_r->get_node_count();
+		variable_mask = exp_l->get_variable_mask() | exp_r->get_variable_mask();
+	}
 
 private:
-	std::string op;
+	operator_type op;
 	exp_type<T> exp_l, exp_r;
+	int depth;
+	size_t node_count;
+	uint64_t variable_mask;
 };
 
 template <typename T> class data_exp;
@@ -200,6 +778,9 @@ template <typename T> class data_exp : public exp<T>
 public:
 	virtual bool is_data() const {return true;}
 	virtual bool judge(const std::function<T(const std::string&)>& cb) const {return 0 != (*this)(cb);}
+	virtual bool judge(const T* values) const {return 0 != (*this)(values);}
+	virtual void judge(batch<T>& b, const T* mask, T* out) const
+		{this->data(b, mask, out); for (size_t n = 0; n < b.size(); ++n) to_bool(out[n]);}
 };
 
 template <typename T> class judge_exp;
@@ -210,6 +791,8 @@ template <typename T> class judge_exp : public exp<T>
 public:
 	virtual bool is_data() const {return false;}
 	virtual T data(const std::function<T(const std::string&)>& cb) const {return (T) this->judge(cb);}
+	virtual T data(const T* values) const {return (T) this->judge(values);}
+	virtual void data(batch<T>& b, const T* mask, T* out) const {this->judge(b, mask, out);}
 };
 
 /////////////////////////////////////////////////////////////////////////////////////////
@@ -239,35 +822,41 @@ public:
 
 	virtual T data(const std::function<T(const std::string&)>& cb) const {return -(*this->get_left_item())(cb);}
 	virtual bool judge(const std::function<T(const std::string&)>& cb) const {return this->get_left_item()->judge(cb);} //equals to 0 != data(cb), but more effective
+	virtual T data(const T* values) const {return -(*this->get_left_item())(values);}
+	virtual bool judge(const T* values) const {return this->get_left_item()->judge(values);}
+	virtual void data(batch<T>& b, const T* mask, T* out) const
+		{this->get_left_item()->data(b, mask, out); for (size_t n = 0; n < b.size(); ++n) negate(out[n]);}
+	virtual void judge(batch<T>& b, const T* mask, T* out) const {this->get_left_item()->judge(b, mask, out);}
 	virtual exp_type<T> to_negative() const {return this->get_left_item();}
 	virtual exp_type<T> bang() const //'!(-!a)' equals to 'a?', '!(-a)' equals to '!a'
-		{auto& exp_l = this->get_left_item(); return not_judge_exp<T>::is_my_type(exp_l) ? exp_l->bang() : std::make_shared<not_judge_exp<T>>(exp_l);}
+		{auto& exp_l = this->get_left_item(); return not_judge_exp<T>::is_my_type(exp_l) ? exp_l->bang() : make_exp<not_judge_exp<T>>(exp_l);}
 
-	virtual exp_type<T> final_optimize() //'-(-a)' equals to 'a'
-		{return exp<T>::final_optimize_1(this->left(), [](exp_ctype<T>& l) {return is_my_type(l) ? l->to_negative() : exp_type<T>();});}
+	virtual exp_type<T> final_optimize(bool) //'-(-a)' equals to 'a'
+		{auto& exp_l = this->get_left_item(); return is_my_type(exp_l) ? exp_l->to_negative() : exp_type<T>();}
 
 	virtual bool is_easy_to_negative() const {return true;}
 	virtual bool is_negative() const {return true;}
 };
 
-template <typename T> inline T calculate(T& operand, char op, T v)
+template <typename T> inline T calculate(T& operand, operator_type op, T v)
 {
 	switch (op)
 	{
-	case '+':
+	case operator_type::add:
 		return operand += v;
-	case '-':
+	case operator_type::sub:
 		return operand -= v;
-	case '*':
+	case operator_type::multi:
 		return operand *= v;
-	case '/':
+	case operator_type::div:
 		if (0 == v)
 			throw("divide zero");
 		return operand /= v;
 	default:
-		throw("undefined operator " + std::string(1, op));
+		throw("undefined operator " + to_string(op));
 	}
 }
+template <typename T> inline T calculate(T& operand, char op, T v) {return calculate(operand, to_operator_type(op), v);}
 
 template <typename T> class immediate_data_exp : public data_exp<T>
 {
@@ -275,7 +864,7 @@ public:
 	immediate_data_exp(T v) : value(v) {}
 
 	virtual void show_immediate_value() const {std::cout << ' ' << value;}
-	exp_type<T> clone() const {return std::make_shared<immediate_data_exp<T>>(value);}
+	exp_type<T> clone() const {return make_exp<immediate_data_exp<T>>(value);}
 	virtual T data(const std::function<T(const std::string&)>&) const
 	{
 #ifdef DEBUG
@@ -283,8 +872,11 @@ public:
 #endif
 		return value;
 	}
-	virtual exp_type<T> to_negative() const {return std::make_shared<immediate_data_exp<T>>(-value);} //more effective than exp<T>::to_negative()
+	virtual T data(const T*) const {return value;}
+	virtual void data(batch<T>& b, const T*, T* out) const {std::fill_n(out, b.size(), value);}
+	virtual exp_type<T> to_negative() const {return make_exp<immediate_data_exp<T>>(-value);} //more effective than exp<T>::to_negative()
 
+	virtual uint64_t get_variable_mask() const {return 1;}
 	virtual bool is_immediate() const {return true;}
 	virtual bool is_easy_to_negative() const {return true;}
 	virtual T get_immediate_value() const {return value;}
@@ -301,157 +893,266 @@ template <typename T, typename O> inline exp_type<T> merge_data_exp(exp_ctype<T>
 template <typename T, typename O> inline exp_type<T> make_binary_data_exp(exp_ctype<T>&, exp_ctype<T>&, char);
 template <typename T, typename O> class binary_data_exp : public binary_exp<T, data_exp>
 {
+public:
+	static inline bool is_my_type(exp_ctype<T>& exp) {return exp->is_data() && exp->is_composite();}
+
 protected:
-	using binary_exp<T, data_exp>::binary_exp;
+	binary_data_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r, operator_type op) : binary_exp<T, data_exp>(exp_l, exp_r, op) {update_negativity();}
 
 public:
 	virtual bool is_composite() const {return true;}
 	virtual exp_type<T> clone() const {return make_binary_data_exp<T, O>(this->get_left_item(), this->get_right_item(), this->get_operator().front());}
 
+	//negate one of the sub expressions level by level (without recursion) until it's not a binary_data_exp, then merge
+	// the outcome with the other sub expressions bottom up.
 	virtual exp_type<T> to_negative() const
 	{
-		auto op = this->get_operator().front();
-		const auto& exp_l = this->get_left_item();
-		const auto& exp_r = this->get_right_item();
-		switch (op)
+		struct frame {exp_type<T> other; char op; bool negative_first;}; //how to merge the negated item with the other item
+		std::vector<frame> frames;
+		exp_type<T> re;
+		for (auto e = this;;)
 		{
-		case '+':
-			if (exp_l->is_easy_to_negative())
-				return merge_data_exp<T, O>(exp_l->to_negative(), exp_r, '-');
-			else if (exp_r->is_easy_to_negative())
-				return merge_data_exp<T, O>(exp_r->to_negative(), exp_l, '-');
-			else
+			auto op = e->get_operator().front();
+			const auto& exp_l = e->get_left_item();
+			const auto& exp_r = e->get_right_item();
+			auto negate_left = true;
+			switch (op)
 			{
-				auto depth_l = exp_l->get_depth(), depth_r = exp_r->get_depth();
-				if (depth_l <= depth_r)
-					return merge_data_exp<T, O>(exp_l->to_negative(), exp_r, '-');
+			case '+':
+			case '*':
+			case '/':
+				if (!exp_l->is_easy_to_negative())
+					negate_left = !exp_r->is_easy_to_negative() && exp_l->get_depth() <= exp_r->get_depth();
+
+				if (negate_left)
+					frames.push_back(frame {exp_r, '+' == op ? '-' : op, true});
+				else //'-(a + b)' equals to '-b - a', '-(a * b)' equals to 'a * -b'
+					frames.push_back(frame {exp_l, '+' == op ? '-' : op, '+' == op});
+				break;
+			case '-':
+				//without this branch, '-a - b' will be transformed to 'b + a' (from b - -a) instead of 'a + b', the former looks strange.
+				if (exp_l->is_negative())
+					frames.push_back(frame {exp_r, '+', true});
 				else
-					return merge_data_exp<T, O>(exp_r->to_negative(), exp_l, '-');
+					re = merge_data_exp<T, O>(exp_r, exp_l, '-');
+				break;
+			default:
+				return exp_type<T>();
+				break;
 			}
-			break;
-		case '-':
-			//without this branch, '-a - b' will be transformed to 'b + a' (from b - -a) instead of 'a + b', the former looks strange.
-			if (exp_l->is_negative())
-				return merge_data_exp<T, O>(exp_l->to_negative(), exp_r, '+');
-			return merge_data_exp<T, O>(exp_r, exp_l, '-');
-			break;
-		case '*':
-		case '/':
-			if (exp_l->is_easy_to_negative())
-				return merge_data_exp<T, O>(exp_l->to_negative(), exp_r, op);
-			else if (exp_r->is_easy_to_negative())
-				return merge_data_exp<T, O>(exp_l, exp_r->to_negative(), op);
-			else
+
+			if (re)
+				break;
+
+			const auto& item = negate_left ? exp_l : exp_r;
+			if (!is_my_type(item))
 			{
-				auto depth_l = exp_l->get_depth(), depth_r = exp_r->get_depth();
-				if (depth_l <= depth_r)
-					return merge_data_exp<T, O>(exp_l->to_negative(), exp_r, op);
-				else
-					return merge_data_exp<T, O>(exp_l, exp_r->to_negative(), op);
+				re = item->to_negative();
+				break;
 			}
-			break;
+			e = static_cast<const binary_data_exp*>(item.get());
 		}
 
-		return exp_type<T>();
+		for (auto iter = frames.rbegin(); iter != frames.rend(); ++iter)
+			re = iter->negative_first ? merge_data_exp<T, O>(re, iter->other, iter->op) : merge_data_exp<T, O>(iter->other, re, iter->op);
+		return re;
 	}
 
-	virtual exp_type<T> final_optimize()
+	virtual exp_type<T> final_optimize(bool items_changed)
 	{
-		auto& exp_l = this->left();
-		auto& exp_r = this->right();
-		return exp<T>::final_optimize_2(exp_l, exp_r) ? merge_data_exp<T, O>(exp_l, exp_r, this->get_operator().front()) : exp_type<T>();
-	}
+		if (!items_changed)
+			return exp_type<T>();
 
-	virtual bool is_easy_to_negative() const
-	{
-		return is_negative() || (is_operator_2(this->get_operator()) &&
-			(this->get_left_item()->is_easy_to_negative() || this->get_right_item()->is_easy_to_negative()));
+		trimmed = false;
+		return merge_data_exp<T, O>(this->get_left_item(), this->get_right_item(), this->get_operator().front());
 	}
 
-	virtual bool is_negative() const
-	{
-		//'-a - b', '-a * b', 'a * -b', '-a / b' and 'a / -b' are considered to be negative,
-		// introduce negative property to binary_data_exp is to eliminate negation operations if possible.
-		//following expressions cannot be eventual outcomes (we'll transform them to corresponding right ones), see trim_myself for more details:
-		//any immediate value (represented by C below) is considered to be NOT negative since it needs no negation operation at runtime, please note.
-		// '-a + -b'	will be transformed to '-a - b'
-		// '-a + b '	will be transformed to 'b - a'
-		// '-a - -b'	will be transformed to 'b - a'
-		// '-a - C '	will be transformed to '-C - a'
-		// '-a * -b'	will be transformed to 'a * b'
-		// '-a * C '	will be transformed to 'a * -C'
-		// 'C * -b '	will be transformed to '-C * b'
-		// '-a / -b'	will be transformed to 'a / b'
-		// '-a / C '	will be transformed to 'a / -C'
-		// 'C / -b '	will be transformed to '-C / b'
-		switch (this->get_operator().front())
-		{
-		case '-':
-			return this->get_left_item()->is_negative();
-		case '*':
-		case '/':
-			return this->get_left_item()->is_negative() || this->get_right_item()->is_negative();
-		}
-
-		return false;
-	}
+	virtual void update() {binary_exp<T, data_exp>::update(); update_negativity();}
+	virtual bool is_easy_to_negative() const {return easy_to_negative;}
+	virtual bool is_negative() const {return negative;}
 
 	virtual bool merge_with(char other_op, exp_ctype<T>& other_exp)
 	{
-		auto op = this->get_operator().front();
-		auto& exp_l = this->left();
-		auto& exp_r = this->right();
-		if (is_same_operator_level<O>(op, other_op))
+		if (O::level() < 2)
 		{
-			if (O::level() < 2)
+			auto op = this->get_operator().front();
+			auto& exp_l = this->left();
+			auto& exp_r = this->right();
+			auto item = &exp_l;
+			if (!is_same_operator_level<O>(op, other_op) || !other_exp->is_immediate())
+				return false;
+			else if (!exp_l->is_immediate())
 			{
-				if (!other_exp->is_immediate())
+				if (!exp_r->is_immediate())
 					return false;
-				else if (exp_l->is_immediate())
-					return exp_l->merge_with(other_op, other_exp);
-				else if (!exp_r->is_immediate())
-					return false;
-
-				if ('-' == op)
+				else if ('-' == op)
 					other_op = '+' == other_op ? '-' : '+';
 				else if ('/' == op) //other_op must also be '/'
 					other_op = '*';
-				return exp_r->merge_with(other_op, other_exp);
+				item = &exp_r;
 			}
-			else if (exp_l->merge_with(other_op, other_exp))
-				return true;
-			else if ('+' == op || '*' == op)
-				return exp_r->merge_with(other_op, other_exp);
-			else if ('-' == op)
-				other_op = '+' == other_op ? '-' : '+';
-			else if ('/' == op)
-				other_op = '*' == other_op ? '/' : '*';
-			return exp_r->merge_with(other_op, other_exp);
-		}
-		else if (2 == O::level() && '+' == other_op && '/' == op && //'N1*a^M / C + N2*a^M' -> '(N1 + N2*C)*a^M / C'
-			exp_r->is_immediate() && is_same_composite_variable(exp_l, other_exp) &&
-			exp_l->get_exponent() == other_exp->get_exponent())
-		{
-			exp_l = std::make_shared<composite_variable_data_exp<T, O>>(exp_l->get_variable_name(),
-				exp_l->get_multiplier() + other_exp->get_multiplier() * exp_r->get_immediate_value(), exp_l->get_exponent());
+
+			if (!(*item)->merge_with(other_op, other_exp))
+				return false;
+			trimmed = false;
 			return true;
 		}
 
-		return false;
-	}
-
+		//only immediate values and composite variables can be merged, sub expressions which don't contain any of the variables
+		// that other_exp may be merged with will be skipped (multiplying or dividing an immediate value changes any composite variables).
+		uint64_t mask = 0;
+		if (other_exp->is_immediate())
+			mask = '*' == other_op || '/' == other_op ? ~(uint64_t) 0 : 1;
+		else if (other_exp->is_composite_variable())
+			mask = other_exp->get_variable_mask();
+		else
+			return false;
+
+		//travel sub expressions with the same operator level depth first (left item first) with an explicit stack instead of recursion,
+		// all binary_data_exps on the path to the changed expression need to be trimmed again and their cached properties be updated.
+		std::vector<std::pair<binary_data_exp*, size_t>> parents; //the second is the index of the parent
+		std::vector<merge_frame> exps(1, merge_frame {this, other_op, (size_t) -1});
+		while (!exps.empty())
+		{
+			auto f = exps.back();
+			exps.pop_back();
+			if (0 == (f.e->get_variable_mask() & mask))
+				continue;
+
+			auto parent = f.parent;
+			auto merged = false;
+			if (f.e->is_data() && f.e->is_composite())
+			{
+				parent = parents.size();
+				parents.emplace_back(static_cast<binary_data_exp*>(f.e), f.parent);
+				merged = parents.back().first->merge_myself(f.op, other_exp, exps, parent);
+			}
+			else
+				merged = f.e->merge_with(f.op, other_exp);
+
+			if (merged)
+			{
+				for (; (size_t) -1 != parent; parent = parents[parent].second)
+				{
+					parents[parent].first->trimmed = false;
+					parents[parent].first->update();
+				}
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	//trim sub expressions bottom up (left item first) with an explicit stack instead of recursion, then trim myself,
+	// binary_data_exps which have been trimmed and not changed since then will be skipped.
 	virtual exp_type<T> trim_myself()
 	{
+		if (trimmed)
+			return exp_type<T>();
+
+		std::vector<std::pair<exp_type<T>*, bool>> exps; //the second means whether sub expressions have been pushed
+		exps.emplace_back(&this->right(), false);
+		exps.emplace_back(&this->left(), false);
+		while (!exps.empty())
+		{
+			auto item = exps.back().first;
+			if (!exps.back().second && is_my_type(*item))
+			{
+				auto e = static_cast<binary_data_exp*>(item->get());
+				if (e->trimmed)
+				{
+					exps.pop_back();
+					continue;
+				}
+
+				exps.back().second = true;
+				exps.emplace_back(&e->right(), false);
+				exps.emplace_back(&e->left(), false);
+				continue;
+			}
+
+			exps.pop_back();
+			auto data = is_my_type(*item) ? static_cast<binary_data_exp*>(item->get())->trim_local() : (*item)->trim_myself();
+			if (data)
+				*item = data;
+		}
+
+		return trim_local();
+	}
+
+private:
+	struct merge_frame {exp<T>* e; char op; size_t parent;};
+
+	void update_negativity()
+	{
+		//'-a - b', '-a * b', 'a * -b', '-a / b' and 'a / -b' are considered to be negative,
+		// introduce negative property to binary_data_exp is to eliminate negation operations if possible.
+		//following expressions cannot be eventual outcomes (we'll transform them to corresponding right ones), see trim_myself for more details:
+		//any immediate value (represented by C below) is considered to be NOT negative since it needs no negation operation at runtime, please note.
+		// '-a + -b'	will be transformed to '-a - b'
+		// '-a + b '	will be transformed to 'b - a'
+		// '-a - -b'	will be transformed to 'b - a'
+		// '-a - C '	will be transformed to '-C - a'
+		// '-a * -b'	will be transformed to 'a * b'
+		// '-a * C '	will be transformed to 'a * -C'
+		// 'C * -b '	will be transformed to '-C * b'
+		// '-a / -b'	will be transformed to 'a / b'
+		// '-a / C '	will be transformed to 'a / -C'
+		// 'C / -b '	will be transformed to '-C / b'
+		auto& exp_l = this->get_left_item();
+		auto& exp_r = this->get_right_item();
+		switch (this->get_operator().front())
+		{
+		case '-':
+			negative = exp_l->is_negative();
+			break;
+		case '*':
+		case '/':
+			negative = exp_l->is_negative() || exp_r->is_negative();
+			break;
+		default:
+			negative = false;
+			break;
+		}
+
+		easy_to_negative = negative || (is_operator_2(this->get_operator()) && (exp_l->is_easy_to_negative() || exp_r->is_easy_to_negative()));
+	}
+
+	//merge other_exp into myself (O::level() > 1), sub expressions with the same operator level will be pushed into exps
+	bool merge_myself(char other_op, exp_ctype<T>& other_exp, std::vector<merge_frame>& exps, size_t index)
+	{
+		auto op = this->get_operator().front();
 		auto& exp_l = this->left();
 		auto& exp_r = this->right();
+		if (is_same_operator_level<O>(op, other_op))
+		{
+			auto op_r = other_op;
+			if ('-' == op)
+				op_r = '+' == other_op ? '-' : '+';
+			else if ('/' == op)
+				op_r = '*' == other_op ? '/' : '*';
+			exps.push_back(merge_frame {exp_r.get(), op_r, index}); //after the whole left item
+			exps.push_back(merge_frame {exp_l.get(), other_op, index});
+		}
+		else if (2 == O::level() && '+' == other_op && '/' == op && //'N1*a^M / C + N2*a^M' -> '(N1 + N2*C)*a^M / C'
+			exp_r->is_immediate() && is_same_composite_variable(exp_l, other_exp) &&
+			exp_l->get_exponent() == other_exp->get_exponent())
+		{
+			exp_l = make_exp<composite_variable_data_exp<T, O>>(exp_l->get_variable_name(),
+				exp_l->get_multiplier() + other_exp->get_multiplier() * exp_r->get_immediate_value(), exp_l->get_exponent());
+			return true;
+		}
 
-		auto data = exp_l->trim_myself();
-		if (data)
-			exp_l = data;
+		return false;
+	}
 
-		data = exp_r->trim_myself();
-		if (data)
-			exp_r = data;
+	//sub expressions have been trimmed (and may have been replaced)
+	exp_type<T> trim_local() {this->update(); auto re = simplify(); trimmed = !re; return re;}
+	exp_type<T> simplify()
+	{
+		auto& exp_l = this->left();
+		auto& exp_r = this->right();
 
 		switch (this->get_operator().front())
 		{
@@ -530,9 +1231,9 @@ public:
 				auto exponent_l = exp_l->get_exponent(), exponent_r = exp_r->get_exponent();
 				if (exponent_l > exponent_r && exponent_r > 0)
 				{
-					exp_l = std::make_shared<composite_variable_data_exp<T, O>>(exp_l->get_variable_name(),
+					exp_l = make_exp<composite_variable_data_exp<T, O>>(exp_l->get_variable_name(),
 						exp_l->get_multiplier(), exponent_l - exponent_r);
-					exp_r = std::make_shared<immediate_data_exp<T>>(exp_r->get_multiplier());
+					exp_r = make_exp<immediate_data_exp<T>>(exp_r->get_multiplier());
 					return trim_myself();
 				}
 			}
@@ -541,39 +1242,70 @@ public:
 
 		return exp_type<T>();
 	}
+
+private:
+	bool negative, easy_to_negative; //cached, see is_negative and is_easy_to_negative
+	bool trimmed = false; //trimmed and not changed since then
 };
 
 template <typename T, typename O> class add_data_exp : public binary_data_exp<T, O>
 {
 public:
-	add_data_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_data_exp<T, O>(exp_l, exp_r, '+') {}
+	add_data_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_data_exp<T, O>(exp_l, exp_r, operator_type::add) {}
 
 	virtual T data(const std::function<T(const std::string&)>& cb) const
 		{return (*this->get_left_item())(cb) + (*this->get_right_item())(cb);}
+	virtual T data(const T* values) const
+		{return (*this->get_left_item())(values) + (*this->get_right_item())(values);}
+	virtual void data(batch<T>& b, const T* mask, T* out) const
+	{
+		typename batch<T>::buffer r(b);
+		this->get_left_item()->data(b, mask, out);
+		this->get_right_item()->data(b, mask, r);
+		b.get_kernels().add(out, r, b.size());
+	}
 };
 
 template <typename T, typename O> class sub_data_exp : public binary_data_exp<T, O>
 {
 public:
-	sub_data_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_data_exp<T, O>(exp_l, exp_r, '-') {}
+	sub_data_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_data_exp<T, O>(exp_l, exp_r, operator_type::sub) {}
 
 	virtual T data(const std::function<T(const std::string&)>& cb) const
 		{return (*this->get_left_item())(cb) - (*this->get_right_item())(cb);}
+	virtual T data(const T* values) const
+		{return (*this->get_left_item())(values) - (*this->get_right_item())(values);}
+	virtual void data(batch<T>& b, const T* mask, T* out) const
+	{
+		typename batch<T>::buffer r(b);
+		this->get_left_item()->data(b, mask, out);
+		this->get_right_item()->data(b, mask, r);
+		b.get_kernels().sub(out, r, b.size());
+	}
 };
 
 template <typename T, typename O> class multi_data_exp : public binary_data_exp<T, O>
 {
 public:
-	multi_data_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_data_exp<T, O>(exp_l, exp_r, '*') {}
+	multi_data_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_data_exp<T, O>(exp_l, exp_r, operator_type::multi) {}
 
 	virtual T data(const std::function<T(const std::string&)>& cb) const
 		{return (*this->get_left_item())(cb) * (*this->get_right_item())(cb);}
+	virtual T data(const T* values) const
+		{return (*this->get_left_item())(values) * (*this->get_right_item())(values);}
+	virtual void data(batch<T>& b, const T* mask, T* out) const
+	{
+		typename batch<T>::buffer r(b);
+		this->get_left_item()->data(b, mask, out);
+		this->get_right_item()->data(b, mask, r);
+		b.get_kernels().multi(out, r, b.size());
+	}
 };
 
 template <typename T, typename O> class div_data_exp : public binary_data_exp<T, O>
 {
 public:
-	div_data_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_data_exp<T, O>(exp_l, exp_r, '/') {}
+	div_data_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_data_exp<T, O>(exp_l, exp_r, operator_type::div) {}
 
 	virtual T data(const std::function<T(const std::string&)>& cb) const
 	{
@@ -584,15 +1316,38 @@ public:
 			throw("divide zero");
 		return dividend / divisor;
 	}
+	virtual T data(const T* values) const
+	{
+		auto dividend = (*this->get_left_item())(values);
+		auto divisor = (*this->get_right_item())(values);
+		if (0 == divisor)
+			throw("divide zero");
+		return dividend / divisor;
+	}
+	virtual void data(batch<T>& b, const T* mask, T* out) const
+	{
+		typename batch<T>::buffer r(b);
+		this->get_left_item()->data(b, mask, out);
+		this->get_right_item()->data(b, mask, r);
+		if (nullptr != mask)
+			for (size_t n = 0; n < b.size(); ++n)
+				if (0 == mask[n])
+					r[n] = 1; //inactive rows must not trigger divide zero
+		if (b.get_kernels().has_zero(r, b.size()))
+			throw("divide zero");
+		b.get_kernels().div(out, r, b.size());
+	}
 };
 
-template <typename T> class variable_data_exp : public data_exp<T>
+//base of all expressions which fetch a variable, the variable will be fetched by its name (via the callback) or
+// by its slot (from an array of values), the slot is assigned by a symbol_table at compilation time, see bind_symbols.
+template <typename T> class variable_exp : public data_exp<T>
 {
-public:
-	variable_data_exp(const std::string& _variable_name) : variable_name(_variable_name) {}
+protected:
+	variable_exp(const std::string& _variable_name) :
+		variable_name(_variable_name), slot(symbol_table::npos), variable_mask(to_variable_mask(_variable_name)), frozen(false) {}
 
-	exp_type<T> clone() const {return std::make_shared<variable_data_exp<T>>(variable_name);}
-	virtual T data(const std::function<T(const std::string&)>& cb) const
+	T fetch(const std::function<T(const std::string&)>& cb) const
 	{
 #ifdef DEBUG
 		auto v = cb(variable_name);
@@ -601,73 +1356,101 @@ public:
 #endif
 		return cb(variable_name);
 	}
+	T fetch(const T* values) const {assert(symbol_table::npos != slot); return values[slot];}
+	const T* fetch(const batch<T>& b) const {assert(symbol_table::npos != slot); return b.column(slot);}
+
+public:
+	virtual uint64_t get_variable_mask() const {return variable_mask;}
+	virtual bool is_variable() const {return true;}
+	virtual int get_exponent() const {return 1;}
+	virtual T get_multiplier() const {return 1;}
+	virtual const std::string& get_variable_name() const {return variable_name;}
+	virtual size_t get_slot() const {return slot;}
+	virtual void bind(size_t _slot)
+	{
+		if (frozen && _slot != slot)
+			throw("cannot rebind variable " + variable_name + " shared by the compile cache");
+		slot = _slot;
+	}
+	virtual void freeze() {frozen = true;}
 
 private:
 	std::string variable_name;
+	size_t slot;
+	uint64_t variable_mask;
+	bool frozen;
+};
+
+template <typename T> class variable_data_exp : public variable_exp<T>
+{
+public:
+	variable_data_exp(const std::string& variable_name) : variable_exp<T>(variable_name) {}
+
+	exp_type<T> clone() const {return make_exp<variable_data_exp<T>>(this->get_variable_name());}
+	virtual T data(const std::function<T(const std::string&)>& cb) const {return this->fetch(cb);}
+	virtual T data(const T* values) const {return this->fetch(values);}
+	virtual void data(batch<T>& b, const T*, T* out) const {std::copy_n(this->fetch(b), b.size(), out);}
 };
 
-template <typename T> class exponent_data_exp : public data_exp<T>
+template <typename T> class exponent_data_exp : public variable_exp<T>
 {
 public:
-	exponent_data_exp(const std::string& _variable_name, int _exponent) : variable_name(_variable_name), exponent(_exponent) {}
+	exponent_data_exp(const std::string& variable_name, int _exponent)
+		: variable_exp<T>(variable_name), exponent(_exponent), raise(power<T>::get(_exponent)) {}
 
 	virtual void show_immediate_value() const {std::cout << ' ' << exponent;}
-	exp_type<T> clone() const {return std::make_shared<exponent_data_exp<T>>(variable_name, exponent);}
-	virtual T data(const std::function<T(const std::string&)>& cb) const
-	{
-#ifdef DEBUG
-		auto v = cb(variable_name);
-		std::cout << " get " << variable_name << " returns " << v << std::endl;
-		return (T) pow(v, exponent);
-#endif
-		return (T) pow(cb(variable_name), exponent);
-	}
+	exp_type<T> clone() const {return make_exp<exponent_data_exp<T>>(this->get_variable_name(), exponent);}
+	virtual T data(const std::function<T(const std::string&)>& cb) const {return raise(this->fetch(cb), exponent);}
+	virtual T data(const T* values) const {return raise(this->fetch(values), exponent);}
+	virtual void data(batch<T>& b, const T*, T* out) const {power<T>::raise(this->fetch(b), out, b.size(), exponent);}
+
+	virtual int get_exponent() const {return exponent;}
 
 private:
-	std::string variable_name;
 	int exponent;
+	typename power<T>::function raise;
 };
 
-template <typename T, typename O> class composite_variable_data_exp : public data_exp<T>
+template <typename T, typename O> class composite_variable_data_exp : public variable_exp<T>
 {
 public:
-	composite_variable_data_exp(const std::string& _variable_name, T _multiplier = 1, int _exponent = 1)
-		: variable_name(_variable_name), multiplier(_multiplier), exponent(_exponent) {}
+	composite_variable_data_exp(const std::string& variable_name, T _multiplier = 1, int _exponent = 1)
+		: variable_exp<T>(variable_name), multiplier(_multiplier), exponent(_exponent) {}
 
 	virtual void show_immediate_value() const {std::cout << ' ' << multiplier << ' ' << exponent;}
-	virtual exp_type<T> clone() const {return std::make_shared<composite_variable_data_exp<T, O>>(variable_name, multiplier, exponent);}
-	virtual T data(const std::function<T(const std::string&)>& cb) const
+	virtual exp_type<T> clone() const
+		{return make_exp<composite_variable_data_exp<T, O>>(this->get_variable_name(), multiplier, exponent);}
+	virtual T data(const std::function<T(const std::string&)>& cb) const {return multiplier * power<T>::raise(this->fetch(cb), exponent);}
+	virtual T data(const T* values) const {return multiplier * power<T>::raise(this->fetch(values), exponent);}
+	virtual void data(batch<T>& b, const T*, T* out) const
 	{
-#ifdef DEBUG
-		auto v = cb(variable_name);
-		std::cout << " get " << variable_name << " returns " << v << std::endl;
-		return multiplier * (T) pow(v, exponent);
-#endif
-		return multiplier * (T) pow(cb(variable_name), exponent);
+		power<T>::raise(this->fetch(b), out, b.size(), exponent);
+		for (size_t n = 0; n < b.size(); ++n)
+			out[n] *= multiplier;
 	}
 	virtual exp_type<T> to_negative() const
-		{return std::make_shared<composite_variable_data_exp<T, O>>(variable_name, -multiplier, exponent);} //more effective than exp<T>::to_negative()
+		{return make_exp<composite_variable_data_exp<T, O>>(this->get_variable_name(), -multiplier, exponent);} //more effective than exp<T>::to_negative()
 
-	virtual exp_type<T> final_optimize()
+	virtual exp_type<T> final_optimize(bool)
 	{
-		exp_type<T> data = std::make_shared<immediate_data_exp<T>>(multiplier);
+		exp_type<T> data = make_exp<immediate_data_exp<T>>(multiplier);
 		if (0 == multiplier || 0 == exponent)
 			return data;
 		else if (1 != multiplier && -1 != multiplier && exponent > 1)
 			return exp_type<T>();
 		else if (1 == multiplier && exponent < 0)
-			return std::make_shared<exponent_data_exp<T>>(variable_name, exponent);
+			return make_exp<exponent_data_exp<T>>(this->get_variable_name(), exponent);
 		else if (-1 == multiplier && exponent < 0)
-			return std::make_shared<negative_data_exp<T>>(std::make_shared<exponent_data_exp<T>>(variable_name, exponent));
+			return make_exp<negative_data_exp<T>>(make_exp<exponent_data_exp<T>>(this->get_variable_name(), exponent));
 		else if (-1 == exponent)
-			return std::make_shared<div_data_exp<T, O>>(data, std::make_shared<variable_data_exp<T>>(variable_name));
+			return make_exp<div_data_exp<T, O>>(data, make_exp<variable_data_exp<T>>(this->get_variable_name()));
 		else if (exponent < -1)
-			return std::make_shared<div_data_exp<T, O>>(data, std::make_shared<exponent_data_exp<T>>(variable_name, -exponent));
+			return make_exp<div_data_exp<T, O>>(data, make_exp<exponent_data_exp<T>>(this->get_variable_name(), -exponent));
 
 		if (1 == exponent)
-			data = std::make_shared<multi_data_exp<T, O>>(data, std::make_shared<variable_data_exp<T>>(variable_name));
+			data = make_exp<multi_data_exp<T, O>>(data, make_exp<variable_data_exp<T>>(this->get_variable_name()));
 		else // > 1
-			data = std::make_shared<multi_data_exp<T, O>>(data, std::make_shared<exponent_data_exp<T>>(variable_name, exponent));
+			data = make_exp<multi_data_exp<T, O>>(data, make_exp<exponent_data_exp<T>>(this->get_variable_name(), exponent));
 
 		auto re = data->trim_myself();
 		return re ? re : data;
@@ -677,7 +1460,6 @@ public:
 	virtual bool is_easy_to_negative() const {return true;}
 	virtual int get_exponent() const {return exponent;}
 	virtual T get_multiplier() const {return multiplier;}
-	virtual const std::string& get_variable_name() const {return variable_name;}
 
 	virtual bool merge_with(char other_op, exp_ctype<T>& other_exp)
 	{
@@ -691,7 +1473,7 @@ public:
 			else
 				return false;
 		}
-		else if (!is_same_composite_variable(variable_name, other_exp))
+		else if (!is_same_composite_variable(this->get_variable_name(), other_exp))
 			return false;
 		else
 		{
@@ -760,12 +1542,11 @@ public:
 	virtual exp_type<T> trim_myself()
 	{
 		if (0 == multiplier || 0 == exponent)
-			return std::make_shared<immediate_data_exp<T>>(multiplier);
+			return make_exp<immediate_data_exp<T>>(multiplier);
 		return exp_type<T>();
 	}
 
 private:
-	std::string variable_name;
 	T multiplier;
 	int exponent;
 };
@@ -776,80 +1557,107 @@ inline exp_type<T> make_binary_data_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r
 	switch (op)
 	{
 	case '+':
-		return std::make_shared<add_data_exp<T, O>>(exp_l, exp_r);
+		return make_exp<add_data_exp<T, O>>(exp_l, exp_r);
 	case '-':
-		return std::make_shared<sub_data_exp<T, O>>(exp_l, exp_r);
+		return make_exp<sub_data_exp<T, O>>(exp_l, exp_r);
 	case '*':
-		return std::make_shared<multi_data_exp<T, O>>(exp_l, exp_r);
+		return make_exp<multi_data_exp<T, O>>(exp_l, exp_r);
 	case '/':
-		return std::make_shared<div_data_exp<T, O>>(exp_l, exp_r);
+		return make_exp<div_data_exp<T, O>>(exp_l, exp_r);
 	default:
 		throw("undefined operator " + std::string(1, op));
 	}
 }
 
+//merging with the left item of a composite right item is handled by the same loop instead of recursion, the composite right item
+// (with the operator to merge its right item) is kept in pending and its right item will be merged with the outcome later.
 template <typename T, typename O> inline exp_type<T> merge_data_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r, char op)
 {
 	if (0 == O::level())
 		return make_binary_data_exp<T, O>(exp_l, exp_r, op);
-	else if (exp_r->merge_with(exp_l, op)) //parse 'C * Na^M' and 'C / Na^M' to composite_variable_data_exp instead of binary_data_exp
-	{
-		auto data = exp_r->trim_myself();
-		return data ? data : exp_r;
-	}
-	else if (exp_l->merge_with(op, exp_r)) //composite_variable_data_exp is involved here
-	{
-		auto data = exp_l->trim_myself();
-		return data ? data : exp_l;
-	}
-	else if (exp_r->is_composite())
+
+	auto l = exp_l, r = exp_r;
+	std::vector<std::pair<exp_type<T>, char>> pending;
+	for (;;)
 	{
-		auto op_2 = exp_r->get_operator().front();
-		if (is_same_operator_level<O>(op, op_2))
+		exp_type<T> re;
+		if (r->merge_with(l, op)) //parse 'C * Na^M' and 'C / Na^M' to composite_variable_data_exp instead of binary_data_exp
 		{
-			exp_type<T> data;
-			if (exp_l->merge_with(op, exp_r->get_left_item()))
-			{
-				data = exp_l->trim_myself();
-				if (!data)
-					data = exp_l;
-			}
-
-			if ('-' == op)
-				op_2 = '-' == op_2 ? '+' : '-';
-			else if ('/' == op)
-				op_2 = '/' == op_2 ? '*' : '/';
-			if (!data)
+			re = r->trim_myself();
+			if (!re)
+				re = r;
+		}
+		else if (l->merge_with(op, r)) //composite_variable_data_exp is involved here
+		{
+			re = l->trim_myself();
+			if (!re)
+				re = l;
+		}
+		else if (r->is_composite())
+		{
+			auto op_2 = r->get_operator().front();
+			if (is_same_operator_level<O>(op, op_2))
 			{
-				if (exp_l->merge_with(op_2, exp_r->get_right_item()))
+				exp_type<T> data;
+				if (l->merge_with(op, r->get_left_item()))
 				{
-					data = exp_l->trim_myself();
+					data = l->trim_myself();
 					if (!data)
-						data = exp_l;
+						data = l;
+				}
 
-					return merge_data_exp<T, O>(data, exp_r->get_left_item(), op);
+				if ('-' == op)
+					op_2 = '-' == op_2 ? '+' : '-';
+				else if ('/' == op)
+					op_2 = '/' == op_2 ? '*' : '/';
+				if (data) //merge data with the right item
+				{
+					l = data;
+					op = op_2;
+					r = exp_type<T>(r->get_right_item());
 				}
-				else
-					data = merge_data_exp<T, O>(exp_l, exp_r->get_left_item(), op);
+				else if (l->merge_with(op_2, r->get_right_item())) //merge the outcome with the left item
+				{
+					data = l->trim_myself();
+					if (data)
+						l = data;
+					r = exp_type<T>(r->get_left_item());
+				}
+				else //merge with the left item, then merge the outcome with the right item
+				{
+					pending.emplace_back(r, op_2);
+					r = exp_type<T>(r->get_left_item());
+				}
+				continue;
+			}
+			else if (2 == O::level() && '+' == op && '/' == op_2 && //'N1*a^M + N2*a^M / C' -> '(N1*C + N2)*a^M / C'
+				r->get_right_item()->is_immediate() && is_same_composite_variable(l, r->get_left_item()) &&
+				l->get_exponent() == r->get_left_item()->get_exponent())
+			{
+				auto multiplier = l->get_multiplier() * r->get_right_item()->get_immediate_value() + r->get_left_item()->get_multiplier();
+				l = make_exp<composite_variable_data_exp<T, O>>(l->get_variable_name(), multiplier, l->get_exponent());
+				op = '/';
+				r = exp_type<T>(r->get_right_item());
+				continue;
 			}
-
-			return merge_data_exp<T, O>(data, exp_r->get_right_item(), op_2);
 		}
-		else if (2 == O::level() && '+' == op && '/' == op_2 && //'N1*a^M + N2*a^M / C' -> '(N1*C + N2)*a^M / C'
-			exp_r->get_right_item()->is_immediate() && is_same_composite_variable(exp_l, exp_r->get_left_item()) &&
-			exp_l->get_exponent() == exp_r->get_left_item()->get_exponent())
+
+		if (!re)
 		{
-			auto multiplier = exp_l->get_multiplier() * exp_r->get_right_item()->get_immediate_value() +
-				exp_r->get_left_item()->get_multiplier();
-			return merge_data_exp<T, O>(
-				std::make_shared<composite_variable_data_exp<T, O>>(exp_l->get_variable_name(), multiplier, exp_l->get_exponent()),
-				exp_r->get_right_item(), '/');
+			re = make_binary_data_exp<T, O>(l, r, op);
+			auto data = re->trim_myself();
+			if (data)
+				re = data;
 		}
-	}
 
-	auto data = make_binary_data_exp<T, O>(exp_l, exp_r, op);
-	auto re = data->trim_myself();
-	return re ? re : data;
+		if (pending.empty())
+			return re;
+
+		l = re;
+		r = exp_type<T>(pending.back().first->get_right_item());
+		op = pending.back().second;
+		pending.pop_back();
+	}
 }
 template <typename T, typename O>
 inline exp_type<T> merge_data_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r, const std::string& op)
@@ -868,13 +1676,15 @@ public:
 		{assert(exp_l->is_data());}
 
 	virtual bool need_to_bool() const {return true;}
-	virtual exp_type<T> clone() const {return std::make_shared<transparent_judge_exp<T>>(this->get_left_item());}
+	virtual exp_type<T> clone() const {return make_exp<transparent_judge_exp<T>>(this->get_left_item());}
 
 	virtual bool judge(const std::function<T(const std::string&)>& cb) const {return this->get_left_item()->judge(cb);}
-	virtual exp_type<T> bang() const {return std::make_shared<not_judge_exp<T>>(this->get_left_item());} //'!(a?)' equals to '!a'
+	virtual bool judge(const T* values) const {return this->get_left_item()->judge(values);}
+	virtual void judge(batch<T>& b, const T* mask, T* out) const {this->get_left_item()->judge(b, mask, out);}
+	virtual exp_type<T> bang() const {return make_exp<not_judge_exp<T>>(this->get_left_item());} //'!(a?)' equals to '!a'
 
-	virtual exp_type<T> final_optimize() //'(a?)?' equals to 'a?'
-		{return exp<T>::final_optimize_1(this->left(), [](exp_ctype<T>& l) {return is_my_type(l) ? l : exp_type<T>();});}
+	virtual exp_type<T> final_optimize(bool) //'(a?)?' equals to 'a?'
+		{auto& exp_l = this->get_left_item(); return is_my_type(exp_l) ? exp_l : exp_type<T>();}
 };
 
 template <typename T> class not_judge_exp : public unitary_exp<T, judge_exp>
@@ -888,14 +1698,17 @@ public:
 		{assert(!is_my_type(exp_l));}
 
 	virtual bool is_reverser() const {return true;}
-	virtual exp_type<T> clone() const {return std::make_shared<not_judge_exp<T>>(this->get_left_item());}
+	virtual exp_type<T> clone() const {return make_exp<not_judge_exp<T>>(this->get_left_item());}
 
 	virtual bool judge(const std::function<T(const std::string&)>& cb) const {return !this->get_left_item()->judge(cb);}
+	virtual bool judge(const T* values) const {return !this->get_left_item()->judge(values);}
+	virtual void judge(batch<T>& b, const T* mask, T* out) const
+		{this->get_left_item()->judge(b, mask, out); for (size_t n = 0; n < b.size(); ++n) to_not(out[n]);}
 	virtual exp_type<T> bang() const
-		{auto& exp_l = this->get_left_item(); return exp_l->is_data() ? std::make_shared<transparent_judge_exp<T>>(exp_l) : exp_l;}
+		{auto& exp_l = this->get_left_item(); return exp_l->is_data() ? make_exp<transparent_judge_exp<T>>(exp_l) : exp_l;}
 
-	virtual exp_type<T> final_optimize() //'!(!a)' equals to 'a?'
-		{return exp<T>::final_optimize_1(this->left(), [](exp_ctype<T>& l) {return is_my_type(l) ? l->bang() : exp_type<T>();});}
+	virtual exp_type<T> final_optimize(bool) //'!(!a)' equals to 'a?'
+		{auto& exp_l = this->get_left_item(); return is_my_type(exp_l) ? exp_l->bang() : exp_type<T>();}
 };
 
 template <typename T> inline exp_type<T> make_binary_judge_exp(exp_ctype<T>&, exp_ctype<T>&, const std::string&);
@@ -908,12 +1721,7 @@ protected:
 public:
 	virtual exp_type<T> clone() const {return make_binary_judge_exp<T>(this->get_left_item(), this->get_right_item(), this->get_operator());}
 
-	virtual exp_type<T> final_optimize()
-	{
-		return exp<T>::final_optimize_2(this->left(), this->right(), [this](exp_ctype<T>& l, exp_ctype<T>& r) {
-			return simple_optimize(l, r, this->get_operator());
-		});
-	}
+	virtual exp_type<T> final_optimize(bool) {return simple_optimize(this->get_left_item(), this->get_right_item(), this->get_operator());}
 
 	static exp_type<T> simple_optimize(exp_ctype<T>& l, exp_ctype<T>& r, const std::string& c)
 	{
@@ -926,9 +1734,9 @@ public:
 		if (useful_exp)
 		{
 			if ("==" == c) //'(!a) == 0' equals to 'a?' , 'a == 0' equals to '!a'
-				return not_judge_exp<T>::is_my_type(useful_exp) ? useful_exp->bang() : std::make_shared<not_judge_exp<T>>(useful_exp);
+				return not_judge_exp<T>::is_my_type(useful_exp) ? useful_exp->bang() : make_exp<not_judge_exp<T>>(useful_exp);
 			else if ("!=" == c) //'a != 0' equals to 'a?', '(a?) != 0' equals to 'a?'
-				return useful_exp->is_data() ? std::make_shared<transparent_judge_exp<T>>(useful_exp) : useful_exp;
+				return useful_exp->is_data() ? make_exp<transparent_judge_exp<T>>(useful_exp) : useful_exp;
 		}
 		return exp_type<T>();
 	}
@@ -938,63 +1746,111 @@ template <typename T> class smaller_equal_judge_exp;
 template <typename T> class bigger_judge_exp : public binary_judge_exp<T>
 {
 public:
-	bigger_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_judge_exp<T>(exp_l, exp_r, ">") {}
+	bigger_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_judge_exp<T>(exp_l, exp_r, operator_type::bigger) {}
 
 	virtual bool judge(const std::function<T(const std::string&)>& cb) const {return (*this->get_left_item())(cb) > (*this->get_right_item())(cb);}
+	virtual bool judge(const T* values) const {return (*this->get_left_item())(values) > (*this->get_right_item())(values);}
+	virtual void judge(batch<T>& b, const T* mask, T* out) const
+	{
+		typename batch<T>::buffer r(b);
+		this->get_left_item()->data(b, mask, out);
+		this->get_right_item()->data(b, mask, r);
+		b.get_kernels().bigger(out, r, b.size());
+	}
 
-	virtual exp_type<T> bang() const {return std::make_shared<smaller_equal_judge_exp<T>>(this->get_left_item(), this->get_right_item());}
+	virtual exp_type<T> bang() const {return make_exp<smaller_equal_judge_exp<T>>(this->get_left_item(), this->get_right_item());}
 };
 
 template <typename T> class smaller_judge_exp;
 template <typename T> class bigger_equal_judge_exp : public binary_judge_exp<T>
 {
 public:
-	bigger_equal_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_judge_exp<T>(exp_l, exp_r, ">=") {}
+	bigger_equal_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_judge_exp<T>(exp_l, exp_r, operator_type::bigger_equal) {}
 
 	virtual bool judge(const std::function<T(const std::string&)>& cb) const {return (*this->get_left_item())(cb) >= (*this->get_right_item())(cb);}
+	virtual bool judge(const T* values) const {return (*this->get_left_item())(values) >= (*this->get_right_item())(values);}
+	virtual void judge(batch<T>& b, const T* mask, T* out) const
+	{
+		typename batch<T>::buffer r(b);
+		this->get_left_item()->data(b, mask, out);
+		this->get_right_item()->data(b, mask, r);
+		b.get_kernels().bigger_equal(out, r, b.size());
+	}
 
-	virtual exp_type<T> bang() const {return std::make_shared<smaller_judge_exp<T>>(this->get_left_item(), this->get_right_item());}
+	virtual exp_type<T> bang() const {return make_exp<smaller_judge_exp<T>>(this->get_left_item(), this->get_right_item());}
 };
 
 template <typename T> class smaller_judge_exp : public binary_judge_exp<T>
 {
 public:
-	smaller_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_judge_exp<T>(exp_l, exp_r, "<") {}
+	smaller_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_judge_exp<T>(exp_l, exp_r, operator_type::smaller) {}
 
 	virtual bool judge(const std::function<T(const std::string&)>& cb) const {return (*this->get_left_item())(cb) < (*this->get_right_item())(cb);}
+	virtual bool judge(const T* values) const {return (*this->get_left_item())(values) < (*this->get_right_item())(values);}
+	virtual void judge(batch<T>& b, const T* mask, T* out) const
+	{
+		typename batch<T>::buffer r(b);
+		this->get_left_item()->data(b, mask, out);
+		this->get_right_item()->data(b, mask, r);
+		b.get_kernels().smaller(out, r, b.size());
+	}
 
-	virtual exp_type<T> bang() const {return std::make_shared<bigger_equal_judge_exp<T>>(this->get_left_item(), this->get_right_item());}
+	virtual exp_type<T> bang() const {return make_exp<bigger_equal_judge_exp<T>>(this->get_left_item(), this->get_right_item());}
 };
 
 template <typename T> class smaller_equal_judge_exp : public binary_judge_exp<T>
 {
 public:
-	smaller_equal_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_judge_exp<T>(exp_l, exp_r, "<=") {}
+	smaller_equal_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_judge_exp<T>(exp_l, exp_r, operator_type::smaller_equal) {}
 
 	virtual bool judge(const std::function<T(const std::string&)>& cb) const {return (*this->get_left_item())(cb) <= (*this->get_right_item())(cb);}
+	virtual bool judge(const T* values) const {return (*this->get_left_item())(values) <= (*this->get_right_item())(values);}
+	virtual void judge(batch<T>& b, const T* mask, T* out) const
+	{
+		typename batch<T>::buffer r(b);
+		this->get_left_item()->data(b, mask, out);
+		this->get_right_item()->data(b, mask, r);
+		b.get_kernels().smaller_equal(out, r, b.size());
+	}
 
-	virtual exp_type<T> bang() const {return std::make_shared<bigger_judge_exp<T>>(this->get_left_item(), this->get_right_item());}
+	virtual exp_type<T> bang() const {return make_exp<bigger_judge_exp<T>>(this->get_left_item(), this->get_right_item());}
 };
 
 template <typename T> class not_equal_judge_exp;
 template <typename T> class equal_judge_exp : public binary_judge_exp<T>
 {
 public:
-	equal_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_judge_exp<T>(exp_l, exp_r, "==") {}
+	equal_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_judge_exp<T>(exp_l, exp_r, operator_type::equal) {}
 
 	virtual bool judge(const std::function<T(const std::string&)>& cb) const {return (*this->get_left_item())(cb) == (*this->get_right_item())(cb);}
+	virtual bool judge(const T* values) const {return (*this->get_left_item())(values) == (*this->get_right_item())(values);}
+	virtual void judge(batch<T>& b, const T* mask, T* out) const
+	{
+		typename batch<T>::buffer r(b);
+		this->get_left_item()->data(b, mask, out);
+		this->get_right_item()->data(b, mask, r);
+		b.get_kernels().equal(out, r, b.size());
+	}
 
-	virtual exp_type<T> bang() const {return std::make_shared<not_equal_judge_exp<T>>(this->get_left_item(), this->get_right_item());}
+	virtual exp_type<T> bang() const {return make_exp<not_equal_judge_exp<T>>(this->get_left_item(), this->get_right_item());}
 };
 
 template <typename T> class not_equal_judge_exp : public binary_judge_exp<T>
 {
 public:
-	not_equal_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_judge_exp<T>(exp_l, exp_r, "!=") {}
+	not_equal_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : binary_judge_exp<T>(exp_l, exp_r, operator_type::not_equal) {}
 
 	virtual bool judge(const std::function<T(const std::string&)>& cb) const {return (*this->get_left_item())(cb) != (*this->get_right_item())(cb);}
+	virtual bool judge(const T* values) const {return (*this->get_left_item())(values) != (*this->get_right_item())(values);}
+	virtual void judge(batch<T>& b, const T* mask, T* out) const
+	{
+		typename batch<T>::buffer r(b);
+		this->get_left_item()->data(b, mask, out);
+		this->get_right_item()->data(b, mask, r);
+		b.get_kernels().not_equal(out, r, b.size());
+	}
 
-	virtual exp_type<T> bang() const {return std::make_shared<equal_judge_exp<T>>(this->get_left_item(), this->get_right_item());}
+	virtual exp_type<T> bang() const {return make_exp<equal_judge_exp<T>>(this->get_left_item(), this->get_right_item());}
 };
 
 template <typename T> inline exp_type<T> make_binary_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r, const std::string& c)
@@ -1005,22 +1861,24 @@ template <typename T> inline exp_type<T> make_binary_judge_exp(exp_ctype<T>& exp
 	if (re)
 		return re;
 	else if (">" == c)
-		return std::make_shared<bigger_judge_exp<T>>(exp_l, exp_r);
+		return make_exp<bigger_judge_exp<T>>(exp_l, exp_r);
 	else if (">=" == c)
-		return std::make_shared<bigger_equal_judge_exp<T>>(exp_l, exp_r);
+		return make_exp<bigger_equal_judge_exp<T>>(exp_l, exp_r);
 	else if ("<" == c)
-		return std::make_shared<smaller_judge_exp<T>>(exp_l, exp_r);
+		return make_exp<smaller_judge_exp<T>>(exp_l, exp_r);
 	else if ("<=" == c)
-		return std::make_shared<smaller_equal_judge_exp<T>>(exp_l, exp_r);
+		return make_exp<smaller_equal_judge_exp<T>>(exp_l, exp_r);
 	else if ("==" == c)
-		return std::make_shared<equal_judge_exp<T>>(exp_l, exp_r);
+		return make_exp<equal_judge_exp<T>>(exp_l, exp_r);
 	else if ("!=" == c)
-		return std::make_shared<not_equal_judge_exp<T>>(exp_l, exp_r);
+		return make_exp<not_equal_judge_exp<T>>(exp_l, exp_r);
 	else
 		throw("unknown compare operator " + c);
 }
 
 template <typename T>inline exp_type<T> make_logical_exp(exp_ctype<T>&, exp_ctype<T>&, const std::string&);
+template <typename T> class and_judge_exp;
+template <typename T> class or_judge_exp;
 template <typename T> class logical_exp : public binary_exp<T, judge_exp>
 {
 protected:
@@ -1030,43 +1888,91 @@ public:
 	virtual bool is_composite() const {return true;}
 	virtual exp_type<T> clone() const {return make_logical_exp<T>(this->get_left_item(), this->get_right_item(), this->get_operator());}
 
-	virtual exp_type<T> final_optimize()
+	//'!(a && b)' equals to '!a || !b', '!(a || b)' equals to '!a && !b',
+	// sub logical expressions are handled bottom up with an explicit stack instead of recursion.
+	virtual exp_type<T> bang() const
 	{
-		return exp<T>::final_optimize_2(this->left(), this->right(), [this](exp_ctype<T>& l, exp_ctype<T>& r) {
-			return simple_optimize(l, r, this->get_operator());
-		});
+		std::vector<std::pair<const exp<T>*, bool>> exps(1, std::make_pair((const exp<T>*) this, false)); //the second means expanded
+		std::vector<exp_type<T>> res;
+		while (!exps.empty())
+		{
+			auto e = exps.back().first;
+			if (e->is_data() || !e->is_composite()) //not a logical expression
+			{
+				exps.pop_back();
+				res.push_back(e->bang());
+			}
+			else if (!exps.back().second)
+			{
+				exps.back().second = true;
+				exps.emplace_back(e->get_right_item().get(), false);
+				exps.emplace_back(e->get_left_item().get(), false);
+			}
+			else
+			{
+				exps.pop_back();
+				auto exp_r = std::move(res.back());
+				res.pop_back();
+				auto& exp_l = res.back();
+				if (operator_type::logical_and == e->get_operator_type())
+					exp_l = make_exp<or_judge_exp<T>>(exp_l, exp_r);
+				else
+					exp_l = make_exp<and_judge_exp<T>>(exp_l, exp_r);
+			}
+		}
+
+		return res.front();
 	}
 
+	virtual exp_type<T> final_optimize(bool) {return simple_optimize(this->get_left_item(), this->get_right_item(), this->get_operator());}
+
 	static exp_type<T> simple_optimize(exp_ctype<T>& l, exp_ctype<T>& r, const std::string& lop)
 	{
 		return not_judge_exp<T>::is_my_type(l) && not_judge_exp<T>::is_my_type(r) ? //'!a && !b' equals to '!(a || b)', '!a || !b' equals to '!(a && b)'
-			std::make_shared<not_judge_exp<T>>(make_logical_exp(l->bang(), r->bang(), "&&" == lop ? "||" : "&&")) : exp_type<T>();
+			make_exp<not_judge_exp<T>>(make_logical_exp(l->bang(), r->bang(), "&&" == lop ? "||" : "&&")) : exp_type<T>();
 	}
 };
 
-template <typename T> class or_judge_exp;
 template <typename T> class and_judge_exp : public logical_exp<T>
 {
 public:
-	and_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : logical_exp<T>(exp_l, exp_r, "&&") {}
-
-	virtual exp_type<T> bang() const
-		{return std::make_shared<or_judge_exp<T>>(this->get_left_item()->bang(), this->get_right_item()->bang());}
+	and_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : logical_exp<T>(exp_l, exp_r, operator_type::logical_and) {}
 
 	virtual bool judge(const std::function<T(const std::string&)>& cb) const
 		{return this->get_left_item()->judge(cb) && this->get_right_item()->judge(cb);}
+	virtual bool judge(const T* values) const
+		{return this->get_left_item()->judge(values) && this->get_right_item()->judge(values);}
+	virtual void judge(batch<T>& b, const T* mask, T* out) const
+	{
+		this->get_left_item()->judge(b, mask, out);
+		typename batch<T>::buffer m(b), r(b);
+		if (0 == b.get_kernels().filter(m, mask, out, b.size())) //short circuit control
+			return;
+
+		this->get_right_item()->judge(b, m, r);
+		b.get_kernels().select(out, m, r, out, b.size());
+	}
 };
 
 template <typename T> class or_judge_exp : public logical_exp<T>
 {
 public:
-	or_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : logical_exp<T>(exp_l, exp_r, "||") {}
-
-	virtual exp_type<T> bang() const
-		{return std::make_shared<and_judge_exp<T>>(this->get_left_item()->bang(), this->get_right_item()->bang());}
+	or_judge_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r) : logical_exp<T>(exp_l, exp_r, operator_type::logical_or) {}
 
 	virtual bool judge(const std::function<T(const std::string&)>& cb) const
 		{return this->get_left_item()->judge(cb) || this->get_right_item()->judge(cb);}
+	virtual bool judge(const T* values) const
+		{return this->get_left_item()->judge(values) || this->get_right_item()->judge(values);}
+	virtual void judge(batch<T>& b, const T* mask, T* out) const
+	{
+		this->get_left_item()->judge(b, mask, out);
+		typename batch<T>::buffer m(b), r(b);
+		if (0 == b.get_kernels().filter_not(m, mask, out, b.size())) //short circuit control
+			return;
+
+		this->get_right_item()->judge(b, m, r);
+		b.get_kernels().select(out, m, r, out, b.size());
+	}
 };
 
 template <typename T>inline exp_type<T> make_logical_exp(exp_ctype<T>& exp_l, exp_ctype<T>& exp_r, const std::string& lop)
@@ -1080,8 +1986,8 @@ template <typename T>inline exp_type<T> make_logical_exp(exp_ctype<T>& exp_l, ex
 	if (re)
 		return re;
 	else if ("&&" == lop)
-		return std::make_shared<and_judge_exp<T>>(exp_l, exp_r);
-	return std::make_shared<or_judge_exp<T>>(exp_l, exp_r); //"||" == lop
+		return make_exp<and_judge_exp<T>>(exp_l, exp_r);
+	return make_exp<or_judge_exp<T>>(exp_l, exp_r); //"||" == lop
 }
 /////////////////////////////////////////////////////////////////////////////////////////
 
@@ -1089,167 +1995,477 @@ template <typename T>inline exp_type<T> make_logical_exp(exp_ctype<T>& exp_l, ex
 template <typename T> class question_exp : public data_exp<T>
 {
 public:
-	question_exp(exp_ctype<T>& _judge, exp_ctype<T>& _exp_l, exp_ctype<T>& _exp_r) : judge(_judge), exp_l(_exp_l), exp_r(_exp_r) {}
+	question_exp(exp_ctype<T>& _judge, exp_ctype<T>& _exp_l, exp_ctype<T>& _exp_r) : judge(_judge), exp_l(_exp_l), exp_r(_exp_r) {update();}
+	~question_exp() {exp<T>::release(judge); exp<T>::release(exp_l); exp<T>::release(exp_r);}
 
-	virtual int get_depth() const {return 1 + std::max(judge->get_depth(), std::max(exp_l->get_depth(), exp_r->get_depth()));}
 	virtual void show_immediate_value() const
 		{judge->show_immediate_value(); exp_l->show_immediate_value(); exp_r->show_immediate_value();}
-	exp_type<T> clone() const {return std::make_shared<question_exp<T>>(judge, exp_l, exp_r);}
+	virtual int get_depth() const {return depth;}
+	virtual size_t get_node_count() const {return node_count;}
+	virtual uint64_t get_variable_mask() const {return variable_mask;}
+	exp_type<T> clone() const {return make_exp<question_exp<T>>(judge, exp_l, exp_r);}
 	virtual exp_ctype<T>& get_road_map() const {return judge;}
 	virtual exp_ctype<T>& get_left_item() const {return exp_l;}
 	virtual exp_ctype<T>& get_right_item() const {return exp_r;}
 
 	virtual T data(const std::function<T(const std::string&)>& cb) const {return judge->judge(cb) ? (*exp_l)(cb) : (*exp_r)(cb);}
+	virtual T data(const T* values) const {return judge->judge(values) ? (*exp_l)(values) : (*exp_r)(values);}
+	virtual void data(batch<T>& b, const T* mask, T* out) const
+	{
+		auto& k = b.get_kernels();
+		typename batch<T>::buffer j(b), r(b);
+		judge->judge(b, mask, j);
+		if (is_cheap(exp_l) && is_cheap(exp_r)) //handle both branches for all active rows, then blend them
+		{
+			exp_l->data(b, mask, out);
+			exp_r->data(b, mask, r);
+			return k.select(out, j, out, r, b.size());
+		}
+
+		//only handle active rows of each branch
+		typename batch<T>::buffer m_l(b), m_r(b);
+		auto num_l = k.filter(m_l, mask, j, b.size()), num_r = k.filter_not(m_r, mask, j, b.size());
+		if (0 == num_r)
+			return exp_l->data(b, mask, out);
+		else if (0 == num_l)
+			return exp_r->data(b, mask, out);
+
+		exp_l->data(b, m_l, out);
+		exp_r->data(b, m_r, r);
+		k.select(out, j, out, r, b.size());
+	}
 	virtual void clear() {judge.reset(); exp_l.reset(); exp_r.reset();}
+	virtual void replace_items(const std::function<void(exp_type<T>&)>& replacer) {replacer(judge); replacer(exp_l); replacer(exp_r);}
+	virtual void update()
+	{
+		depth = 1 + std::max(judge->get_depth(), std::max(exp_l->get_depth(), exp_r->get_depth()));
+		node_count = 1 + judge->get_node_count() + exp_l->get_node_count() + exp_r->get_node_count();
+		variable_mask = judge->get_variable_mask() | exp_l->get_variable_mask() | exp_r->get_variable_mask();
+	}
 
-	virtual exp_type<T> final_optimize()
+private:
+	//cheap expressions never throw exceptions, so they can be handled for rows which don't select them.
+	static bool is_cheap(exp_ctype<T>& exp)
 	{
-		exp<T>::final_optimize_1(judge);
-		exp<T>::final_optimize_2(exp_l, exp_r);
-		return exp_type<T>();
+		return exp->is_leaf() || (exp->is_data() && exp->is_composite() && operator_type::div != exp->get_operator_type() &&
+			exp->get_left_item()->is_leaf() && exp->get_right_item()->is_leaf());
 	}
 
 private:
 	exp_type<T> judge, exp_l, exp_r;
+	int depth;
+	size_t node_count;
+	uint64_t variable_mask;
 };
-/////////////////////////////////////////////////////////////////////////////////////////
 
-/////////////////////////////////////////////////////////////////////////////////////////
-template <typename T> inline bool to_not(T& operand) {return (bool) (operand = (T) (0 == operand));}
-template <typename T> inline bool to_bool(T& operand) {return (bool) (operand = (T) (0 != operand));}
-template <typename T> inline T negate(T& operand) {return operand = -operand;}
-template <typename T> inline bool compare(T& operand, const std::string& c, T v)
+//the final optimization (qme::O2/qme::O3), optimize sub expressions bottom up (road map, left item and right item in turn)
+// with an explicit stack instead of recursion, then expressions with any depth can be optimized.
+template <typename T> inline void final_optimize(exp_type<T>& exp)
 {
-	if (">" == c)
-		return (bool) (operand = (T) (operand > v));
-	else if (">=" == c)
-		return (bool) (operand = (T) (operand >= v));
-	else if ("<" == c)
-		return (bool) (operand = (T) (operand < v));
-	else if ("<=" == c)
-		return (bool) (operand = (T) (operand <= v));
-	else if ("==" == c)
-		return (bool) (operand = (T) (operand == v));
-	else if ("!=" == c)
-		return (bool) (operand = (T) (operand != v));
-	else
-		throw("unknown compare operator " + c);
+	struct frame {exp_type<T>* item; size_t parent; bool expanded, items_changed;};
+	std::vector<frame> exps(1, frame {&exp, 0, false, false});
+	std::vector<exp_type<T>*> items;
+	while (!exps.empty())
+	{
+		auto index = exps.size() - 1;
+		if (!exps[index].expanded)
+		{
+			exps[index].expanded = true;
+			items.clear();
+			(*exps[index].item)->replace_items([&](exp_type<T>& item) {items.push_back(&item);});
+			for (auto iter = items.rbegin(); iter != items.rend(); ++iter)
+				exps.push_back(frame {*iter, index, false, false});
+			continue;
+		}
+
+		auto f = exps.back();
+		exps.pop_back();
+		if (f.items_changed)
+			(*f.item)->update();
+		auto e = (*f.item)->final_optimize(f.items_changed);
+		if (e)
+		{
+			*f.item = e;
+			if (!exps.empty())
+				exps[f.parent].items_changed = true;
+		}
+	}
 }
+/////////////////////////////////////////////////////////////////////////////////////////
 
-//since recursion is used during the whole compilation and execution, if your expression is too complicated to
-// be compiled and executed (stack overflow), use
-// qme::O0/qme::O1 to compile it,
-// qme::safe_data/qme::safe_judge to execute it and
-// qme::safe_delete to delete it,
-//then recursion will be eliminated, but additional runtime judgment will be performed, we have no choice.
-//
-//with optimization level qme::O0/qme::O1, following functions are still available, if you're encountering above situation,
-//you should not call them manually, please note:
-// get_depth
-// show_immediate_value
-// to_negative
-// final_optimize
-// is_easy_to_negative
-// is_negative
-// merge_with
-// trim_myself
-//return the data and max depth (just traveled branches).
-template <typename T> inline std::pair<T, size_t> safe_data(exp_ctype<T>& exp, const std::function<T(const std::string&)>& cb)
+/////////////////////////////////////////////////////////////////////////////////////////
+//declared bounds of variables (variable name to [lower, upper], both inclusive), values of these variables must be within their bounds at runtime.
+template <typename T> using variable_bounds = std::map<std::string, std::pair<T, T>>;
+
+//the range of an expression's values under declared bounds, it's known only if the expression never throws exceptions,
+// for judge expressions, 0 means false and 1 means true.
+//endpoints are calculated by the same operations as the execution (so with the same rounding errors), integer overflows
+// or NaNs make the range unknown.
+template <typename T> struct value_range
 {
-	if (!exp->is_parent())
-		return std::make_pair((*exp)(cb), 1);
+	T lower, upper;
+	bool known;
 
-	size_t max_depth = 1;
-	//the max depth is the max size that this list ever get, so please use at least gcc 5 since we need std::list::size() to have O(1) complexity
-	std::list<std::pair<exp_type<T>, int>> exps; //current branch: -1 - before handling, 0 - road map, 1 - left branch, 2 - right branch
-	auto direction = 0; //0 - road map, 1 - left-bottom, 2 - right-bottom, 3 - top-left
-	exps.emplace_back(exp, -1);
-	std::list<T> res;
-	for (auto iter = exps.rbegin(); iter != exps.rend();)
-		if (0 == direction) //road map
-		{
-			iter->second = 0;
-			auto road_map = iter->first->get_road_map();
-			if (!road_map)
-				direction = 1;
-			else if (road_map->is_parent())
+	bool is_constant() const {return known && lower == upper;}
+	value_range to_judge() const {return known ? of_judge(lower <= 0 && upper >= 0, 0 != lower || 0 != upper) : *this;} //value to bool
+
+	static value_range unknown() {return value_range {0, 0, false};}
+	static value_range of(T lower, T upper) {return value_range {lower, upper, lower == lower && upper == upper};} //NaN check
+	static value_range of_judge(bool may_be_false, bool may_be_true) {return value_range {(T) !may_be_false, (T) may_be_true, true};}
+
+	static bool is_valid(long double v)
+		{return std::is_floating_point<T>::value || (v >= std::numeric_limits<T>::lowest() && v <= std::numeric_limits<T>::max());}
+
+	static bool calculate(T& re, T l, operator_type op, T r)
+	{
+		long double v = l;
+		switch (op)
+		{
+		case operator_type::add: v += r; break;
+		case operator_type::sub: v -= r; break;
+		case operator_type::multi: v *= r; break;
+		default: v /= r; break;
+		}
+
+		if (!is_valid(v))
+			return false;
+		re = l;
+		qme::calculate(re, op, r);
+		return true;
+	}
+
+	static bool raise(T& re, T v, int exponent)
+	{
+		if (!is_valid(pow((long double) v, exponent)))
+			return false;
+		re = power<T>::raise(v, exponent);
+		return true;
+	}
+
+	value_range operator-() const {return !known || !is_valid(-(long double) lower) ? unknown() : of(-upper, -lower);}
+
+	//'+' and '-' are monotonic, so are '*' and '/' within the quadrants, then the extremums must be at the corners.
+	static value_range calculate(const value_range& l, operator_type op, const value_range& r)
+	{
+		if (!l.known || !r.known || (operator_type::div == op && r.lower <= 0 && r.upper >= 0)) //may divide zero
+			return unknown();
+
+		T corners[4];
+		if (!calculate(corners[0], l.lower, op, r.lower) || !calculate(corners[1], l.lower, op, r.upper) ||
+			!calculate(corners[2], l.upper, op, r.lower) || !calculate(corners[3], l.upper, op, r.upper))
+			return unknown();
+		return of(*std::min_element(corners, corners + 4), *std::max_element(corners, corners + 4));
+	}
+
+	//integer powers are monotonic when the sign of the base is fixed.
+	value_range raise(int exponent) const
+	{
+		T l, u;
+		if (!known || (exponent < 0 && lower <= 0 && upper >= 0) || !raise(l, lower, exponent) || !raise(u, upper, exponent))
+			return unknown();
+		else if (0 == exponent % 2 && lower < 0 && upper > 0)
+			return of(power<T>::raise(0, exponent), std::max(l, u));
+		return of(std::min(l, u), std::max(l, u));
+	}
+
+	static value_range compare(const value_range& l, operator_type c, const value_range& r)
+	{
+		if (!l.known || !r.known)
+			return unknown();
+
+		switch (c)
+		{
+		case operator_type::bigger: return of_judge(l.lower <= r.upper, l.upper > r.lower);
+		case operator_type::bigger_equal: return of_judge(l.lower < r.upper, l.upper >= r.lower);
+		case operator_type::smaller: return compare(r, operator_type::bigger, l);
+		case operator_type::smaller_equal: return compare(r, operator_type::bigger_equal, l);
+		case operator_type::equal:
+			return of_judge(!l.is_constant() || !r.is_constant() || l.lower != r.lower, l.upper >= r.lower && l.lower <= r.upper);
+		default: //not_equal
 			{
-				exps.emplace_back(road_map, -1);
-				iter = exps.rbegin();
+				auto re = compare(l, operator_type::equal, r);
+				return of_judge(0 != re.upper, 0 == re.lower);
 			}
+		}
+	}
+};
+
+//apply declared bounds of variables to the expression with an explicit stack instead of recursion, ranges of values are propagated
+// bottom up, judgments which become constant are folded and dead branches of question mark expressions are pruned.
+//a sub expression will not be removed if it may throw exceptions (undeclared variables or dividing a range containing 0) and it will
+// be executed without the folding, for example, 'a > 0 || b > 1' equals to 'a > 0' if b is always bigger than 1, but 'b > 1 || a > 0'
+// is always true only if a is declared too.
+//constants folded here are optimized further like any other immediate values, O2 and O3 transform '0 / a' to '0' (even without
+// bounds), so with a, b and c declared within [0, 1], 'c * (a + c == 6) / b' becomes '0' and never throws divide zero, use O0 or O1
+// to keep the division.
+template <typename T> inline void apply_bounds(exp_type<T>& exp, const variable_bounds<T>& bounds)
+{
+	auto make_constant_judge = [](bool v) -> exp_type<T> {return make_exp<transparent_judge_exp<T>>(make_exp<immediate_data_exp<T>>((T) v));};
+
+	struct frame {exp_type<T>* item; size_t parent; bool expanded, items_changed;};
+	std::vector<frame> exps(1, frame {&exp, 0, false, false});
+	std::vector<exp_type<T>*> items;
+	std::vector<value_range<T>> ranges; //of sub expressions which have been handled, in the order of road map, left item and right item
+	while (!exps.empty())
+	{
+		auto index = exps.size() - 1;
+		if (!exps[index].expanded)
+		{
+			exps[index].expanded = true;
+			items.clear();
+			(*exps[index].item)->replace_items([&](exp_type<T>& item) {items.push_back(&item);});
+			for (auto iter = items.rbegin(); iter != items.rend(); ++iter)
+				exps.push_back(frame {*iter, index, false, false});
+			continue;
+		}
+
+		auto f = exps.back();
+		exps.pop_back();
+		auto& e = *f.item;
+		if (f.items_changed)
+			e->update();
+
+		size_t num = 0;
+		e->replace_items([&](exp_type<T>&) {++num;});
+		auto sub_ranges = ranges.data() + ranges.size() - num;
+		//data items are judged as bool by logical_exp, not_judge_exp, transparent_judge_exp and as road maps
+		if (e->is_judge() ? e->is_composite() || e->is_reverser() || e->need_to_bool() : e->is_selector())
+		{
+			size_t n = 0;
+			e->replace_items([&](exp_type<T>& item) {
+				if (item->is_data() && (e->is_judge() || 0 == n))
+					sub_ranges[n] = sub_ranges[n].to_judge();
+				++n;
+			});
+		}
+		auto re = value_range<T>::unknown();
+		exp_type<T> replacement;
+		if (e->is_leaf())
+		{
+			if (e->is_immediate())
+				re = value_range<T>::of(e->get_immediate_value(), e->get_immediate_value());
+			else if (e->is_variable())
+			{
+				auto iter = bounds.find(e->get_variable_name());
+				if (std::end(bounds) != iter)
+				{
+					auto multiplier = e->get_multiplier();
+					re = value_range<T>::of(iter->second.first, iter->second.second).raise(e->get_exponent());
+					if (1 != multiplier)
+						re = value_range<T>::calculate(value_range<T>::of(multiplier, multiplier), operator_type::multi, re);
+				}
+			}
+		}
+		else if (e->is_selector())
+		{
+			auto& j = sub_ranges[0];
+			if (j.is_constant()) //prune the dead branch
+			{
+				replacement = 0 != j.lower ? e->get_left_item() : e->get_right_item();
+				re = sub_ranges[0 != j.lower ? 1 : 2];
+			}
+			else if (j.known && sub_ranges[1].known && sub_ranges[2].known)
+				re = value_range<T>::of(std::min(sub_ranges[1].lower, sub_ranges[2].lower), std::max(sub_ranges[1].upper, sub_ranges[2].upper));
+		}
+		else if (e->is_data() && e->is_reverser())
+			re = -sub_ranges[0];
+		else if (e->is_reverser()) //not_judge_exp
+			re = sub_ranges[0].known ? value_range<T>::of(1 - sub_ranges[0].upper, 1 - sub_ranges[0].lower) : sub_ranges[0];
+		else if (e->need_to_bool()) //transparent_judge_exp
+			re = sub_ranges[0];
+		else if (e->is_data()) //binary_data_exp
+			re = value_range<T>::calculate(sub_ranges[0], e->get_operator_type(), sub_ranges[1]);
+		else if (!e->is_composite()) //binary_judge_exp
+			re = value_range<T>::compare(sub_ranges[0], e->get_operator_type(), sub_ranges[1]);
+		else //logical_exp, the left item decides first (short circuit control), then any item which doesn't decide can be removed
+		{
+			auto& l = sub_ranges[0], & r = sub_ranges[1];
+			T decisive = operator_type::logical_and == e->get_operator_type() ? 0 : 1;
+			if (l.is_constant())
+			{
+				if (decisive == l.lower)
+					re = l;
+				else
+					re = r, replacement = e->get_right_item();
+			}
+			else if (r.is_constant() && decisive != r.lower)
+				re = l, replacement = e->get_left_item();
+			else if (l.known && r.known)
+				re = 0 == decisive ? value_range<T>::of(l.lower && r.lower, l.upper && r.upper) :
+					value_range<T>::of(l.lower || r.lower, l.upper || r.upper);
+
+			if (replacement && replacement->is_data()) //'1 && a' equals to 'a?'
+				replacement = make_exp<transparent_judge_exp<T>>(replacement);
+		}
+
+		if (re.is_constant() && !replacement && !(e->is_data() ? e->is_immediate() : e->need_to_bool() && e->get_left_item()->is_immediate()))
+			replacement = e->is_data() ? make_exp<immediate_data_exp<T>>(re.lower) : make_constant_judge(0 != re.lower);
+		if (replacement)
+		{
+			e = replacement;
+			if (!exps.empty())
+				exps[f.parent].items_changed = true;
+		}
+
+		ranges.resize(ranges.size() - num);
+		ranges.push_back(re);
+	}
+}
+/////////////////////////////////////////////////////////////////////////////////////////
+
+/////////////////////////////////////////////////////////////////////////////////////////
+template <typename T> inline bool compare(T& operand, operator_type c, T v)
+{
+	switch (c)
+	{
+	case operator_type::bigger:
+		return (bool) (operand = (T) (operand > v));
+	case operator_type::bigger_equal:
+		return (bool) (operand = (T) (operand >= v));
+	case operator_type::smaller:
+		return (bool) (operand = (T) (operand < v));
+	case operator_type::smaller_equal:
+		return (bool) (operand = (T) (operand <= v));
+	case operator_type::equal:
+		return (bool) (operand = (T) (operand == v));
+	case operator_type::not_equal:
+		return (bool) (operand = (T) (operand != v));
+	default:
+		throw("unknown compare operator " + to_string(c));
+	}
+}
+template <typename T> inline bool compare(T& operand, const std::string& c, T v)
+{
+	if (!is_comparer(c))
+		throw("unknown compare operator " + c);
+	return compare(operand, to_operator_type(c), v);
+}
+
+//the max depth of an expression (no recursion will be introduced), which is also the bound of the depth of safe_data.
+template <typename T> inline size_t get_max_depth(exp_ctype<T>& exp) {return (size_t) exp->get_depth();}
+
+//stacks used by safe_data and safe_judge, reuse one context for many evaluations to avoid heap allocations, a context
+// constructed from an expression is able to evaluate it without any heap allocations, even for the first time.
+//a context can only be used by one evaluation at a time.
+template <typename T> class eval_context
+{
+	template <typename U, typename ARG> friend std::pair<U, size_t> do_safe_data(exp_ctype<U>&, const ARG&, eval_context<U>&);
+
+public:
+	eval_context() {}
+	eval_context(exp_ctype<T>& exp) {reserve(get_max_depth(exp));}
+
+	void reserve(size_t depth) {exps.reserve(depth); res.reserve(depth);}
+
+private:
+	//branch: -1 - before handling, 0 - road map, 1 - left branch, 2 - right branch
+	struct frame {const exp<T>* e; int branch;};
+	std::vector<frame> exps;
+	std::vector<T> res;
+};
+
+//compilation never recurses with any optimization level, but since recursion is used during the execution (operator()),
+// if your expression is too complicated to be executed (stack overflow), use qme::safe_data/qme::safe_judge to execute it,
+//then recursion will be eliminated (destruction never recurses, so qme::safe_delete is not necessary anymore), but additional runtime judgment will be performed, we have no choice.
+//
+//show_immediate_value is still recursive, if you're encountering above situation, you should not call it manually, please note.
+//the source of variables (ARG) can be a callback or an array of values indexed by slots.
+template <typename T, typename ARG> inline std::pair<T, size_t> do_safe_data(exp_ctype<T>& exp, const ARG& cb, eval_context<T>& context)
+{
+	if (!exp->is_parent())
+		return std::make_pair((*exp)(cb), 1);
+
+	size_t max_depth = 1;
+	auto& exps = context.exps; //the max depth is the max size that this stack ever get
+	auto& res = context.res;
+	exps.clear();
+	res.clear();
+
+	auto direction = 0; //0 - road map, 1 - left-bottom, 2 - right-bottom, 3 - top-left
+	exps.push_back(typename eval_context<T>::frame {exp.get(), -1});
+	while (!exps.empty())
+	{
+		auto& top = exps.back();
+		auto e = top.e;
+		if (0 == direction) //road map
+		{
+			top.branch = 0;
+			auto& road_map = e->get_road_map();
+			if (!road_map)
+				direction = 1;
+			else if (road_map->is_parent())
+				exps.push_back(typename eval_context<T>::frame {road_map.get(), -1});
 			else
 			{
-				res.emplace_back((T) road_map->judge(cb));
+				res.push_back((T) road_map->judge(cb));
 				direction = 3;
 				max_depth = std::max(exps.size() + 1, max_depth);
 			}
 		}
 		else if (1 == direction) //left
 		{
-			iter->second = 1;
-			auto left = iter->first->get_left_item();
+			top.branch = 1;
+			auto& left = e->get_left_item();
 			if (left->is_parent())
 			{
-				exps.emplace_back(left, -1);
-				iter = exps.rbegin();
+				exps.push_back(typename eval_context<T>::frame {left.get(), -1});
 				direction = 0;
 			}
 			else
 			{
-				res.emplace_back((*left)(cb));
-				direction = iter->first->is_selector() ? 3 : 2;
+				res.push_back((*left)(cb));
+				direction = e->is_selector() ? 3 : 2;
 				max_depth = std::max(exps.size() + 1, max_depth);
 			}
 		}
 		else if (2 == direction) //right
 		{
-			iter->second = direction++;
-			if (iter->first->is_reverser() || iter->first->need_to_bool())
+			top.branch = direction++;
+			if (e->is_reverser() || e->need_to_bool())
 				continue;
-			else if (!iter->first->is_selector())
+			else if (!e->is_selector())
 			{
-				auto& lop = iter->first->get_operator();
+				auto lop = e->get_operator_type();
 				if (is_logical_operator(lop))
 				{
 					assert(!res.empty());
 					auto re = 0 != res.back();
-					if ("&&" == lop ? !re : re)
+					if (operator_type::logical_and == lop ? !re : re)
 						continue; //short circuit control
 					res.pop_back();
 				}
 			}
 
-			auto right = iter->first->get_right_item();
+			auto& right = e->get_right_item();
 			if (right->is_parent())
 			{
-				exps.emplace_back(right, -1);
-				iter = exps.rbegin();
+				exps.push_back(typename eval_context<T>::frame {right.get(), -1});
 				direction = 0;
 			}
 			else
 			{
-				res.emplace_back((*right)(cb));
+				res.push_back((*right)(cb));
 				max_depth = std::max(exps.size() + 1, max_depth);
 			}
 		}
 		else //3 == direction, backtrace
 		{
-			if (iter->first->is_reverser())
+			if (e->is_reverser())
 			{
 				assert(!res.empty());
-				if (iter->first->is_data())
+				if (e->is_data())
 					negate(res.back());
 				else
 					to_not(res.back());
 			}
-			else if (iter->first->need_to_bool())
+			else if (e->need_to_bool())
 			{
 				assert(!res.empty());
 				to_bool(res.back());
 			}
-			else if (!iter->first->is_selector())
+			else if (!e->is_selector())
 			{
-				auto& op = iter->first->get_operator();
+				auto op = e->get_operator_type();
 				if (is_logical_operator(op))
 				{
 					assert(!res.empty());
@@ -1263,34 +2479,69 @@ template <typename T> inline std::pair<T, size_t> safe_data(exp_ctype<T>& exp, c
 					if (is_comparer(op))
 						compare(res.back(), op, re);
 					else //+-*/
-						calculate(res.back(), op.front(), re);
+						calculate(res.back(), op, re);
 				}
 			}
 
-			if (0 == iter->second) //road map
+			if (0 == top.branch) //road map
 			{
 				assert(!res.empty());
 				direction = 0 != res.back() ? 1 : 2;
 				res.pop_back();
 			}
-			else if (++iter != exps.rend() && !iter->first->is_selector() && 1 == iter->second)
-				direction = 2;
-			iter = decltype(iter)(exps.erase(iter.base(), std::end(exps)));
+			else
+			{
+				exps.pop_back();
+				if (!exps.empty() && !exps.back().e->is_selector() && 1 == exps.back().branch)
+					direction = 2;
+			}
 		}
+	}
 
-	assert(max_depth > 1 && exps.empty() && 1 == res.size());
+	assert(max_depth > 1 && 1 == res.size());
 #ifdef DEBUG
 	std::cout << " max depth: " << max_depth << std::endl;
 #endif
 	return std::make_pair(res.back(), max_depth);
 }
 
+//return the data and max depth (just traveled branches).
+template <typename T> inline std::pair<T, size_t> safe_data(exp_ctype<T>& exp, const std::function<T(const std::string&)>& cb,
+	eval_context<T>& context) {return do_safe_data(exp, cb, context);}
+template <typename T> inline std::pair<T, size_t> safe_data(exp_ctype<T>& exp, const T* values, eval_context<T>& context)
+	{return do_safe_data(exp, values, context);}
+template <typename T> inline std::pair<T, size_t> safe_data(exp_ctype<T>& exp, const fetch_once<T>& cb, eval_context<T>& context)
+	{return do_safe_data(exp, std::function<T(const std::string&)>(std::cref(cb)), context);} //cb will not be copied
+template <typename T> inline std::pair<T, size_t> safe_data(exp_ctype<T>& exp, const std::function<T(const std::string&)>& cb)
+	{eval_context<T> context; return safe_data(exp, cb, context);}
+template <typename T> inline std::pair<T, size_t> safe_data(exp_ctype<T>& exp, const T* values)
+	{eval_context<T> context; return safe_data(exp, values, context);}
+template <typename T> inline std::pair<T, size_t> safe_data(exp_ctype<T>& exp, const fetch_once<T>& cb)
+	{eval_context<T> context; return safe_data(exp, cb, context);}
+
 //return the judgment and max depth (just traveled branches).
-template <typename T> inline std::pair<bool, size_t> safe_judge(exp_ctype<T>& exp, const std::function<T(const std::string&)>& cb)
+template <typename T> inline std::pair<bool, size_t> safe_judge(exp_ctype<T>& exp, const std::function<T(const std::string&)>& cb,
+	eval_context<T>& context)
+{
+	auto re = safe_data(exp, cb, context);
+	return std::make_pair(0 != re.first, re.second);
+}
+template <typename T> inline std::pair<bool, size_t> safe_judge(exp_ctype<T>& exp, const T* values, eval_context<T>& context)
 {
-	auto re = safe_data(exp, cb);
+	auto re = safe_data(exp, values, context);
 	return std::make_pair(0 != re.first, re.second);
 }
+template <typename T> inline std::pair<bool, size_t> safe_judge(exp_ctype<T>& exp, const fetch_once<T>& cb, eval_context<T>& context)
+{
+	auto re = safe_data(exp, cb, context);
+	return std::make_pair(0 != re.first, re.second);
+}
+template <typename T> inline std::pair<bool, size_t> safe_judge(exp_ctype<T>& exp, const std::function<T(const std::string&)>& cb)
+	{eval_context<T> context; return safe_judge(exp, cb, context);}
+template <typename T> inline std::pair<bool, size_t> safe_judge(exp_ctype<T>& exp, const T* values)
+	{eval_context<T> context; return safe_judge(exp, values, context);}
+template <typename T> inline std::pair<bool, size_t> safe_judge(exp_ctype<T>& exp, const fetch_once<T>& cb)
+	{eval_context<T> context; return safe_judge(exp, cb, context);}
 
 #define TRAVEL_EXP(branch_name) \
 { \
@@ -1308,7 +2559,7 @@ template <typename T> inline std::pair<bool, size_t> safe_judge(exp_ctype<T>& ex
 		max_depth = std::max(exps.size() + 1, max_depth); \
 }
 
-//return the max depth.
+//return the max depth, kept for compatibility, expressions with any depth can be destroyed directly now.
 template <typename T> inline size_t safe_delete(exp_ctype<T>& exp)
 {
 	size_t max_depth = 1;
@@ -1334,87 +2585,1031 @@ template <typename T> inline size_t safe_delete(exp_ctype<T>& exp)
 	assert(max_depth > 0 && exps.empty() && exp->is_leaf());
 	return max_depth;
 }
+
+//the structural key of an expression whose sub expressions have already been shared, so they can be identified by their addresses.
+template <typename T> inline std::string get_structural_key(exp_ctype<T>& exp)
+{
+	std::string key = typeid(*exp).name();
+	auto append = [&](const void* data, size_t len) {key.append((const char*) data, len);};
+	if (exp->is_immediate())
+	{
+		auto v = exp->get_immediate_value();
+		append(&v, sizeof(v));
+	}
+	else if (exp->is_variable())
+	{
+		auto multiplier = exp->get_multiplier();
+		auto exponent = exp->get_exponent();
+		append(&multiplier, sizeof(multiplier));
+		append(&exponent, sizeof(exponent));
+		key += exp->get_variable_name();
+	}
+	else
+	{
+		const qme::exp<T>* items[] = {exp->get_road_map().get(), exp->get_left_item().get(), exp->get_right_item().get()};
+		append(items, sizeof(items));
+		if (exp->get_right_item() && !exp->is_selector())
+			key += (char) exp->get_operator_type();
+	}
+
+	return key;
+}
+
+//hash-consing, identical sub expressions (same operator and same sub expressions, or same leaf) will be shared, no recursion will
+// be introduced. all expressions share the same exps will share their sub expressions too, the shared expression is returned.
+template <typename T> inline exp_type<T> share_common_exps(exp_ctype<T>& exp, std::map<std::string, exp_type<T>>& exps)
+{
+	std::map<const qme::exp<T>*, exp_type<T>> shared; //original expression to the shared one
+	std::vector<std::pair<exp_type<T>, bool>> stack(1, std::make_pair(exp, false)); //second - whether sub expressions have been pushed
+	while (!stack.empty())
+	{
+		auto& top = stack.back();
+		if (shared.count(top.first.get()))
+			stack.pop_back();
+		else if (!top.second)
+		{
+			top.second = true;
+			auto e = top.first; //stack may be reallocated
+			e->replace_items([&](exp_type<T>& item) {stack.emplace_back(item, false);});
+		}
+		else
+		{
+			auto e = std::move(top.first);
+			stack.pop_back();
+			e->replace_items([&](exp_type<T>& item) {item = shared[item.get()];});
+			auto& s = exps[get_structural_key(e)];
+			if (!s)
+				s = e;
+			shared[e.get()] = s;
+		}
+	}
+
+	return shared[exp.get()];
+}
+
+//call handler with each variable in the expression by the order of appearance (no recursion will be introduced).
+template <typename T, typename HANDLER> inline void for_each_variable(exp_ctype<T>& exp, const HANDLER& handler)
+{
+	std::vector<decltype(exp.get())> exps(1, exp.get());
+	while (!exps.empty())
+	{
+		auto e = exps.back();
+		exps.pop_back();
+		if (e->is_variable())
+			handler(*e);
+		else //push in reverse order
+		{
+			if (e->get_right_item())
+				exps.push_back(e->get_right_item().get());
+			if (e->get_left_item())
+				exps.push_back(e->get_left_item().get());
+			if (e->get_road_map())
+				exps.push_back(e->get_road_map().get());
+		}
+	}
+}
+
+//assign a slot to each variable in the expression, the symbol table can be shared by many expressions, then all of them can be
+// executed with the same array of values.
+//expressions returned by the compile cache are shared, their variables can't be bound to other slots (an exception will be thrown),
+// compile the statement with the symbol table instead (see compiler::compile).
+template <typename T> inline void bind_symbols(exp_ctype<T>& exp, symbol_table& symbols)
+	{for_each_variable(exp, [&](qme::exp<T>& e) {e.bind(symbols.insert(e.get_variable_name()));});}
+/////////////////////////////////////////////////////////////////////////////////////////
+
 /////////////////////////////////////////////////////////////////////////////////////////
+//a cheap timestamp for instrumentation, CPU cycles (time stamp counter) on x86 with gcc or clang, steady clock ticks otherwise.
+inline uint64_t read_timestamp()
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	return __builtin_ia32_rdtsc();
+#else
+	return (uint64_t) std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+//print an immediate value so that it can be parsed back to exactly the same value, the parser doesn't accept exponent notation,
+// so floating point values are printed in fixed notation with the fewest decimals which read back the same value.
+//infinities (from 'a / 0' merged by O3 for example) and NaN can't be parsed, so an exception will be thrown for them, unless
+// parseable is false (for reports), then they're printed as inf, -inf and nan.
+template <typename T> inline std::string to_immediate_text(T v, bool parseable = true)
+{
+	auto infinity = std::numeric_limits<T>::infinity();
+	if (v != v || (std::numeric_limits<T>::has_infinity && (infinity == v || -infinity == v)))
+	{
+		std::string text = v != v ? "nan" : v < 0 ? "-inf" : "inf";
+		if (parseable)
+			throw("unsupported immediate value " + text);
+		return text;
+	}
+
+	std::ostringstream os;
+	os << std::fixed;
+	for (std::streamsize precision = 0;; ++precision)
+	{
+		os.str(std::string());
+		os.precision(precision);
+		os << v;
+		//float and double need at most 149 and 1074 decimals (the smallest denormalized values)
+		if (!std::is_floating_point<T>::value || precision > 1100 || (T) strtod(os.str().data(), nullptr) == v)
+			return os.str();
+	}
+}
+
+//print the expression as a statement which can be compiled again (no recursion will be introduced), all binary expressions are
+// parenthesized, variables with exponents are expanded to multiplications since there's no power operator, and values judged
+// as bool are printed as 'a != 0'. immediate values are printed by to_immediate_text, so they will not be changed (expressions
+// with infinities or NaN can't be printed, unless parseable is false).
+template <typename T> inline std::string to_statement(exp_ctype<T>& exp, bool parseable = true)
+{
+	auto to_text = [=](T v) {return to_immediate_text(v, parseable);};
+
+	std::vector<std::pair<const exp_type<T>*, bool>> exps(1, std::make_pair(&exp, false)); //the second means expanded
+	std::vector<std::string> res;
+	while (!exps.empty())
+	{
+		auto& e = *exps.back().first;
+		if (!e->is_leaf() && !exps.back().second)
+		{
+			exps.back().second = true;
+			const exp_type<T>* items[] = {&e->get_right_item(), &e->get_left_item(), &e->get_road_map()};
+			for (auto item : items)
+				if (*item)
+					exps.emplace_back(item, false);
+			continue;
+		}
+
+		exps.pop_back();
+		std::string re;
+		if (e->is_immediate())
+			re = to_text(e->get_immediate_value());
+		else if (e->is_variable())
+		{
+			auto exponent = e->get_exponent();
+			for (auto n = exponent < 0 ? -exponent : exponent; n > 0; --n)
+				re += (re.empty() ? "" : " * ") + e->get_variable_name();
+			if (0 == exponent)
+				re = "1";
+			else if (exponent < 0)
+				re = "1 / " + (exponent < -1 ? '(' + re + ')' : re);
+
+			auto multiplier = e->get_multiplier();
+			if (-1 == multiplier)
+				re = exponent < 0 ? "-(" + re + ')' : '-' + re;
+			else if (1 != multiplier)
+				re = to_text(multiplier) + " * " + (exponent < 0 ? '(' + re + ')' : re);
+			if (1 != exponent || 1 != multiplier)
+				re = '(' + re + ')';
+		}
+		else if (e->is_selector())
+		{
+			auto i = res.size() - 3;
+			re = '(' + res[i] + " ? " + res[i + 1] + " : " + res[i + 2] + ')';
+		}
+		else if (!e->get_right_item()) //unitary exp
+			re = e->need_to_bool() ? '(' + res.back() + " != 0)" : std::string(e->is_data() ? "-(" : "!(") + res.back() + ')';
+		else
+		{
+			auto i = res.size() - 2;
+			re = '(' + res[i] + ' ' + e->get_operator() + ' ' + res[i + 1] + ')';
+		}
+
+		res.resize(res.size() - (e->is_selector() ? 3 : e->get_right_item() ? 2 : e->get_left_item() ? 1 : 0));
+		res.push_back(std::move(re));
+	}
+
+	return res.front();
+}
+
+//profile-guided optimization and instrumentation, execute an expression with a profiler (on real or sampled records) to collect
+// statistics of each node, then reorder the expression by them (see reorder) or print a report (see report).
+//executing expressions by operator(), qme::program or any other ways is not affected at all, so profilers can be used in release
+// builds for a sampled fraction of executions without any overhead for the others.
+//like operator(), recursion will be introduced during the profiling.
+template <typename T> class profiler
+{
+public:
+	//visits - how many times the node has been executed, trues - how many times its outcome was not 0,
+	// cost - how many nodes have been executed within the sub expression (itself included) in total,
+	// short_circuits - how many times the right item has been skipped (logical expressions only),
+	// true_branches - how many times the left item has been selected (question mark expressions only),
+	// elapsed - timestamps (see read_timestamp) spent within the sub expression in total, only if timing is enabled.
+	struct node_stats {size_t visits, trues, cost, short_circuits, true_branches; uint64_t elapsed;};
+
+	//timing costs two timestamps per node, which can be much more than executing the node itself, so elapsed is only
+	// meaningful for comparing big sub expressions.
+	profiler(bool _timing = false) : timing(_timing) {}
+
+	T data(exp_ctype<T>& exp, const std::function<T(const std::string&)>& cb) {return execute(*exp, cb).first;}
+	T data(exp_ctype<T>& exp, const T* values) {return execute(*exp, values).first;}
+	bool judge(exp_ctype<T>& exp, const std::function<T(const std::string&)>& cb) {return 0 != data(exp, cb);}
+	bool judge(exp_ctype<T>& exp, const T* values) {return 0 != data(exp, values);}
+
+	//nullptr means the node has never been executed, a shared node (see share_common_exps) accumulates all its occurrences.
+	const node_stats* find(const exp<T>* e) const {auto iter = stats.find(e); return std::end(stats) == iter ? nullptr : &iter->second;}
+	void clear() {stats.clear();}
+
+	//print the statement of the expression, then statistics of executed nodes in pre-order, one node per line, indented by depth,
+	// with the operator of the node (or the variable / immediate value for leaves), the statement is printed only once so the
+	// report grows linearly with the expression. cost and elapsed are averaged by visits. no recursion will be introduced.
+	void report(std::ostream& os, exp_ctype<T>& exp) const
+	{
+		os << to_statement(exp, false) << std::endl;
+		std::vector<std::pair<const exp_type<T>*, size_t>> exps(1, std::make_pair(&exp, 0)); //the second is the depth
+		while (!exps.empty())
+		{
+			auto& e = *exps.back().first;
+			auto depth = exps.back().second;
+			exps.pop_back();
+			auto s = find(e.get());
+			if (!s)
+				continue;
+
+			os << std::string(2 * depth, ' ') << label(e) << ": visits " << s->visits << ", trues " << s->trues
+				<< ", cost " << (double) s->cost / s->visits;
+			if (e->is_judge() && e->is_composite())
+				os << ", short circuits " << s->short_circuits;
+			else if (e->is_selector())
+				os << ", true branches " << s->true_branches;
+			if (timing)
+				os << ", elapsed " << (double) s->elapsed / s->visits;
+			os << std::endl;
+
+			const exp_type<T>* items[] = {&e->get_right_item(), &e->get_left_item(), &e->get_road_map()};
+			for (auto item : items)
+				if (*item)
+					exps.emplace_back(item, depth + 1);
+		}
+	}
+
+private:
+	static std::string label(exp_ctype<T>& e)
+	{
+		if (e->is_leaf())
+			return to_statement(e, false);
+		else if (e->is_selector())
+			return "?";
+		else if (!e->get_right_item()) //unitary exp
+			return e->need_to_bool() ? "!= 0" : e->is_data() ? "-" : "!";
+		return e->get_operator();
+	}
+
+	template <typename ARG> std::pair<T, size_t> execute(const exp<T>& e, const ARG& cb) //return the outcome and the cost
+	{
+		auto start = timing ? read_timestamp() : 0;
+		size_t cost = 1, short_circuits = 0, true_branches = 0;
+		auto sub = [&](exp_ctype<T>& item) {auto re = this->execute(*item, cb); cost += re.second; return re.first;};
+
+		T re;
+		if (e.is_leaf())
+			re = e(cb);
+		else if (e.is_selector())
+		{
+			true_branches = 0 != sub(e.get_road_map());
+			re = true_branches ? sub(e.get_left_item()) : sub(e.get_right_item());
+		}
+		else if (e.is_reverser())
+		{
+			re = sub(e.get_left_item());
+			if (e.is_data())
+				negate(re);
+			else
+				to_not(re);
+		}
+		else if (e.need_to_bool())
+			to_bool(re = sub(e.get_left_item()));
+		else
+		{
+			auto op = e.get_operator_type();
+			re = sub(e.get_left_item());
+			if (is_logical_operator(op))
+			{
+				short_circuits = operator_type::logical_and == op ? 0 == re : 0 != re;
+				if (!short_circuits)
+					re = sub(e.get_right_item());
+				to_bool(re);
+			}
+			else
+			{
+				auto r = sub(e.get_right_item());
+				if (is_comparer(op))
+					compare(re, op, r);
+				else //+-*/
+					calculate(re, op, r);
+			}
+		}
+
+		auto& s = stats[&e];
+		++s.visits;
+		s.trues += 0 != re;
+		s.cost += cost;
+		s.short_circuits += short_circuits;
+		s.true_branches += true_branches;
+		if (timing)
+			s.elapsed += read_timestamp() - start;
+		return std::make_pair(re, cost);
+	}
+
+private:
+	bool timing;
+	std::map<const exp<T>*, node_stats> stats;
+};
+
+//reorder the expression by the statistics collected by the profiler, a new expression is returned, unchanged sub expressions are
+// shared with the original one, no recursion will be introduced. statistics are kept by the original nodes, profile the new
+// expression again if you want to reorder it again.
+//operands of logical expressions are swapped if it reduces the expected cost, for 'a && b' it's cost(a) + P(a) * cost(b), and
+// cost(b) + P(b) * cost(a) after swapping (for '||', P means the probability of being false). P(b) is estimated from executions
+// which didn't short circuit. operands are never swapped if any of them may throw exceptions (dividing a non-immediate value or 0),
+// variables are supposed to be fetched without exceptions since the fetching order will be changed.
+//branches of question mark expressions are swapped if the false branch has been taken more often and negating the judgment doesn't
+// introduce more nodes ('a > b' to 'a <= b' for example), then the more likely branch falls through in qme::program.
+template <typename T> inline exp_type<T> reorder(exp_ctype<T>& exp, const profiler<T>& p)
+{
+	//the expected cost of executing first first and then second if first doesn't decide
+	auto expected_cost = [](const typename profiler<T>::node_stats& first, const typename profiler<T>::node_stats& second, bool decisive) {
+		auto undecided = (double) (decisive ? first.visits - first.trues : first.trues) / first.visits;
+		return (double) first.cost / first.visits + undecided * second.cost / second.visits;
+	};
+
+	std::vector<std::pair<const exp_type<T>*, bool>> exps(1, std::make_pair(&exp, false)); //the second means expanded
+	std::vector<std::pair<exp_type<T>, bool>> res; //reordered sub expressions and whether they may throw exceptions
+	while (!exps.empty())
+	{
+		auto& e = *exps.back().first;
+		if (!e->is_leaf() && !exps.back().second)
+		{
+			exps.back().second = true;
+			const exp_type<T>* items[] = {&e->get_right_item(), &e->get_left_item(), &e->get_road_map()};
+			for (auto item : items)
+				if (*item)
+					exps.emplace_back(item, false);
+			continue;
+		}
+
+		exps.pop_back();
+		if (e->is_leaf())
+		{
+			res.emplace_back(e, false);
+			continue;
+		}
+
+		const qme::exp<T>* originals[] = {e->get_road_map().get(), e->get_left_item().get(), e->get_right_item().get()};
+		auto first = std::begin(originals) + (e->is_selector() ? 0 : 1), last = std::end(originals) - (e->get_right_item() ? 0 : 1);
+		auto items = res.data() + res.size() - (last - first);
+		auto changed = false, may_throw = false;
+		for (auto iter = first; iter != last; ++iter)
+		{
+			changed = changed || items[iter - first].first.get() != *iter;
+			may_throw = may_throw || items[iter - first].second;
+		}
+
+		exp_type<T> re;
+		if (e->is_selector())
+		{
+			auto s = p.find(originals[0]);
+			auto judge = s && 2 * s->trues < s->visits ? items[0].first->bang() : exp_type<T>();
+			if (judge && judge->get_node_count() <= items[0].first->get_node_count())
+				re = make_exp<question_exp<T>>(judge, items[2].first, items[1].first);
+			else if (changed)
+				re = make_exp<question_exp<T>>(items[0].first, items[1].first, items[2].first);
+		}
+		else if (e->is_data() && e->is_reverser())
+		{
+			if (changed)
+				re = make_exp<negative_data_exp<T>>(items[0].first);
+		}
+		else if (e->is_judge() && e->is_composite()) //logical_exp
+		{
+			auto op = e->get_operator_type();
+			auto l = p.find(originals[1]), r = p.find(originals[2]);
+			auto decisive = operator_type::logical_and != op;
+			auto swap = !may_throw && l && r && expected_cost(*r, *l, decisive) < expected_cost(*l, *r, decisive);
+			if (swap)
+				std::swap(items[0], items[1]);
+			if (swap || changed)
+				re = make_logical_exp(items[0].first, items[1].first, e->get_operator());
+		}
+		else if (changed && e->is_judge() && e->get_right_item()) //binary_judge_exp
+			re = make_binary_judge_exp(items[0].first, items[1].first, e->get_operator());
+		else if (changed)
+		{
+			re = e->clone();
+			auto n = 0;
+			re->replace_items([&](exp_type<T>& item) {item = items[n++].first;});
+			re->update();
+		}
+
+		if (e->is_data() && e->is_composite() && operator_type::div == e->get_operator_type())
+		{
+			auto& divisor = e->get_right_item();
+			may_throw = may_throw || !divisor->is_immediate() || 0 == divisor->get_immediate_value();
+		}
+		res.resize(res.size() - (last - first));
+		res.emplace_back(re ? re : e, may_throw);
+	}
+
+	return res.front().first;
+}
+/////////////////////////////////////////////////////////////////////////////////////////
+
+//execute the expression on many rows at once, columns are indexed by slots (see symbol_table) and each of them must hold
+// at least rows values, the outcome of row n will be written to out[n].
+//rows are handled block by block (see batch), just like operator(), recursion will be introduced.
+template <typename T>
+inline void batch_data(exp_ctype<T>& exp, const T* const* columns, size_t rows, T* out, simd_isa isa = best_simd_isa())
+{
+	batch<T> b(columns, isa);
+	for (size_t first = 0; first < rows; first += batch<T>::block_size)
+	{
+		b.select(first, std::min(batch<T>::block_size, rows - first));
+		exp->data(b, nullptr, std::next(out, first));
+	}
+}
+
+template <typename T>
+inline void batch_judge(exp_ctype<T>& exp, const T* const* columns, size_t rows, bool* out, simd_isa isa = best_simd_isa())
+{
+	batch<T> b(columns, isa);
+	typename batch<T>::buffer re(b);
+	for (size_t first = 0; first < rows; first += batch<T>::block_size)
+	{
+		b.select(first, std::min(batch<T>::block_size, rows - first));
+		exp->judge(b, nullptr, re);
+		for (size_t n = 0; n < b.size(); ++n)
+			out[first + n] = 0 != re[n];
+	}
+}
+/////////////////////////////////////////////////////////////////////////////////////////
+
+/////////////////////////////////////////////////////////////////////////////////////////
+enum class opcode : unsigned char
+{
+	immediate, //push the immediate value indexed by arg
+	load, //push the variable whose slot is arg
+	power, //top = top ^ arg (see qme::power)
+	square, cube, reciprocal, //top = top ^ 2, top ^ 3 and top ^ -1
+	negate, to_not, to_bool, //operate on the top
+	add, sub, multi, div, //pop the right operand and operate it with the top
+	bigger, bigger_equal, smaller, smaller_equal, equal, not_equal, //pop the right comparand and compare it with the top
+	jump, //jump to arg
+	jump_if_zero, //pop the top and jump to arg if it's zero (question exp)
+	jump_if_zero_or_pop, //jump to arg if the top is zero, otherwise pop it (short circuit of &&)
+	jump_if_not_zero_or_pop, //jump to arg if the top is not zero, otherwise pop it (short circuit of ||)
+	//push the value cached in arg and execute the next instruction (a jump over the computation of the value), or skip the next
+	// instruction if the value has not been cached during this execution.
+	load_cache,
+	store_cache, //cache the top in arg
+	store_output, //pop the top into the output indexed by arg
+};
+
+struct instruction
+{
+	opcode code;
+	int arg;
+};
+
+//a flat program lowered from an (optimized) expression, it will be executed by a stack based virtual machine, so no recursion will be
+// introduced during the lowering and the execution, nor virtual function calls during the execution.
+//judgments are represented by 0 and 1 just like safe_data.
+//sub expressions shared by more than one parent (see share_common_exps) will be evaluated at most once per execution.
+//a program can also be lowered from many expressions, then all of them will be evaluated in one execution (see rule_set).
+template <typename T> class program
+{
+public:
+	program(exp_ctype<T>& exp) : max_stack_size(0), cache_size(0) {lower(std::vector<exp_type<T>>(1, exp));}
+	program(const std::vector<exp_type<T>>& exps) : max_stack_size(0), cache_size(0) {lower(exps);}
+
+	inline T operator()(const std::function<T(const std::string&)>& cb) const {return data(cb);}
+	inline T operator()(const T* values) const {return data(values);} //values are indexed by slots, see symbol_table for more details
+
+	T data(const std::function<T(const std::string&)>& cb) const {return execute(cb);}
+	T data(const T* values) const {return execute(values);}
+	bool judge(const std::function<T(const std::string&)>& cb) const {return 0 != execute(cb);}
+	bool judge(const T* values) const {return 0 != execute(values);}
+
+	//stack must be able to hold stack_size() values at least, outputs must be able to hold output_size() values at least.
+	template <typename ARG> void execute(const ARG& arg, T* stack, T* outputs) const
+		{execute(code.data(), code.size(), consts.data(), max_stack_size, cache_size, [&](int slot) {return this->fetch(arg, slot);}, stack, outputs);}
+
+	//the virtual machine, code and consts can also be mapped from an image (see question_exp_image.h), fetch(slot) returns
+	// the value of a variable.
+	template <typename FETCH> static void execute(const instruction* first, size_t code_size, const T* consts,
+		size_t max_stack_size, size_t cache_size, const FETCH& fetch, T* stack, T* outputs)
+	{
+		auto cache = stack + max_stack_size, cached = cache + cache_size;
+		std::fill_n(cached, cache_size, (T) 0);
+		auto sp = stack;
+		for (auto pc = first, last = first + code_size; pc < last; ++pc)
+			switch (pc->code)
+			{
+			case opcode::immediate: *sp++ = consts[pc->arg]; break;
+			case opcode::load: *sp++ = fetch(pc->arg); break;
+			case opcode::power: sp[-1] = power<T>::raise(sp[-1], pc->arg); break;
+			case opcode::square: sp[-1] = power<T>::square(sp[-1], 2); break;
+			case opcode::cube: sp[-1] = power<T>::cube(sp[-1], 3); break;
+			case opcode::reciprocal: sp[-1] = power<T>::reciprocal(sp[-1], -1); break;
+			case opcode::negate: negate(sp[-1]); break;
+			case opcode::to_not: to_not(sp[-1]); break;
+			case opcode::to_bool: to_bool(sp[-1]); break;
+			case opcode::add: --sp; sp[-1] += *sp; break;
+			case opcode::sub: --sp; sp[-1] -= *sp; break;
+			case opcode::multi: --sp; sp[-1] *= *sp; break;
+			case opcode::div:
+				if (0 == *--sp)
+					throw("divide zero");
+				sp[-1] /= *sp;
+				break;
+			case opcode::bigger: --sp; sp[-1] = (T) (sp[-1] > *sp); break;
+			case opcode::bigger_equal: --sp; sp[-1] = (T) (sp[-1] >= *sp); break;
+			case opcode::smaller: --sp; sp[-1] = (T) (sp[-1] < *sp); break;
+			case opcode::smaller_equal: --sp; sp[-1] = (T) (sp[-1] <= *sp); break;
+			case opcode::equal: --sp; sp[-1] = (T) (sp[-1] == *sp); break;
+			case opcode::not_equal: --sp; sp[-1] = (T) (sp[-1] != *sp); break;
+			case opcode::jump: pc = first + pc->arg - 1; break;
+			case opcode::jump_if_zero: if (0 == *--sp) pc = first + pc->arg - 1; break;
+			case opcode::jump_if_zero_or_pop: if (0 == sp[-1]) pc = first + pc->arg - 1; else --sp; break;
+			case opcode::jump_if_not_zero_or_pop: if (0 != sp[-1]) pc = first + pc->arg - 1; else --sp; break;
+			case opcode::load_cache: if (0 != cached[pc->arg]) *sp++ = cache[pc->arg]; else ++pc; break;
+			case opcode::store_cache: cache[pc->arg] = sp[-1]; cached[pc->arg] = 1; break;
+			case opcode::store_output: outputs[pc->arg] = *--sp; break;
+			}
+
+		assert(stack == sp);
+	}
+
+	template <typename ARG> void execute_all(const ARG& arg, T* outputs) const
+	{
+		if (stack_size() <= 64)
+		{
+			T stack[64];
+			execute(arg, stack, outputs);
+		}
+		else
+		{
+			std::vector<T> stack(stack_size());
+			execute(arg, stack.data(), outputs);
+		}
+	}
+
+	//for programs with only one output
+	template <typename ARG> T execute(const ARG& arg, T* stack) const {T re; execute(arg, stack, &re); return re;}
+	template <typename ARG> T execute(const ARG& arg) const {T re; execute_all(arg, &re); return re;}
+
+	size_t stack_size() const {return max_stack_size + 2 * cache_size;} //including cached values and their flags
+	size_t output_size() const {return outputs_size;}
+	size_t get_max_stack_size() const {return max_stack_size;}
+	size_t get_cache_size() const {return cache_size;}
+	const std::vector<instruction>& get_code() const {return code;}
+	const std::vector<T>& get_consts() const {return consts;}
+	const std::vector<std::string>& get_variable_names() const {return variable_names;} //indexed by slots
+
+private:
+	T fetch(const T* values, int slot) const {return values[slot];}
+	T fetch(const std::function<T(const std::string&)>& cb, int slot) const {return cb(variable_names[slot]);}
+	template <typename F, typename = typename std::enable_if<!std::is_pointer<F>::value>::type>
+	T fetch(const F& f, int slot) const {return f((size_t) slot);} //any callable which accepts a slot
+
+	void emit(opcode c, int arg = 0) {code.push_back(instruction {c, arg});}
+	void emit_immediate(T value) {emit(opcode::immediate, (int) consts.size()); consts.push_back(value);}
+	void patch(size_t index) {code[index].arg = (int) code.size();} //jump to the next instruction
+
+	//returns how many stack slots the leaf uses, its value and (if any) the multiplier.
+	size_t emit_leaf(exp_ctype<T>& exp)
+	{
+		if (exp->is_immediate())
+		{
+			emit_immediate(exp->get_immediate_value());
+			return 1;
+		}
+		else if (!exp->is_variable())
+			throw("unsupported leaf expression!");
+
+		auto slot = exp->get_slot();
+		if (symbol_table::npos == slot)
+			throw("unbound variable " + exp->get_variable_name());
+		else if (slot >= variable_names.size())
+			variable_names.resize(slot + 1);
+		variable_names[slot] = exp->get_variable_name();
+
+		emit(opcode::load, (int) slot);
+		auto exponent = exp->get_exponent();
+		auto raise = power<T>::get(exponent);
+		if (&power<T>::square == raise)
+			emit(opcode::square);
+		else if (&power<T>::cube == raise)
+			emit(opcode::cube);
+		else if (&power<T>::reciprocal == raise)
+			emit(opcode::reciprocal);
+		else if (&power<T>::one != raise)
+			emit(opcode::power, exponent);
+		auto multiplier = exp->get_multiplier();
+		if (-1 == multiplier)
+			emit(opcode::negate);
+		else if (1 != multiplier)
+		{
+			emit_immediate(multiplier);
+			emit(opcode::multi);
+			return 2;
+		}
+		return 1;
+	}
+
+	static opcode to_opcode(operator_type op)
+	{
+		switch (op)
+		{
+		case operator_type::add: return opcode::add;
+		case operator_type::sub: return opcode::sub;
+		case operator_type::multi: return opcode::multi;
+		case operator_type::div: return opcode::div;
+		case operator_type::bigger: return opcode::bigger;
+		case operator_type::bigger_equal: return opcode::bigger_equal;
+		case operator_type::smaller: return opcode::smaller;
+		case operator_type::smaller_equal: return opcode::smaller_equal;
+		case operator_type::equal: return opcode::equal;
+		case operator_type::not_equal: return opcode::not_equal;
+		case operator_type::logical_and: return opcode::jump_if_zero_or_pop;
+		case operator_type::logical_or: return opcode::jump_if_not_zero_or_pop;
+		default: throw("undefined operator " + to_string(op));
+		}
+	}
+
+	//parent expressions which have more than one parent (roots are parents of themselves) will be cached (leaves are cheap enough
+	// to be evaluated again).
+	void assign_caches(const std::vector<exp_type<T>>& roots)
+	{
+		std::map<const qme::exp<T>*, size_t> parents;
+		std::vector<const qme::exp<T>*> exps;
+		for (auto& root : roots)
+			if (!root->is_leaf() && 1 == ++parents[root.get()])
+				exps.push_back(root.get());
+		while (!exps.empty())
+		{
+			auto e = exps.back();
+			exps.pop_back();
+			for (auto item : {e->get_road_map().get(), e->get_left_item().get(), e->get_right_item().get()})
+				if (item && !item->is_leaf() && 1 == ++parents[item])
+					exps.push_back(item);
+		}
+
+		for (auto& item : parents)
+			if (item.second > 1)
+				caches[item.first] = (int) cache_size++;
+	}
+
+	//travel the expression with an explicit stack, each node will be visited several times (stages), the depth of the virtual
+	// machine's stack is tracked at the same time.
+	//a cached expression will be emitted at each place it appears (since any of them may be skipped at runtime), surrounded by
+	// load_cache/jump and store_cache.
+	void lower(const std::vector<exp_type<T>>& exps)
+	{
+		assign_caches(exps);
+		outputs_size = exps.size();
+		size_t node_count = exps.size(); //store_output
+		for (auto& exp : exps)
+			node_count += exp->get_node_count(); //about one instruction per node
+		code.reserve(node_count);
+		for (size_t n = 0; n < exps.size(); ++n)
+		{
+			lower(exps[n]);
+			emit(opcode::store_output, (int) n);
+		}
+		caches.clear();
+	}
+
+	void lower(exp_ctype<T>& exp)
+	{
+		struct frame {const exp_type<T>* e; int stage; size_t patch_index, depth, cache_patch_index;};
+		std::vector<frame> frames(1, frame {&exp, 0, 0, 0, 0});
+		size_t depth = 0;
+		while (!frames.empty())
+		{
+			auto i = frames.size() - 1;
+			const auto& e = *frames[i].e;
+			auto stage = frames[i].stage++;
+			auto cache = caches.find(e.get());
+			if (0 == stage && caches.end() != cache)
+			{
+				emit(opcode::load_cache, cache->second);
+				frames[i].cache_patch_index = code.size();
+				emit(opcode::jump);
+			}
+
+			if (e->is_leaf())
+			{
+				max_stack_size = std::max(depth + emit_leaf(e), max_stack_size);
+				++depth;
+			}
+			else if (e->is_selector()) //question exp
+				switch (stage)
+				{
+				case 0: frames.push_back(frame {&e->get_road_map(), 0, 0, 0, 0}); continue;
+				case 1:
+					frames[i].patch_index = code.size();
+					emit(opcode::jump_if_zero);
+					frames[i].depth = --depth;
+					frames.push_back(frame {&e->get_left_item(), 0, 0, 0, 0});
+					continue;
+				case 2:
+				{
+					auto jump_index = code.size();
+					emit(opcode::jump);
+					patch(frames[i].patch_index);
+					frames[i].patch_index = jump_index;
+					depth = frames[i].depth;
+					frames.push_back(frame {&e->get_right_item(), 0, 0, 0, 0});
+					continue;
+				}
+				default: patch(frames[i].patch_index); break;
+				}
+			else if (!e->get_right_item()) //unitary exp
+			{
+				if (0 == stage)
+				{
+					frames.push_back(frame {&e->get_left_item(), 0, 0, 0, 0});
+					continue;
+				}
+				emit(e->is_reverser() ? (e->is_data() ? opcode::negate : opcode::to_not) : opcode::to_bool);
+			}
+			else //binary exp
+			{
+				auto c = to_opcode(e->get_operator_type());
+				auto is_logical = opcode::jump_if_zero_or_pop == c || opcode::jump_if_not_zero_or_pop == c;
+				switch (stage)
+				{
+				case 0: frames.push_back(frame {&e->get_left_item(), 0, 0, 0, 0}); continue;
+				case 1:
+					if (is_logical)
+					{
+						frames[i].patch_index = code.size();
+						emit(c);
+						--depth;
+					}
+					frames.push_back(frame {&e->get_right_item(), 0, 0, 0, 0});
+					continue;
+				default:
+					if (is_logical)
+					{
+						patch(frames[i].patch_index);
+						emit(opcode::to_bool);
+					}
+					else
+					{
+						emit(c);
+						--depth;
+					}
+					break;
+				}
+			}
+
+			if (caches.end() != cache)
+			{
+				emit(opcode::store_cache, cache->second);
+				patch(frames[i].cache_patch_index);
+			}
+			frames.pop_back();
+		}
+
+		assert(1 == depth);
+	}
+
+private:
+	std::vector<instruction> code;
+	std::vector<T> consts;
+	std::vector<std::string> variable_names;
+	size_t max_stack_size, cache_size, outputs_size;
+	std::map<const exp<T>*, int> caches; //only used during the lowering
+};
+/////////////////////////////////////////////////////////////////////////////////////////
+
+template <typename T, typename O> class rule_set;
+template <typename T = float, typename O = O3> class compiler
+{
+	friend class rule_set<T, O>;
+
+public:
+	static exp_type<T> to_judge_exp(exp_ctype<T>& exp) {return exp->is_data() ? make_exp<transparent_judge_exp<T>>(exp) : exp;}
+	static exp_type<T> compile(const char* statement) {return compile(std::string(statement));}
+	static exp_type<T> compile(const std::string& statement) {symbol_table symbols; return compile(statement, symbols);}
+	//variables will be bound to slots in symbols (new variables will be appended), then the expression can also be executed
+	// with an array of values indexed by these slots.
+	static exp_type<T> compile(const char* statement, symbol_table& symbols) {return compile(std::string(statement), symbols);}
+	static exp_type<T> compile(const std::string& statement, symbol_table& symbols)
+	{
+		auto expression = statement;
+		remove_blanks(expression);
+
+		auto& c = get_cache();
+		auto re = c.find(expression, symbols);
+		if (!re && (re = compile_normalized(expression, symbols)))
+			c.insert(expression, re);
+		return re;
+	}
+	//values of variables are declared to be within bounds at runtime, judgments which become constant with these bounds will be
+	// folded and dead branches will be pruned (see qme::apply_bounds), such expressions will not be compiled via the compile cache.
+	static exp_type<T> compile(const std::string& statement, const variable_bounds<T>& bounds)
+		{symbol_table symbols; return compile(statement, symbols, bounds);}
+	static exp_type<T> compile(const std::string& statement, symbol_table& symbols, const variable_bounds<T>& bounds)
+	{
+		auto expression = statement;
+		remove_blanks(expression);
+		return compile_normalized(expression, symbols, bounds);
+	}
+
+	//partial evaluation, variables in bindings (variable name to value) are replaced by their values, and then the expression is
+	// optimized again with this optimization level (judgments which become constant are folded and dead branches are pruned),
+	// the residual expression is returned (exp will not be changed), variables left will be bound to slots in symbols.
+	static exp_type<T> specialize(exp_ctype<T>& exp, const std::map<std::string, T>& bindings)
+		{symbol_table symbols; return specialize(exp, bindings, symbols);}
+	static exp_type<T> specialize(exp_ctype<T>& exp, const std::map<std::string, T>& bindings, symbol_table& symbols)
+	{
+		return build([&]() {
+			auto re = substitute(exp, bindings);
+			apply_bounds(re, variable_bounds<T>());
+			return re;
+		}, symbols);
+	}
+
+	struct cache_stats {size_t capacity, size, hits, misses, evictions;};
+	//the compile cache is disabled by default (capacity 0), once enabled, at most capacity expressions will be cached (least recently
+	// used ones will be evicted), keyed by the statement without blanks, expressions compiled with other T or O are cached separately.
+	//the compile cache is thread safe, and cached expressions are shared by all callers, they're immutable and can be executed
+	// concurrently, a cached expression will only be returned if its slots match the given symbol table. slots of cached
+	// expressions are frozen, so bind_symbols refuses to bind them to other slots.
+	static void enable_cache(size_t capacity) {get_cache().set_capacity(capacity);}
+	static void clear_cache() {get_cache().clear();}
+	static cache_stats get_cache_stats() {return get_cache().get_stats();}
+
+private:
+	class cache
+	{
+	public:
+		cache() : capacity(0), hits(0), misses(0), evictions(0) {}
+
+		exp_type<T> find(const std::string& expression, symbol_table& symbols)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (0 == capacity)
+				return exp_type<T>();
+
+			auto iter = exps.find(expression);
+			if (exps.end() == iter || !is_compatible(iter->second->bindings, symbols))
+			{
+				++misses;
+				return exp_type<T>();
+			}
+
+			++hits;
+			lru.splice(std::begin(lru), lru, iter->second);
+			for (auto& item : iter->second->bindings)
+				symbols.insert(item.second);
+			return iter->second->exp;
+		}
+
+		void insert(const std::string& expression, exp_ctype<T>& exp)
+		{
+			std::map<size_t, std::string> bindings; //slot to variable name
+			std::vector<qme::exp<T>*> variables;
+			for_each_variable(exp, [&](qme::exp<T>& e) {bindings[e.get_slot()] = e.get_variable_name(); variables.push_back(&e);});
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (0 == capacity)
+				return;
+
+			for (auto e : variables) //it will be shared
+				e->freeze();
+
+			auto iter = exps.find(expression);
+			if (exps.end() != iter) //compiled again since slots mismatched, keep the newer one
+			{
+				lru.erase(iter->second);
+				exps.erase(iter);
+			}
+
+			lru.push_front(entry {expression, exp, bindings});
+			exps[expression] = std::begin(lru);
+			trim();
+		}
+
+		void set_capacity(size_t _capacity) {std::lock_guard<std::mutex> lock(mutex); capacity = _capacity; trim();}
+		void clear() {std::lock_guard<std::mutex> lock(mutex); lru.clear(); exps.clear();}
+		cache_stats get_stats() {std::lock_guard<std::mutex> lock(mutex); return cache_stats {capacity, exps.size(), hits, misses, evictions};}
+
+	private:
+		//variables which are not in the symbol table yet must get the same slots after appended to it.
+		static bool is_compatible(const std::map<size_t, std::string>& bindings, const symbol_table& symbols)
+		{
+			auto next_slot = symbols.size();
+			for (auto& item : bindings)
+			{
+				auto slot = symbols.find(item.second);
+				if (symbol_table::npos == slot ? item.first != next_slot++ : item.first != slot)
+					return false;
+			}
+
+			return true;
+		}
+
+		void trim()
+		{
+			for (; exps.size() > capacity; ++evictions)
+			{
+				exps.erase(lru.back().expression);
+				lru.pop_back();
+			}
+		}
 
-template <typename T = float, typename O = O3> class compiler
-{
-private:
-	struct sub_exp
-	{
-		std::string name, raw_exp;
-		std::vector<std::string> items;
-		exp_type<T> parsed_exp;
+	private:
+		struct entry
+		{
+			std::string expression;
+			exp_type<T> exp;
+			std::map<size_t, std::string> bindings; //slot to variable name
+		};
+
+		std::mutex mutex;
+		std::list<entry> lru; //most recently used first
+		std::map<std::string, typename std::list<entry>::iterator> exps;
+		size_t capacity, hits, misses, evictions;
 	};
 
-public:
-	static exp_type<T> to_judge_exp(exp_ctype<T>& exp) {return exp->is_data() ? std::make_shared<transparent_judge_exp<T>>(exp) : exp;}
-	static exp_type<T> compile(const char* statement) {return compile(std::string(statement));}
-	static exp_type<T> compile(const std::string& statement)
+	static cache& get_cache() {static cache c; return c;}
+
+	//copy the expression bottom up with an explicit stack instead of recursion, sub expressions are made just like parsing them
+	// again (so optimizations of this level happen again), and variables in bindings are replaced by their values.
+	static exp_type<T> substitute(exp_ctype<T>& exp, const std::map<std::string, T>& bindings)
 	{
-		try
+		std::vector<std::pair<const exp_type<T>*, bool>> exps(1, std::make_pair(&exp, false)); //the second means expanded
+		std::vector<exp_type<T>> res;
+		while (!exps.empty())
 		{
-			auto expression = statement;
-			pre_parse_1(expression);
-#ifdef DEBUG
-			auto old_exp = expression;
-#endif
-			std::map<std::string, sub_exp> sub_exps;
-			size_t index = 0;
-			try
+			auto& e = *exps.back().first;
+			if (!e->is_leaf() && !exps.back().second)
 			{
-				auto end_index = expression.size();
-				auto num = 0;
-				pre_parse_2(expression, sub_exps, index, end_index, num, 0);
-
-				auto base_level = 0;
-				for (auto first = true; first || pre_parse_3(expression, sub_exps, index, end_index, num, 0, base_level);
-					first = false, base_level += 100, index = 0, end_index = expression.size(), num = 0);
-
-				auto tmp_exps = sub_exps;
-				for (auto& s_exp : tmp_exps)
-				{
-					base_level -= 100;
-					for (auto first = true; first || pre_parse_3(s_exp.second.raw_exp, sub_exps, index, end_index, num, 0, base_level);
-						first = false, base_level += 100, index = 0, end_index = s_exp.second.raw_exp.size(), num = 0)
-						if (!first)
-							sub_exps[s_exp.first].raw_exp = s_exp.second.raw_exp;
-				}
+				exps.back().second = true;
+				const exp_type<T>* items[] = {&e->get_right_item(), &e->get_left_item(), &e->get_road_map()};
+				for (auto item : items)
+					if (*item)
+						exps.emplace_back(item, false);
+				continue;
 			}
-			catch (const std::exception& e) {on_error(expression, index); throw(e);}
-			catch (const std::string& e) {on_error(expression, index); throw(e);}
-			catch (const char* e) {on_error(expression, index); throw(e);}
 
-			if (!sub_exps.empty())
+			exps.pop_back();
+			if (e->is_leaf())
 			{
-#ifdef DEBUG
-				printf(" get %s from %s, where:\n", expression.data(), old_exp.data());
-				for (auto& item : sub_exps)
-				{
-					printf("  %s = %s\n", item.first.data(), item.second.raw_exp.data());
-					item.second.items = split(item.second.raw_exp);
-				}
-#else
-				for (auto& item : sub_exps)
-					item.second.items = split(item.second.raw_exp);
-#endif
-				auto parsed_num = 0;
-				do
-				{
-					parsed_num = 0;
-					for (auto& item : sub_exps)
-						if (!item.second.parsed_exp && (item.second.parsed_exp = compile(item.second.items, sub_exps)))
-							++parsed_num;
-				} while (parsed_num > 0);
+				auto iter = e->is_variable() ? bindings.find(e->get_variable_name()) : std::end(bindings);
+				res.push_back(std::end(bindings) == iter ? e->clone() :
+					make_exp<immediate_data_exp<T>>(e->data([&](const std::string&) {return iter->second;})));
+				continue;
 			}
 
-			auto re = compile(split(expression), sub_exps);
-			if (!re)
-				throw("incomplete expression!");
-			else if (O::level() > 1)
+			auto i = res.size() - (e->is_selector() ? 3 : e->get_right_item() ? 2 : 1);
+			exp_type<T> re;
+			if (e->is_selector())
+				re = make_exp<question_exp<T>>(res[i], res[i + 1], res[i + 2]);
+			else if (e->is_data() && e->is_reverser())
+				re = to_negative(res[i]);
+			else if (e->is_reverser())
+				re = bang(res[i]);
+			else if (e->need_to_bool())
+				re = to_judge_exp(res[i]);
+			else if (e->is_data())
+				re = qme::merge_data_exp<T, O>(res[i], res[i + 1], e->get_operator());
+			else if (e->is_composite())
+				re = make_logical_exp(res[i], res[i + 1], e->get_operator());
+			else
+				re = make_binary_judge_exp(res[i], res[i + 1], e->get_operator());
+			res.resize(i);
+			res.push_back(re);
+		}
+
+		return res.front();
+	}
+
+	//blanks have been removed
+	static exp_type<T> compile_normalized(const std::string& statement, symbol_table& symbols, const variable_bounds<T>& bounds = variable_bounds<T>())
+	{
+		return build([&]() {
+			auto re = parse(statement);
+			if (!bounds.empty())
+				apply_bounds(re, bounds);
+			return re;
+		}, symbols);
+	}
+
+	//make an expression (parse a statement for example) and do the final optimization, then bind variables to symbols.
+	static exp_type<T> build(const std::function<exp_type<T>()>& make, symbol_table& symbols)
+	{
+		arena::scope s(std::make_shared<arena>()); //all nodes will be allocated from this arena
+		try
+		{
+			auto re = make();
+			if (O::level() > 1)
 			{
-				auto final_re = re->final_optimize();
-				if (final_re)
-					re = final_re;
+				final_optimize(re);
+				std::map<std::string, exp_type<T>> exps;
+				re = share_common_exps(re, exps);
 #ifdef DEBUG
 				printf(" max depth: %d\n immediate values:", re->get_depth());
 				re->show_immediate_value();
@@ -1422,6 +3617,7 @@ public:
 #endif
 			}
 
+			bind_symbols(re, symbols);
 			return re;
 		}
 		catch (const std::exception& e) {printf("\033[31m%s\033[0m\n", e.what());}
@@ -1433,180 +3629,66 @@ public:
 	}
 
 private:
-	static void pre_parse_1(std::string& expression)
+	static void remove_blanks(std::string& expression)
 	{
 #ifdef DEBUG
-		printf(" pre-parsing phase 1 from [%s] ", expression.data());
+		printf(" removing blanks from [%s] ", expression.data());
 #endif
-		char blanks[] = {' ', '\t', '\n', '\r'};
-		for (const auto& c : blanks)
-			for (auto pos = std::string::npos; std::string::npos != (pos = expression.rfind(c, pos));)
-				expression.erase(pos, 1);
-
+		expression.erase(std::remove_if(std::begin(expression), std::end(expression),
+			[](char c) {return ' ' == c || '\t' == c || '\n' == c || '\r' == c;}), std::end(expression));
 #ifdef DEBUG
 		printf("to [%s]\n", expression.data());
 #endif
 	}
 
-	static void pre_parse_2(std::string& expression, std::map<std::string, sub_exp>& sub_exps,
-		size_t& index, size_t& end_index, int& p_num, int level)
+	//a view of the statement, tokens are never copied during the parsing.
+	struct token
 	{
-		if (level >= 100)
-			throw("parentheses layer cannot exceed 99!");
-
-		auto p_start = std::string::npos;
-		while (index < end_index)
-		{
-			const auto c = expression[index];
-			if ('(' == c)
-			{
-				if (std::string::npos == p_start)
-				{
-					p_start = index;
-					++p_num;
-				}
-				else
-					pre_parse_2(expression, sub_exps, index, end_index, p_num, level + 1);
-			}
-			else if (')' == c)
-			{
-				if (std::string::npos == p_start)
-				{
-					--index;
-					return;
-				}
-				else if (index <= p_start + 1)
-					throw("empty parentheses!");
-
-				char buf[32];
-				std::string name(buf, snprintf(buf, sizeof(buf), "$%d_%d", level, p_num));
-				std::string raw_exp = std::string(std::next(expression.data(), p_start + 1), index - p_start - 1);
-				sub_exps[name] = sub_exp {name, raw_exp};
-
-				auto old_size = expression.size();
-#ifdef DEBUG
-				printf(" pre-parsing phase 2 from [%s] ", expression.data());
-				expression.replace(p_start, raw_exp.size() + 2, name);
-				printf("to [%s]\n", expression.data());
-#else
-				expression.replace(p_start, raw_exp.size() + 2, name);
-#endif
-				auto size_change = old_size - expression.size();
-				index -= size_change;
-				end_index -= size_change;
-
-				p_start = std::string::npos;
-			}
+		const char* data;
+		size_t size;
 
-			++index;
-		}
+		bool is(char c) const {return 1 == size && c == *data;}
+		bool is(const char* s) const {return 2 == size && 0 == strncmp(data, s, 2);}
+		std::string to_string() const {return std::string(data, size);}
+	};
 
-		--index;
-		if (std::string::npos != p_start)
-			throw("parentheses not match!");
+	static token next_token(const char* input)
+	{
+		if (is_key_2(input))
+			return token {input, 2};
+		else if (is_key_1(input))
+			return token {input, 1};
+
+		auto end = input;
+		while ('\0' != *++end && !is_key_2(end) && !is_key_1(end));
+		return token {input, (size_t) (end - input)};
 	}
 
-	static bool pre_parse_3(std::string& expression, std::map<std::string, sub_exp>& sub_exps,
-		size_t& index, size_t& end_index, int& q_num, int level, int base_level)
+	//parentheses and both branches of question exps open new scopes, the false branch ends together with the question exp.
+	enum class scope_type {statement, parentheses, true_branch, false_branch};
+	struct parse_scope
 	{
-		if (level >= 100)
-			throw("question layer cannot exceed 99!");
-
-		auto changed = false;
-		size_t q_pos = 0, c_pos = 0, start = index;
-		while (index < end_index)
-		{
-			const auto c = expression[index];
-			if ('?' == c)
-			{
-				if (0 == q_pos)
-				{
-					if (0 == index)
-						throw("missing judgment!");
-					else if (0 != c_pos)
-						throw(": cannot appears before ?");
+		parse_scope(scope_type _type, const char* _start = nullptr) : type(_type), start(_start), empty(true), last_operator('\0'), negative(-1), revert(0) {}
 
-					q_pos = index;
-					++q_num;
-				}
-				else
-				{
-					index = 1 + (c_pos > 0 ? c_pos : q_pos);
-					if (pre_parse_3(expression, sub_exps, index, end_index, q_num, level + 1, base_level))
-						changed = true;
-				}
-			}
-			else if (':' == c || index + 1 == end_index)
-			{
-				auto is_c = ':' == c;
-				if (!is_c)
-					++index;
-
-				if (0 == c_pos)
-				{
-					if (0 == index)
-						throw("missing judgment!");
-
-					c_pos = index;
-				}
-				else if (level > 0)
-				{
-					char buf[32];
-					std::string name(buf, snprintf(buf, sizeof(buf), "$%d_%d", level + base_level, q_num));
-					std::string raw_exp = std::string(std::next(expression.data(), start), index - start);
-					sub_exps[name] = sub_exp {name, raw_exp};
-
-					auto old_size = expression.size();
-#ifdef DEBUG
-					printf(" pre-parsing phase 3 from [%s] ", expression.data());
-					expression.replace(start, index - start, name);
-					printf("to [%s]\n", expression.data());
-#else
-					expression.replace(start, index - start, name);
-#endif
-					auto size_change = old_size - expression.size();
-					index -= size_change;
-					end_index -= size_change;
-					--index;
-
-					return true;
-				}
-			}
-
-			++index;
-		}
+		scope_type type;
+		const char* start; //the ? operator for true branches, nullptr for others
+		bool empty; //no tokens yet
 
-		return changed;
-	}
-
-	static std::vector<std::string> split(const std::string& expression)
-	{
-		std::vector<std::string> items;
+		char last_operator; //+-!
+		int negative; //number of -, 0 means at least one +
+		int revert; //number of !
 
-		auto input = expression.data();
-		auto start = input;
-		for (; '\0' != *input; ++input)
-			if (is_key_2(input))
-			{
-				if (start < input)
-					items.emplace_back(start, input - start);
+		exp_type<T> data_1, data_2; //treat as data (which means they can be judgments)
+		std::string op_1, op_2;
 
-				items.emplace_back(input++, 2);
-				start = input + 1;
-			}
-			else if (is_key_1(input))
-			{
-				if (start < input)
-					items.emplace_back(start, input - start);
+		exp_type<T> dc; //merged comparand (from data_1 and data_2 with op_1)
+		std::string c; //comparer
 
-				items.emplace_back(input, 1);
-				start = input + 1;
-			}
-		if (start < input)
-			items.emplace_back(start, input - start);
+		exp_type<T> judge_1, judge_2; //treat as judge (which means they can be data)
+		std::string lop_1, lop_2;
 
-		return items;
-	}
+		exp_type<T> fj, fd_1; //for question exp, treat as judge and data respectively, the false branch is the next scope
+	};
 
 	static void finish_data_exp(exp_type<T>& data_1, exp_type<T>&& data_2, std::string& op_1, const std::string& op_2 = std::string())
 	{
@@ -1733,52 +3815,47 @@ private:
 	static exp_type<T> bang(exp_ctype<T>& exp)
 	{
 		if (O::level() < 2 && exp->is_composite() && (exp->get_left_item()->is_composite() || exp->get_right_item()->is_composite()))
-			return std::make_shared<not_judge_exp<T>>(exp);
+			return make_exp<not_judge_exp<T>>(exp);
 		return exp->bang();
 	}
 
 	static exp_type<T> to_negative(exp_ctype<T>& exp)
 	{
 		if (O::level() < 2 && exp->is_composite() && (exp->get_left_item()->is_composite() || exp->get_right_item()->is_composite()))
-			return std::make_shared<negative_data_exp<T>>(exp);
+			return make_exp<negative_data_exp<T>>(exp);
 		return exp->to_negative();
 	}
 
-	static exp_type<T> compile(const std::vector<std::string>& items, const std::map<std::string, sub_exp>& sub_exps)
+	static data_exp_type<T> parse_data(const token& vov)
 	{
-		size_t index = 0, end_index = items.size();
-		try {return compile(items, sub_exps, index, end_index);}
-		catch (const std::exception& e) {on_error(items, index); throw(e);}
-		catch (const std::string& e) {on_error(items, index); throw(e);}
-		catch (const char* e) {on_error(items, index); throw(e);}
-	}
-
-	static data_exp_type<T> parse_data(const std::string& vov)
-	{
-		if (is_key_2(vov) || is_key_1(vov))
-			throw("unexpected " + vov);
-		else if (0 == isdigit(vov[0])) //variable
+		if (is_key_2(vov.data) || is_key_1(vov.data))
+			throw("unexpected " + vov.to_string());
+		else if ('$' == vov.data[0]) //reserved
+			throw("undefined symbol " + vov.to_string());
+		else if (0 == isdigit(vov.data[0])) //variable
 		{
 			if (O::level() < 2)
-				return std::make_shared<variable_data_exp<T>>(vov);
-			return std::make_shared<composite_variable_data_exp<T, O>>(vov);
+				return make_exp<variable_data_exp<T>>(vov.to_string());
+			return make_exp<composite_variable_data_exp<T, O>>(vov.to_string());
 		}
 
+		//the token is not null terminated (it's a view of the statement), so the number must end exactly at the end of the token.
 		T value;
 		char* endptr;
+		auto end = vov.data + vov.size;
 		errno = 0;
 		if (std::is_same<T, float>::value || std::is_same<T, double>::value)
-			value = (T) strtod(vov.data(), &endptr); //(T) atof(vov.data())
+			value = (T) strtod(vov.data, &endptr);
 		else
 		{
-			value = (T) strtoll(vov.data(), &endptr, 0); //(T) atoll(vov.data())
-			if (0 == errno && '\0' != *endptr)
-				value = (T) strtod(vov.data(), &endptr); //(T) atof(vov.data())
+			value = (T) strtoll(vov.data, &endptr, 0);
+			if (0 == errno && end != endptr)
+				value = (T) strtod(vov.data, &endptr);
 		}
-		if (0 != errno || '\0' != *endptr)
-			throw("invalid immediate data " + vov);
+		if (0 != errno || end != endptr)
+			throw("invalid immediate data " + vov.to_string());
 
-		return std::make_shared<immediate_data_exp<T>>(value);
+		return make_exp<immediate_data_exp<T>>(value);
 	}
 
 	static void merge_unary_operator(char& last_operator, int& negative, int& revert, char op)
@@ -1799,266 +3876,405 @@ private:
 		last_operator = op;
 	}
 
-	static exp_type<T> compile(const std::vector<std::string>& items, const std::map<std::string, sub_exp>& sub_exps,
-		size_t& index, size_t end_index)
+	static void check_unary_operator(const parse_scope& s)
 	{
-		if (index >= end_index)
-			throw("empty expresson!");
-
-		auto last_operator = '\0'; //+-!
-		auto negative = -1; //number of -, 0 means at least one +
-		auto revert = 0; //number of !
-
-		exp_type<T> data_1, data_2; //treat as data (which means they can be judgments)
-		std::string op_1, op_2;
-
-		exp_type<T> dc; //merged comparand (from data_1 and data_2 with op_1)
-		std::string c; //comparer
-
-		exp_type<T> judge_1, judge_2; //treat as judge (which means they can be data)
-		std::string lop_1, lop_2;
-
-		exp_type<T> fj; //for final question exp, treat as judge (which means they can be data)
-		exp_type<T> fd_1, fd_2; //for final question exp, treat as data (which means they can be judgments)
+		if (s.negative >= 0)
+			throw("unexpected +/- operator!");
+		else if (s.revert > 0)
+			throw("unexpected ! operator!");
+	}
 
-		while (index < end_index)
+	//tokens are parsed in one pass without any recursion, parentheses and question exps push new scopes, which are merged into
+	// their outer scopes as operands once they're closed, so the time complexity is linear.
+	static exp_type<T> parse(const std::string& expression)
+	{
+		std::vector<parse_scope> scopes(1, parse_scope(scope_type::statement));
+		size_t parentheses = 0; //layers, any depth is acceptable
+		auto input = expression.data();
+		try
 		{
-			const auto& item = items[index];
-			if ("!" == item)
-			{
-				merge_unary_operator(last_operator, negative, revert, '!');
-				++index;
-				continue;
-			}
-			else if (is_operator(item))
+			for (token item; '\0' != *input; input += item.size)
 			{
-				exp_type<T> data;
-				if (judge_2)
+				item = next_token(input);
+				auto& s = scopes.back();
+				if (item.is('('))
 				{
-					if (lop_2.empty())
-					{
-						data = judge_2;
-						judge_2.reset();
-					}
+					++parentheses;
+					s.empty = false;
+					scopes.push_back(parse_scope(scope_type::parentheses));
 				}
-				else if (judge_1 && lop_1.empty())
+				else if (item.is(')'))
 				{
-					data = judge_1;
-					judge_1.reset();
+					if (0 == parentheses)
+						throw("unexpected )");
+					else if (scope_type::parentheses == s.type && s.empty)
+						throw("empty parentheses!");
+
+					check_question_operator(scopes, input);
+					auto re = close_scope(scopes);
+					if (scope_type::true_branch == re.second)
+						throw("incomplete question exp!");
+
+					--parentheses;
+					merge_operand(scopes.back(), std::move(re.first));
 				}
-
-				if (data)
+				else if (item.is('?'))
 				{
-					assert(!data_1 && !data_2);
-					data_1.swap(data);
+					if (s.empty)
+						throw(scope_type::false_branch == s.type ? "redundant ? operator!" : "missing judgment!");
+
+					s.empty = false;
+					finish_data_and_merge_judge_exp(s.dc, s.c, s.data_1, s.data_2, s.op_1, s.op_2, s.judge_1, s.judge_2, s.lop_1, s.lop_2);
+					finish_judge_exp(s.judge_1, std::move(s.judge_2), s.lop_1, s.lop_2);
+					s.fj.swap(s.judge_1);
+					check_unary_operator(s);
+					scopes.push_back(parse_scope(scope_type::true_branch, input));
 				}
-
-				auto check = false;
-				if (data_2)
+				else if (item.is(':'))
 				{
-					if (!op_2.empty())
-						check = true;
-					else if (is_operator_1(item))
+					auto i = scopes.size() - 1;
+					while (scope_type::false_branch == scopes[i].type)
+						--i;
+					if (scope_type::true_branch != scopes[i].type)
 					{
-						finish_data_exp(data_1, std::move(data_2), op_1);
-						op_1 = item;
+						if (i + 1 < scopes.size())
+							throw("redundant : operator!");
+						else if (s.empty)
+							throw("missing judgment!");
+
+						//a ? operator follows within the same parentheses, like 'a : b ? c : 0'
+						size_t layers = 0;
+						for (auto next = input + 1; '\0' != *next; ++next)
+							if ('(' == *next)
+								++layers;
+							else if (')' == *next && 0 == layers--)
+								break;
+							else if ('?' == *next && 0 == layers)
+							{
+								input = next;
+								throw(": cannot appears before ?");
+							}
+						throw("missing ? operator!");
 					}
-					else
-						op_2 = item;
-				}
-				else if (data_1)
-				{
-					if (!op_1.empty())
-						check = true;
-					else
-						op_1 = item;
+
+					auto re = close_scope(scopes);
+					assert(scope_type::true_branch == re.second);
+					scopes.back().fd_1 = std::move(re.first);
+					scopes.push_back(parse_scope(scope_type::false_branch));
 				}
-				else if (is_operator_2(item))
-					throw("missing operand!");
 				else
-					check = true;
-
-				if (check)
 				{
-					if (!is_operator_1(item))
-						throw("redundant operand!");
-
-					merge_unary_operator(last_operator, negative, revert, item[0]);
-					++index;
-					continue;
+					s.empty = false;
+					parse_token(s, item);
 				}
 			}
-			else if (is_comparer(item))
-			{
-				if (!c.empty() || dc)
-					throw("redundant comparer!");
-				else if (!data_1)
-				{
-					assert(!data_2 && op_1.empty() && op_2.empty());
-					if (judge_2)
-					{
-						assert(judge_1 && !lop_1.empty());
-						if (!lop_2.empty())
-							throw("missing operand!");
 
-						data_1 = judge_2;
-						judge_2.reset();
-					}
-					else if (judge_1)
-					{
-						assert(lop_2.empty());
-						if (!lop_1.empty())
-							throw("missing operand!");
+			if (parentheses > 0)
+				throw("parentheses not match!");
+			else if (1 == scopes.size() && scopes.back().empty)
+				throw("empty expresson!");
 
-						data_1 = judge_1;
-						judge_1.reset();
-					}
-				}
+			check_question_operator(scopes, input);
+			auto re = close_scope(scopes);
+			if (scope_type::true_branch == re.second)
+				throw("incomplete question exp!");
 
-				finish_data_exp(data_1, std::move(data_2), op_1, op_2);
-				dc = std::move(data_1);
-				c = item;
-			}
-			else if (is_logical_operator(item))
+			assert(scopes.empty());
+			return re.first;
+		}
+		catch (const std::exception& e) {on_error(expression, (size_t) (input - expression.data())); throw(e);}
+		catch (const std::string& e) {on_error(expression, (size_t) (input - expression.data())); throw(e);}
+		catch (const char* e) {on_error(expression, (size_t) (input - expression.data())); throw(e);}
+	}
+
+	//before closing parentheses or the statement, a question exp which is still in its true branch must be the outermost one,
+	// otherwise its ? operator can never be matched, like 'a ? b ? c' and 'a ? b : c ? d'.
+	static void check_question_operator(const std::vector<parse_scope>& scopes, const char*& input)
+	{
+		for (auto i = scopes.size() - 1; scope_type::true_branch == scopes[i].type || scope_type::false_branch == scopes[i].type; --i)
+			if (scope_type::true_branch == scopes[i].type)
 			{
-				finish_data_and_merge_judge_exp(dc, c, data_1, data_2, op_1, op_2, judge_1, judge_2, lop_1, lop_2);
-				if (judge_2)
+				auto owner = scopes[i - 1].type;
+				if (scope_type::true_branch == owner || scope_type::false_branch == owner)
 				{
-					if (!lop_2.empty())
-						throw("redundant logical operator!");
-					else if ("||" == item)
-					{
-						finish_judge_exp(judge_1, std::move(judge_2), lop_1, lop_2);
-						lop_1 = item;
-					}
-					else
-						lop_2 = item;
+					input = scopes[i].start;
+					throw("redundant ? operator!");
 				}
-				else if (judge_1)
+				break;
+			}
+	}
+
+	//close the innermost scope, question exps whose false branches are closed will be closed too,
+	// return the expression and the type of the last closed scope.
+	static std::pair<exp_type<T>, scope_type> close_scope(std::vector<parse_scope>& scopes)
+	{
+		auto& s = scopes.back();
+		auto re = finish_scope(s);
+		auto type = s.type;
+		if (scope_type::true_branch == type)
+			check_unary_operator(s);
+
+		for (scopes.pop_back(); scope_type::false_branch == type; scopes.pop_back())
+		{
+			auto& owner = scopes.back();
+			re = make_exp<question_exp<T>>(owner.fj, owner.fd_1, re);
+			type = owner.type;
+		}
+
+		return std::make_pair(re, type);
+	}
+
+	static exp_type<T> finish_scope(parse_scope& s)
+	{
+		assert(!s.fj && !s.fd_1);
+		finish_data_and_judge_exp(s.dc, s.c, false, s.data_1, s.data_2, s.op_1, s.op_2, s.judge_1, s.judge_2, s.lop_1, s.lop_2);
+
+		assert(s.c.empty() && s.op_1.empty() && s.op_2.empty() && s.lop_1.empty() && s.lop_2.empty());
+		assert(!s.dc && !s.data_2 && !s.judge_2);
+		if (s.data_1)
+		{
+			assert(!s.judge_1);
+			return s.data_1;
+		}
+		else if (s.judge_1)
+			return s.judge_1;
+		else
+			throw("incomplete exp!");
+	}
+
+	//apply pending unary operators and merge an operand (data, variable or closed scope) into the scope.
+	static void merge_operand(parse_scope& s, exp_type<T>&& parsed_exp)
+	{
+		if (s.judge_2 ? s.lop_2.empty() : s.judge_1 && s.lop_1.empty()) //closed scopes can follow a judgment directly, like '(a > b)(c)'
+			throw("missing operator!");
+
+		auto is_judge = parsed_exp->is_judge();
+		if (s.revert > 0)
+		{
+			is_judge = true;
+			parsed_exp = 1 == (s.revert & 1) ? bang(parsed_exp) : to_judge_exp(parsed_exp);
+		}
+		if (s.negative >= 0)
+		{
+			is_judge = false;
+			if (1 == (s.negative & 1))
+				parsed_exp = to_negative(parsed_exp);
+		}
+		s.last_operator = '\0';
+		s.negative = -1;
+		s.revert = 0;
+
+		if (!s.dc && !s.data_1 && is_judge)
+			merge_judge_exp(s.judge_1, s.judge_2, s.lop_1, s.lop_2, std::move(parsed_exp));
+		else
+			merge_data_exp(s.data_1, s.data_2, s.op_1, s.op_2, std::move(parsed_exp));
+	}
+
+	//parse operators and operands (all tokens except parentheses, ? and :).
+	static void parse_token(parse_scope& s, const token& item)
+	{
+		if (item.is('!'))
+		{
+			merge_unary_operator(s.last_operator, s.negative, s.revert, '!');
+			return;
+		}
+		else if (is_operator(item.data))
+		{
+			exp_type<T> data;
+			if (s.judge_2)
+			{
+				if (s.lop_2.empty())
 				{
-					if (!lop_1.empty())
-						throw("redundant logical operator!");
-					else
-						lop_1 = item;
+					data = s.judge_2;
+					s.judge_2.reset();
 				}
-				else
-					throw("missing logical operand!");
 			}
-			else if ("?" == item)
+			else if (s.judge_1 && s.lop_1.empty())
 			{
-				if (fj)
-					throw("redundant ? operator!");
-
-				finish_data_and_merge_judge_exp(dc, c, data_1, data_2, op_1, op_2, judge_1, judge_2, lop_1, lop_2);
-				finish_judge_exp(judge_1, std::move(judge_2), lop_1, lop_2);
-				fj.swap(judge_1);
+				data = s.judge_1;
+				s.judge_1.reset();
 			}
-			else if (":" == item)
-			{
-				if (!fj)
-					throw("missing ? operator!");
-				else if (fd_1)
-					throw("redundant : operator!");
 
-				finish_data_and_judge_exp(dc, c, true, data_1, data_2, op_1, op_2, judge_1, judge_2, lop_1, lop_2);
-				fd_1.swap(data_1);
+			if (data)
+			{
+				assert(!s.data_1 && !s.data_2);
+				s.data_1.swap(data);
 			}
-			else
+
+			auto check = false;
+			if (s.data_2)
 			{
-				exp_type<T> parsed_exp;
-				if ('$' == item[0])
+				if (!s.op_2.empty())
+					check = true;
+				else if (is_operator_1(item.data))
 				{
-					auto iter = sub_exps.find(item);
-					if (iter == std::end(sub_exps))
-						throw("undefined symbol " + item);
-					else if (!(parsed_exp = iter->second.parsed_exp)) //dependancy not ready
-						return parsed_exp;
+					finish_data_exp(s.data_1, std::move(s.data_2), s.op_1);
+					s.op_1.assign(item.data, item.size);
 				}
 				else
-					parsed_exp = parse_data(item);
-
-				auto is_judge = parsed_exp->is_judge();
-				if (revert > 0)
-				{
-					is_judge = true;
-					parsed_exp = 1 == (revert & 1) ? bang(parsed_exp) : to_judge_exp(parsed_exp);
-				}
-				if (negative >= 0)
-				{
-					is_judge = false;
-					if (1 == (negative & 1))
-						parsed_exp = to_negative(parsed_exp);
-				}
-				last_operator = '\0';
-				negative = -1;
-				revert = 0;
-
-				if (!dc && !data_1 && is_judge)
-					merge_judge_exp(judge_1, judge_2, lop_1, lop_2, std::move(parsed_exp));
+					s.op_2.assign(item.data, item.size);
+			}
+			else if (s.data_1)
+			{
+				if (!s.op_1.empty())
+					check = true;
 				else
-					merge_data_exp(data_1, data_2, op_1, op_2, std::move(parsed_exp));
+					s.op_1.assign(item.data, item.size);
 			}
+			else if (is_operator_2(item.data))
+				throw("missing operand!");
+			else
+				check = true;
 
-			if (negative >= 0)
-				throw("unexpected +/- operator!");
-			else if (revert > 0)
-				throw("unexpected ! operator!");
+			if (check)
+			{
+				if (!is_operator_1(item.data))
+					throw("redundant operand!");
 
-			++index;
+				merge_unary_operator(s.last_operator, s.negative, s.revert, *item.data);
+				return;
+			}
 		}
-
-		auto to_data = fj && fd_1;
-		finish_data_and_judge_exp(dc, c, to_data, data_1, data_2, op_1, op_2, judge_1, judge_2, lop_1, lop_2);
-		if (to_data)
+		else if (is_comparer(item.data))
 		{
-			assert(!fd_2);
-			fd_2.swap(data_1);
-		}
+			if (!s.c.empty() || s.dc)
+				throw("redundant comparer!");
+			else if (!s.data_1)
+			{
+				assert(!s.data_2 && s.op_1.empty() && s.op_2.empty());
+				if (s.judge_2)
+				{
+					assert(s.judge_1 && !s.lop_1.empty());
+					if (!s.lop_2.empty())
+						throw("missing operand!");
 
-		assert(c.empty() && op_1.empty() && op_2.empty() && lop_1.empty() && lop_2.empty());
-		assert(!dc && !data_2 && !judge_2);
-		if (fj)
-		{
-			if (!fd_1 || !fd_2)
-				throw("incomplete question exp!");
+					s.data_1 = s.judge_2;
+					s.judge_2.reset();
+				}
+				else if (s.judge_1)
+				{
+					assert(s.lop_2.empty());
+					if (!s.lop_1.empty())
+						throw("missing operand!");
 
-			assert(!data_1 && !judge_1);
-			return std::make_shared<question_exp<T>>(fj, fd_1, fd_2);
+					s.data_1 = s.judge_1;
+					s.judge_1.reset();
+				}
+			}
+
+			finish_data_exp(s.data_1, std::move(s.data_2), s.op_1, s.op_2);
+			s.dc = std::move(s.data_1);
+			s.c.assign(item.data, item.size);
 		}
-		else if (data_1)
+		else if (is_logical_operator(item.data))
 		{
-			assert(!judge_1);
-			return data_1;
+			finish_data_and_merge_judge_exp(s.dc, s.c, s.data_1, s.data_2, s.op_1, s.op_2, s.judge_1, s.judge_2, s.lop_1, s.lop_2);
+			if (s.judge_2)
+			{
+				if (!s.lop_2.empty())
+					throw("redundant logical operator!");
+				else if (item.is("||"))
+				{
+					finish_judge_exp(s.judge_1, std::move(s.judge_2), s.lop_1, s.lop_2);
+					s.lop_1.assign(item.data, item.size);
+				}
+				else
+					s.lop_2.assign(item.data, item.size);
+			}
+			else if (s.judge_1)
+			{
+				if (!s.lop_1.empty())
+					throw("redundant logical operator!");
+				else
+					s.lop_1.assign(item.data, item.size);
+			}
+			else
+				throw("missing logical operand!");
 		}
-		else if (judge_1)
-			return judge_1;
 		else
-			throw("incomplete exp!");
+			merge_operand(s, parse_data(item));
+
+		check_unary_operator(s);
 	}
 
+	//highlight the token at index (the end of the statement for missing tokens) and its neighbours.
 	static void on_error(const std::string& expression, size_t index)
 	{
 		puts("failed to parse the statement:");
-		for (size_t i = 0; i < expression.size(); ++i)
-			if (i + 1 == index || i == index || i == index + 1)
-				printf("\033[31m%c\033[0m", expression[i]);
-			else
-				printf("%c", expression[i]);
+		std::vector<token> items;
+		for (auto input = expression.data(); '\0' != *input; input += items.back().size)
+			items.push_back(next_token(input));
+
+		size_t n = 0;
+		while (n < items.size() && (size_t) (items[n].data - expression.data()) + items[n].size <= index)
+			++n;
+		for (size_t i = 0; i < items.size(); ++i)
+			printf(i + 1 == n || i == n || i == n + 1 ? "\033[31m%.*s\033[0m" : "%.*s", (int) items[i].size, items[i].data);
 
 		putchar('\n');
 	}
+};
+/////////////////////////////////////////////////////////////////////////////////////////
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//compile many statements together into one DAG, all variables are bound to one symbol table and identical sub expressions (even
+// from different statements) are shared, then all statements will be evaluated in one execution of a program, each variable will
+// be fetched at most once, and each shared sub expression will be evaluated at most once.
+//if any statement throws an exception (divide zero for example) during the evaluation, the whole evaluation will be aborted.
+template <typename T = float, typename O = O3> class rule_set
+{
+public:
+	rule_set(const std::vector<std::string>& statements) : exps(compile(statements, symbols)), prog(exps) {}
+	//see compiler::compile with bounds
+	rule_set(const std::vector<std::string>& statements, const variable_bounds<T>& bounds) : exps(compile(statements, symbols, bounds)), prog(exps) {}
+
+	size_t size() const {return exps.size();}
+	const symbol_table& get_symbols() const {return symbols;}
+	const std::vector<exp_type<T>>& get_exps() const {return exps;}
+	const program<T>& get_program() const {return prog;}
+
+	//outputs must be able to hold size() values at least, they're in the same order as the statements.
+	void evaluate(const T* values, T* outputs) const {prog.execute_all(values, outputs);} //values are indexed by slots
+	void evaluate(const std::function<T(const std::string&)>& cb, T* outputs) const
+	{
+		std::vector<T> values(symbols.size());
+		std::vector<bool> fetched(symbols.size());
+		prog.execute_all([&](size_t slot) -> T {
+			if (!fetched[slot])
+			{
+				values[slot] = cb(symbols[slot]);
+				fetched[slot] = true;
+			}
+			return values[slot];
+		}, outputs);
+	}
 
-	static void on_error(const std::vector<std::string>& items, size_t index)
+private:
+	//statements will not be compiled via the compile cache, since cached expressions are shared and must not be changed.
+	static std::vector<exp_type<T>> compile(const std::vector<std::string>& statements, symbol_table& symbols,
+		const variable_bounds<T>& bounds = variable_bounds<T>())
 	{
-		puts("failed to parse the statement:");
-		for (size_t i = 0; i < items.size(); ++i)
-			if (i + 1 == index || i == index || i == index + 1)
-				printf("\033[31m%s\033[0m", items[i].data());
-			else
-				printf("%s", items[i].data());
+		std::vector<exp_type<T>> exps;
+		std::map<std::string, exp_type<T>> common_exps;
+		for (auto& statement : statements)
+		{
+			auto expression = statement;
+			compiler<T, O>::remove_blanks(expression);
+			auto exp = compiler<T, O>::compile_normalized(expression, symbols, bounds);
+			if (!exp)
+				throw("failed to compile statement " + statement);
+			exps.push_back(share_common_exps(exp, common_exps));
+		}
 
-		putchar('\n');
+		return exps;
 	}
+
+private:
+	symbol_table symbols;
+	std::vector<exp_type<T>> exps;
+	program<T> prog;
 };
 
 }
+
+#endif /* _QUESTION_EXP_H_ */
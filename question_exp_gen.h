@@ -0,0 +1,300 @@
+#ifndef _QUESTION_EXP_GEN_H_
+#define _QUESTION_EXP_GEN_H_
+
+#include "question_exp.h"
+
+#include <limits>
+#include <sstream>
+
+namespace qme
+{
+
+//generate c++ code from compiled question mark expressions (ahead of time compilation), each expression becomes an inline function
+// with straight-line code (only question marks and logical operators introduce branches), which has the same behavior as the
+// interpreter (float is raised in double precision, divide zero throws "divide zero").
+//the generated header doesn't depend on qme, see qme_gen.cpp.
+template <typename T> class generator
+{
+public:
+	generator(const std::string& _type_name) : type_name(_type_name) {}
+
+	static bool is_identifier(const std::string& name)
+	{
+		if (name.empty() || isdigit((unsigned char) name[0]))
+			return false;
+		for (auto c : name)
+			if (!isalnum((unsigned char) c) && '_' != c)
+				return false;
+		return true;
+	}
+
+	std::string to_literal(T v) const
+	{
+		std::ostringstream os;
+		if (!std::is_floating_point<T>::value)
+			os << "(value_type) " << (long long) v;
+		else if (v != v)
+			os << "std::numeric_limits<value_type>::quiet_NaN()";
+		else if (v == std::numeric_limits<T>::infinity() || v == -std::numeric_limits<T>::infinity())
+			os << (v < 0 ? "-" : "") << "std::numeric_limits<value_type>::infinity()";
+		else
+		{
+			char buff[64];
+			snprintf(buff, sizeof(buff), "%.17g", (double) v); //round trip
+			os << "(value_type) " << buff;
+		}
+		return os.str();
+	}
+
+	//all expressions must be bound to the same symbol table (see rule_set).
+	void generate(std::ostream& os, const std::string& name_space, const std::vector<std::string>& names,
+		const std::vector<std::string>& statements, const std::vector<exp_type<T>>& exps, const symbol_table& symbols) const
+	{
+		auto has_record = true;
+		for (size_t slot = 0; slot < symbols.size(); ++slot)
+			has_record = has_record && is_identifier(symbols[slot]);
+
+		os << "//generated by qme_gen, do not edit." << std::endl
+			<< "#pragma once" << std::endl << std::endl
+			<< "#include <math.h>" << std::endl
+			<< "#include <stddef.h>" << std::endl
+			<< "#include <limits>" << std::endl << std::endl
+			<< "namespace " << name_space << std::endl << '{' << std::endl << std::endl
+			<< "typedef " << type_name << " value_type;" << std::endl
+			<< "typedef " << (std::is_same<T, float>::value ? std::string("double") : std::is_integral<T>::value ? std::string("unsigned long long") :
+				type_name) << " wide_type; //to raise value_type, integers wrap around"
+			<< std::endl
+			<< "typedef value_type (*function)(const value_type* values);" << std::endl << std::endl;
+
+		os << "static const size_t variable_count = " << symbols.size() << ';' << std::endl
+			<< "static const char* const variable_names[] = {";
+		for (size_t slot = 0; slot < symbols.size(); ++slot)
+			os << (slot > 0 ? ", " : "") << quote(symbols[slot]);
+		os << (0 == symbols.size() ? "nullptr" : "") << "}; //indexed by slots" << std::endl << std::endl;
+
+		if (has_record)
+		{
+			os << "struct record" << std::endl << '{' << std::endl;
+			for (size_t slot = 0; slot < symbols.size(); ++slot)
+				os << "\tvalue_type " << symbols[slot] << ';' << std::endl;
+			os << "};" << std::endl << std::endl;
+		}
+
+		os << "inline value_type divide(value_type l, value_type r) {if (0 == r) throw(\"divide zero\"); return l / r;}" << std::endl
+			<< "inline value_type raise(value_type v, int exponent)" << std::endl
+			<< '{' << std::endl
+			<< "\twide_type base = v, re = 1;" << std::endl
+			<< "\tfor (auto n = exponent < 0 ? -exponent : exponent; n > 0; n >>= 1, base *= base)" << std::endl
+			<< "\t\tif (n & 1)" << std::endl
+			<< "\t\t\tre *= base;" << std::endl
+			<< "\treturn (value_type) (exponent < 0 ? 1 / re : re);" << std::endl
+			<< '}' << std::endl << std::endl;
+
+		for (size_t n = 0; n < exps.size(); ++n)
+		{
+			os << "//" << statements[n] << std::endl;
+			generate(os, names[n], exps[n]);
+			if (has_record)
+			{
+				os << "inline value_type " << names[n] << "(const record& r)" << std::endl << '{' << std::endl
+					<< "\tconst value_type values[] = {";
+				for (size_t slot = 0; slot < symbols.size(); ++slot)
+					os << (slot > 0 ? ", " : "") << "r." << symbols[slot];
+				os << (0 == symbols.size() ? "0" : "") << "};" << std::endl
+					<< "\treturn " << names[n] << "(values);" << std::endl << '}' << std::endl;
+			}
+			os << std::endl;
+		}
+
+		os << "static const size_t rule_count = " << exps.size() << ';' << std::endl
+			<< "static const char* const rule_names[] = {";
+		for (size_t n = 0; n < names.size(); ++n)
+			os << (n > 0 ? ", " : "") << quote(names[n]);
+		os << "};" << std::endl << "static const char* const statements[] = {";
+		for (size_t n = 0; n < statements.size(); ++n)
+			os << (n > 0 ? ", " : "") << quote(statements[n]);
+		os << "};" << std::endl << "static const function functions[] = {";
+		for (size_t n = 0; n < names.size(); ++n)
+			os << (n > 0 ? ", " : "") << "static_cast<function>(&" << names[n] << ')';
+		os << "};" << std::endl << std::endl << "} //namespace" << std::endl;
+	}
+
+	//generate one inline function, the expression is travelled with an explicit stack, each non-leaf expression gets a local variable,
+	// identical sub expressions (shared by O2/O3) are evaluated once per scope.
+	void generate(std::ostream& os, const std::string& name, exp_ctype<T>& exp) const
+	{
+		struct frame {const exp_type<T>* e; int stage; std::string temp;};
+		std::vector<frame> frames(1, frame {&exp, 0, std::string()});
+		std::vector<std::string> results, lines;
+		std::map<const qme::exp<T>*, std::pair<std::string, size_t>> temps; //second - the scope which the local variable belongs to
+		std::vector<size_t> scopes(1, 0);
+		size_t next_scope = 1, next_temp = 0;
+		auto line = [&](const std::string& l) {lines.push_back(std::string(scopes.size(), '\t') + l);};
+		auto open_scope = [&]() {line("{"); scopes.push_back(next_scope++);};
+		auto close_scope = [&]() {scopes.pop_back(); line("}");};
+		auto pop_result = [&]() {auto re = std::move(results.back()); results.pop_back(); return re;};
+
+		while (!frames.empty())
+		{
+			auto i = frames.size() - 1;
+			const auto& e = *frames[i].e;
+			auto stage = frames[i].stage++;
+			if (0 == stage)
+			{
+				auto iter = temps.find(e.get());
+				if (temps.end() != iter && std::end(scopes) != std::find(std::begin(scopes), std::end(scopes), iter->second.second))
+				{
+					results.push_back(iter->second.first);
+					frames.pop_back();
+					continue;
+				}
+				else if (e->is_leaf())
+				{
+					results.push_back(leaf(e));
+					frames.pop_back();
+					continue;
+				}
+
+				frames[i].temp = "t" + std::to_string(next_temp++);
+			}
+
+			auto& temp = frames[i].temp;
+			if (e->is_selector()) //question exp
+				switch (stage)
+				{
+				case 0: frames.push_back(frame {&e->get_road_map(), 0, std::string()}); continue;
+				case 1:
+					line("value_type " + temp + ';');
+					line("if (0 != " + pop_result() + ')');
+					open_scope();
+					frames.push_back(frame {&e->get_left_item(), 0, std::string()});
+					continue;
+				case 2:
+					line(temp + " = " + pop_result() + ';');
+					close_scope();
+					line("else");
+					open_scope();
+					frames.push_back(frame {&e->get_right_item(), 0, std::string()});
+					continue;
+				default:
+					line(temp + " = " + pop_result() + ';');
+					close_scope();
+					break;
+				}
+			else if (!e->get_right_item()) //unitary exp
+			{
+				if (0 == stage)
+				{
+					frames.push_back(frame {&e->get_left_item(), 0, std::string()});
+					continue;
+				}
+
+				auto operand = pop_result();
+				line("const value_type " + temp + " = " + (e->is_reverser() ?
+					(e->is_data() ? "-(" + operand + ')' : "(value_type) (0 == " + operand + ')') : "(value_type) (0 != " + operand + ')') + ';');
+			}
+			else //binary exp
+			{
+				auto op = e->get_operator_type();
+				auto is_logical = is_logical_operator(op);
+				switch (stage)
+				{
+				case 0: frames.push_back(frame {&e->get_left_item(), 0, std::string()}); continue;
+				case 1:
+					if (is_logical)
+					{
+						line("value_type " + temp + " = (value_type) (0 != " + pop_result() + ");");
+						line(std::string("if (") + (operator_type::logical_and == op ? "0 != " : "0 == ") + temp + ')');
+						open_scope();
+					}
+					frames.push_back(frame {&e->get_right_item(), 0, std::string()});
+					continue;
+				default:
+					if (is_logical)
+					{
+						line(temp + " = (value_type) (0 != " + pop_result() + ");");
+						close_scope();
+					}
+					else
+					{
+						auto r = pop_result(), l = pop_result();
+						if (operator_type::div == op)
+							line("const value_type " + temp + " = divide(" + l + ", " + r + ");");
+						else if (is_comparer(op))
+							line("const value_type " + temp + " = (value_type) (" + l + ' ' + to_string(op) + ' ' + r + ");");
+						else
+							line("const value_type " + temp + " = " + l + ' ' + to_string(op) + ' ' + r + ';');
+					}
+					break;
+				}
+			}
+
+			temps[e.get()] = std::make_pair(temp, scopes.back());
+			results.push_back(temp);
+			frames.pop_back();
+		}
+
+		assert(1 == results.size());
+		os << "inline value_type " << name << "(const value_type* values)" << std::endl << '{' << std::endl;
+		for (auto& l : lines)
+			os << l << std::endl;
+		os << "\treturn " << results.back() << ';' << std::endl << '}' << std::endl;
+	}
+
+private:
+	//raise the variable and multiply it by the multiplier, exactly like program<T>::emit_leaf.
+	std::string leaf(exp_ctype<T>& exp) const
+	{
+		if (exp->is_immediate())
+			return to_literal(exp->get_immediate_value());
+		else if (!exp->is_variable())
+			throw("unsupported leaf expression!");
+
+		auto slot = exp->get_slot();
+		if (symbol_table::npos == slot)
+			throw("unbound variable " + exp->get_variable_name());
+
+		auto v = "values[" + std::to_string(slot) + ']';
+		auto w = "(wide_type) " + v;
+		auto exponent = exp->get_exponent();
+		auto raise = power<T>::get(exponent);
+		if (&power<T>::zero == raise)
+			v = "(value_type) 1";
+		else if (&power<T>::square == raise)
+			v = "(value_type) (" + w + " * " + w + ')';
+		else if (&power<T>::cube == raise)
+			v = "(value_type) (" + w + " * " + w + " * " + w + ')';
+		else if (&power<T>::reciprocal == raise)
+			v = "(value_type) (1 / " + w + ')';
+		else if (&power<T>::by_squaring == raise)
+			v = "raise(" + v + ", " + std::to_string(exponent) + ')';
+		else if (&power<T>::libm == raise)
+			v = "(value_type) pow(" + v + ", " + std::to_string(exponent) + ')';
+
+		auto multiplier = exp->get_multiplier();
+		if (-1 == multiplier)
+			return "-" + v;
+		else if (1 != multiplier)
+			return '(' + v + " * " + to_literal(multiplier) + ')';
+		return v;
+	}
+
+	static std::string quote(const std::string& s)
+	{
+		std::string re = "\"";
+		for (auto c : s)
+		{
+			if ('"' == c || '\\' == c)
+				re += '\\';
+			re += c;
+		}
+		return re + '"';
+	}
+
+private:
+	std::string type_name;
+};
+
+} //namespace
+
+#endif /* _QUESTION_EXP_GEN_H_ */
@@ -0,0 +1,347 @@
+#ifndef _QUESTION_EXP_IMAGE_H_
+#define _QUESTION_EXP_IMAGE_H_
+
+#include "question_exp.h"
+
+//mapping files needs POSIX mmap, define QME_NO_MMAP to disable it, then qme::mapped_file reads the whole file into memory instead.
+#if !defined(QME_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define QME_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <fstream>
+
+namespace qme
+{
+
+//a binary image of programs (see qme::program), which can be written once and then executed directly from its bytes (mapped from
+// a file for example), without any parsing nor allocation, so one file can be mapped and shared read only by many processes.
+//images can only be loaded on the same platform with the same T (checked by the header).
+//
+//layout (all offsets are from the beginning of the image, integers are in the native byte order):
+// image_header
+// uint64_t offsets of programs[program_num]
+// uint64_t offsets of variable names[variable_num + 1] (indexed by slots, the last one is the end of all names)
+// chars of variable names (without terminators)
+// programs, each one is aligned to program_alignment: image_program_header, T[const_num], instruction[code_size] (see image_layout)
+struct image_header
+{
+	char magic[8];
+	uint32_t version, value_size, value_kind, instruction_size;
+	uint64_t size, program_num, variable_num;
+};
+
+struct image_program_header {uint64_t code_size, const_num, max_stack_size, cache_size, output_size;};
+
+const size_t program_alignment = 16;
+
+template <typename T> struct image_layout //offsets within a program
+{
+	static_assert(alignof(T) <= program_alignment, "unsupported value type");
+
+	static size_t align(size_t n, size_t alignment) {return (n + alignment - 1) / alignment * alignment;}
+	static size_t consts_offset() {return align(sizeof(image_program_header), alignof(T));}
+	static size_t code_offset(size_t const_num) {return align(consts_offset() + const_num * sizeof(T), alignof(instruction));}
+};
+
+template <typename T> inline image_header make_image_header()
+{
+	image_header header = {{'q', 'm', 'e', 'i', 'm', 'a', 'g', 'e'}, 1, (uint32_t) sizeof(T),
+		(uint32_t) (std::is_floating_point<T>::value ? 2 : 0) | (uint32_t) std::is_signed<T>::value, (uint32_t) sizeof(instruction), 0, 0, 0};
+	return header;
+}
+
+//all programs must be bound to the same symbol table (see rule_set) or to symbol tables which don't conflict with each other.
+template <typename T> inline std::string to_image(const std::vector<const program<T>*>& progs)
+{
+	std::vector<std::string> variable_names;
+	for (auto prog : progs)
+	{
+		auto& names = prog->get_variable_names();
+		if (names.size() > variable_names.size())
+			variable_names.resize(names.size());
+		for (size_t slot = 0; slot < names.size(); ++slot)
+			if (variable_names[slot].empty())
+				variable_names[slot] = names[slot];
+			else if (!names[slot].empty() && names[slot] != variable_names[slot])
+				throw("conflicting variable " + names[slot]);
+	}
+
+	std::string image(sizeof(image_header) + (progs.size() + variable_names.size() + 1) * sizeof(uint64_t), '\0');
+	auto put = [&](size_t offset, const void* data, size_t len) {memcpy(&image[offset], data, len);};
+	auto offsets = sizeof(image_header), name_offsets = offsets + progs.size() * sizeof(uint64_t);
+	for (size_t slot = 0; slot <= variable_names.size(); ++slot)
+	{
+		uint64_t offset = image.size();
+		put(name_offsets + slot * sizeof(uint64_t), &offset, sizeof(offset));
+		if (slot < variable_names.size())
+			image += variable_names[slot];
+	}
+
+	for (size_t n = 0; n < progs.size(); ++n)
+	{
+		size_t offset = image_layout<T>::align(image.size(), program_alignment);
+		uint64_t offset_64 = offset;
+		put(offsets + n * sizeof(uint64_t), &offset_64, sizeof(offset_64));
+
+		auto& code = progs[n]->get_code();
+		auto& consts = progs[n]->get_consts();
+		image_program_header header = {code.size(), consts.size(), progs[n]->get_max_stack_size(), progs[n]->get_cache_size(), progs[n]->output_size()};
+		auto code_offset = offset + image_layout<T>::code_offset(consts.size());
+		image.resize(code_offset + code.size() * sizeof(instruction), '\0'); //padding bytes are 0
+		put(offset, &header, sizeof(header));
+		if (!consts.empty())
+			put(offset + image_layout<T>::consts_offset(), consts.data(), consts.size() * sizeof(T));
+		for (size_t i = 0; i < code.size(); ++i) //field by field, so padding bytes of instructions are kept as 0
+		{
+			put(code_offset + i * sizeof(instruction) + offsetof(instruction, code), &code[i].code, sizeof(code[i].code));
+			put(code_offset + i * sizeof(instruction) + offsetof(instruction, arg), &code[i].arg, sizeof(code[i].arg));
+		}
+	}
+
+	auto header = make_image_header<T>();
+	header.size = image.size();
+	header.program_num = progs.size();
+	header.variable_num = variable_names.size();
+	put(0, &header, sizeof(header));
+	return image;
+}
+
+template <typename T> inline std::string to_image(const program<T>& prog) {return to_image(std::vector<const program<T>*>(1, &prog));}
+
+//a program executed directly from an image, it's valid as long as the image.
+template <typename T> class program_view
+{
+public:
+	program_view(const image_program_header* _header, const char* const* _names) : header(_header), names(_names),
+		code((const instruction*) ((const char*) header + image_layout<T>::code_offset((size_t) header->const_num))),
+		consts((const T*) ((const char*) header + image_layout<T>::consts_offset())) {}
+
+	inline T operator()(const std::function<T(const std::string&)>& cb) const {return data(cb);}
+	inline T operator()(const T* values) const {return data(values);} //values are indexed by slots
+
+	T data(const std::function<T(const std::string&)>& cb) const {return execute(cb);}
+	T data(const T* values) const {return execute(values);}
+	bool judge(const std::function<T(const std::string&)>& cb) const {return 0 != execute(cb);}
+	bool judge(const T* values) const {return 0 != execute(values);}
+
+	//stack must be able to hold stack_size() values at least, outputs must be able to hold output_size() values at least.
+	template <typename ARG> void execute(const ARG& arg, T* stack, T* outputs) const
+	{
+		program<T>::execute(code, (size_t) header->code_size, consts, (size_t) header->max_stack_size, (size_t) header->cache_size,
+			[&](int slot) {return this->fetch(arg, slot);}, stack, outputs);
+	}
+
+	template <typename ARG> void execute_all(const ARG& arg, T* outputs) const
+	{
+		if (stack_size() <= 64)
+		{
+			T stack[64];
+			execute(arg, stack, outputs);
+		}
+		else
+		{
+			std::vector<T> stack(stack_size());
+			execute(arg, stack.data(), outputs);
+		}
+	}
+
+	//for programs with only one output
+	template <typename ARG> T execute(const ARG& arg) const {T re; execute_all(arg, &re); return re;}
+
+	size_t stack_size() const {return (size_t) (header->max_stack_size + 2 * header->cache_size);}
+	size_t output_size() const {return (size_t) header->output_size;}
+
+private:
+	T fetch(const T* values, int slot) const {return values[slot];}
+	T fetch(const std::function<T(const std::string&)>& cb, int slot) const {return cb(std::string(names[slot], names[slot + 1]));}
+
+private:
+	const image_program_header* header;
+	const char* const* names;
+	const instruction* code;
+	const T* consts;
+};
+
+//load an image in O(size) without copying it, the image must be aligned to program_alignment (mapped files are page aligned) and
+// must be kept until all programs of it are not used anymore.
+//operands of all instructions are checked, and the stack depth is tracked through all paths (jumps are forward only, so one linear
+// pass is enough), it must never exceed the max stack size of the program, otherwise the image will be rejected.
+//all errors are thrown as std::string.
+template <typename T> class image
+{
+public:
+	image(const void* data, size_t size) : bytes((const char*) data)
+	{
+		auto expected = make_image_header<T>();
+		if (size < sizeof(image_header) || 0 != memcmp(bytes, &expected, offsetof(image_header, size)))
+			throw(std::string("invalid image or unmatched value type!"));
+		memcpy(&header, bytes, sizeof(header));
+		auto offset_num = (size - sizeof(image_header)) / sizeof(uint64_t); //compare counts one by one, their sum may wrap around
+		if (header.size != size || 0 != (uintptr_t) bytes % program_alignment ||
+			header.program_num > offset_num || header.variable_num >= offset_num - header.program_num)
+			throw(std::string("invalid image!"));
+
+		auto offsets = (const uint64_t*) (bytes + sizeof(image_header));
+		auto name_offsets = offsets + header.program_num;
+		names.reserve((size_t) header.variable_num + 1);
+		for (size_t slot = 0; slot <= header.variable_num; ++slot)
+			if (name_offsets[slot] > size || (slot > 0 && name_offsets[slot] < name_offsets[slot - 1]))
+				throw(std::string("invalid image!"));
+			else
+				names.push_back(bytes + name_offsets[slot]);
+
+		progs.reserve((size_t) header.program_num);
+		std::vector<int64_t> depths; //reused by all programs
+		for (size_t n = 0; n < header.program_num; ++n)
+		{
+			auto offset = offsets[n];
+			if (0 != offset % program_alignment || offset > size || size - offset < sizeof(image_program_header))
+				throw(std::string("invalid image!"));
+			auto h = (const image_program_header*) (bytes + offset);
+			auto code_offset = (size - offset) / sizeof(T) < h->const_num ? size + 1 : offset + image_layout<T>::code_offset((size_t) h->const_num);
+			if (code_offset > size || (size - code_offset) / sizeof(instruction) < h->code_size ||
+				h->cache_size > h->code_size || h->output_size > h->code_size) //each of them needs one instruction at least
+				throw(std::string("invalid image!"));
+			progs.emplace_back(h, names.data());
+			check(h, depths);
+		}
+	}
+
+	image(const image&) = delete; //programs refer to names
+	image& operator=(const image&) = delete;
+
+	size_t size() const {return progs.size();}
+	const program_view<T>& operator[](size_t n) const {return progs[n];}
+	size_t variable_num() const {return (size_t) header.variable_num;}
+	std::string get_variable_name(size_t slot) const {return std::string(names[slot], names[slot + 1]);} //indexed by slots
+
+private:
+	//depths[n] is the stack depth before the nth instruction, -1 means unreachable (so far).
+	void check(const image_program_header* h, std::vector<int64_t>& depths) const
+	{
+		auto code = (const instruction*) ((const char*) h + image_layout<T>::code_offset((size_t) h->const_num));
+		auto code_size = (size_t) h->code_size;
+		depths.assign(code_size + 1, -1);
+		depths[0] = 0;
+
+		auto invalid = []() {throw(std::string("invalid image!"));};
+		int64_t max_depth = 0;
+		auto go_to = [&](size_t target, int64_t depth) {
+			if (target > code_size || (depths[target] >= 0 && depths[target] != depth))
+				invalid();
+			depths[target] = depth;
+			max_depth = std::max(max_depth, depth);
+		};
+		for (size_t n = 0; n < code_size; ++n)
+		{
+			auto& i = code[n];
+			auto depth = depths[n];
+			if (i.code > opcode::store_output)
+				invalid();
+			else if (depth < 0) //unreachable
+				continue;
+
+			auto pop = [&](int64_t num) {if (depth < num) invalid(); return depth - num;};
+			auto jump_target = [&]() {if (i.arg < 0 || (size_t) i.arg <= n) invalid(); return (size_t) i.arg;}; //forward only
+			uint64_t bound = (uint64_t) -1; //no operand or any exponent
+			switch (i.code)
+			{
+			case opcode::immediate: bound = h->const_num; go_to(n + 1, depth + 1); break;
+			case opcode::load: bound = header.variable_num; go_to(n + 1, depth + 1); break;
+			case opcode::power: case opcode::square: case opcode::cube: case opcode::reciprocal:
+			case opcode::negate: case opcode::to_not: case opcode::to_bool: go_to(n + 1, pop(1) + 1); break;
+			case opcode::jump: go_to(jump_target(), depth); break;
+			case opcode::jump_if_zero: go_to(n + 1, pop(1)); go_to(jump_target(), pop(1)); break;
+			case opcode::jump_if_zero_or_pop: case opcode::jump_if_not_zero_or_pop: go_to(n + 1, pop(1)); go_to(jump_target(), depth); break;
+			case opcode::load_cache: bound = h->cache_size; go_to(n + 1, depth + 1); go_to(n + 2, depth); break; //or skip the next one
+			case opcode::store_cache: bound = h->cache_size; go_to(n + 1, pop(1) + 1); break;
+			case opcode::store_output: bound = h->output_size; go_to(n + 1, pop(1)); break;
+			default: go_to(n + 1, pop(2) + 1); break; //calculators and comparers
+			}
+			if ((uint64_t) -1 != bound && (i.arg < 0 || (uint64_t) i.arg >= bound))
+				invalid();
+		}
+
+		if (0 != depths[code_size] || (uint64_t) max_depth != h->max_stack_size) //all values must be popped
+			invalid();
+	}
+
+private:
+	const char* bytes;
+	image_header header;
+	std::vector<const char*> names;
+	std::vector<program_view<T>> progs;
+};
+
+//a read only file mapped into memory, it can be shared by processes.
+class mapped_file
+{
+public:
+	mapped_file(const std::string& file_name) : addr(nullptr), len(0)
+	{
+#ifdef QME_MMAP
+		auto fd = open(file_name.data(), O_RDONLY);
+		struct stat st;
+		if (fd < 0 || 0 != fstat(fd, &st))
+		{
+			if (fd >= 0)
+				close(fd);
+			throw("cannot open " + file_name);
+		}
+
+		len = (size_t) st.st_size;
+		if (len > 0)
+			addr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (MAP_FAILED == addr)
+		{
+			addr = nullptr;
+			throw("cannot map " + file_name);
+		}
+#else
+		std::ifstream f(file_name, std::ios::binary | std::ios::ate);
+		if (!f)
+			throw("cannot open " + file_name);
+		len = (size_t) f.tellg();
+		buffer.reset(new char[len + 1]); //aligned for any fundamental type
+		if (!f.seekg(0).read(buffer.get(), len))
+			throw("cannot read " + file_name);
+		addr = buffer.get();
+#endif
+	}
+	~mapped_file()
+	{
+#ifdef QME_MMAP
+		if (nullptr != addr)
+			munmap(addr, len);
+#endif
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	const void* data() const {return addr;}
+	size_t size() const {return len;}
+
+private:
+	void* addr;
+	size_t len;
+#ifndef QME_MMAP
+	std::unique_ptr<char[]> buffer;
+#endif
+};
+
+inline void save_image(const std::string& file_name, const std::string& image)
+{
+	std::ofstream f(file_name, std::ios::binary | std::ios::trunc);
+	if (!f.write(image.data(), image.size()) || !f.flush())
+		throw("cannot write " + file_name);
+}
+
+} //namespace
+
+#endif /* _QUESTION_EXP_IMAGE_H_ */
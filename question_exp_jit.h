@@ -0,0 +1,592 @@
+#ifndef _QUESTION_EXP_JIT_H_
+#define _QUESTION_EXP_JIT_H_
+
+#include "question_exp.h"
+
+//native code for x86-64 (linux), define QME_NO_JIT to disable it, then qme::jit always falls back to the interpreter.
+#if !defined(QME_NO_JIT) && defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define QME_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace qme
+{
+
+//a minimal x86-64 assembler, only instructions needed by jit are supported.
+//xmm/ymm registers are numbered 0 ~ 15, general purpose registers are numbered as rax(0), rcx(1), rdx(2), rbx(3), rsp(4), rbp(5),
+// rsi(6), rdi(7).
+class x86_64_assembler
+{
+public:
+	enum gpr {rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi};
+	//prefixes of SSE instructions, ps (packed single) doesn't need a prefix
+	enum sse_prefix {ps = 0, pd = 0x66, ss = 0xF3, sd = 0xF2};
+	//conditions of jcc
+	enum condition {jp = 0x8A, je = 0x84, jne = 0x85, ja = 0x87};
+
+	size_t size() const {return code.size();}
+	const std::vector<unsigned char>& get_code() const {return code;}
+
+	void emit(unsigned char c) {code.push_back(c);}
+	void emit32(int v) {for (auto n = 0; n < 4; ++n) emit((unsigned char) (v >> (8 * n)));}
+	void patch32(size_t pos, int v) {for (auto n = 0; n < 4; ++n) code[pos + n] = (unsigned char) (v >> (8 * n));}
+
+	//legacy SSE: op xmm_reg, xmm_rm
+	void sse(sse_prefix prefix, unsigned char op, int reg, int rm)
+		{sse_prefix_and_opcode(prefix, op, reg, rm); emit((unsigned char) (0xC0 | (reg & 7) << 3 | (rm & 7)));}
+	//legacy SSE: op xmm_reg, [base + disp]
+	void sse(sse_prefix prefix, unsigned char op, int reg, gpr base, int disp)
+		{sse_prefix_and_opcode(prefix, op, reg, 0); memory(reg, base, disp);}
+	//legacy SSE: op xmm_reg, [rip + disp], disp is computed from the absolute position of the operand in the buffer
+	void sse_rip(sse_prefix prefix, unsigned char op, int reg, size_t pos)
+		{sse_prefix_and_opcode(prefix, op, reg, 0); rip(reg, pos, 0);}
+	void cmp_sse(sse_prefix prefix, int reg, int rm, unsigned char predicate) {sse(prefix, 0xC2, reg, rm); emit(predicate);}
+	void ucomi(bool is_double, int reg, int rm) {sse(is_double ? pd : ps, 0x2E, reg, rm);}
+
+	//VEX.256: op ymm_reg, ymm_v, ymm_rm
+	void avx(bool is_double, unsigned char op, int reg, int v, int rm)
+		{vex(is_double, reg, 0, rm, v); emit(op); emit((unsigned char) (0xC0 | (reg & 7) << 3 | (rm & 7)));}
+	//VEX.256: op ymm_reg, ymm_v, [rip + disp]
+	void avx_rip(bool is_double, unsigned char op, int reg, int v, size_t pos, int imm_size = 0)
+		{vex(is_double, reg, 0, 0, v); emit(op); rip(reg, pos, imm_size);}
+	//VEX.256: op ymm_reg, [base + index * scale]
+	void avx_sib(bool is_double, unsigned char op, int reg, gpr base, gpr index, int scale)
+	{
+		vex(is_double, reg, index, base, 0);
+		emit(op);
+		emit((unsigned char) (0x04 | (reg & 7) << 3)); //mod 00, rm 100 (SIB)
+		emit((unsigned char) ((2 == scale ? 1 : 4 == scale ? 2 : 8 == scale ? 3 : 0) << 6 | (index & 7) << 3 | (base & 7)));
+	}
+	void cmp_avx(bool is_double, int reg, int v, int rm, unsigned char predicate) {avx(is_double, 0xC2, reg, v, rm); emit(predicate);}
+	void vzeroupper() {emit(0xC5); emit(0xF8); emit(0x77);}
+
+	//mov byte [rsp + disp], imm
+	void mov_byte(int disp, unsigned char imm) {emit(0xC6); memory(0, rsp, disp); emit(imm);}
+	//cmp byte [rsp + disp], imm
+	void cmp_byte(int disp, unsigned char imm) {emit(0x80); memory(7, rsp, disp); emit(imm);}
+	//mov r64, [base + disp]
+	void mov_load(gpr reg, gpr base, int disp) {emit(0x48); emit(0x8B); memory(reg, base, disp);}
+	void sub_rsp(int v) {emit(0x48); emit(0x81); emit(0xEC); emit32(v);}
+	void add_rsp(int v) {emit(0x48); emit(0x81); emit(0xC4); emit32(v);}
+	void mov_eax(int v) {emit(0xB8); emit32(v);}
+
+	//return the position of rel32, which need to be patched later.
+	size_t jcc(condition c) {emit(0x0F); emit((unsigned char) c); emit32(0); return size() - 4;}
+	size_t jmp() {emit(0xE9); emit32(0); return size() - 4;}
+	void patch_jump(size_t pos, size_t target) {patch32(pos, (int) target - (int) (pos + 4));}
+	void ret() {emit(0xC3);}
+
+private:
+	void sse_prefix_and_opcode(sse_prefix prefix, unsigned char op, int reg, int rm)
+	{
+		if (ps != prefix)
+			emit((unsigned char) prefix);
+		if (reg > 7 || rm > 7)
+			emit((unsigned char) (0x40 | (reg > 7 ? 4 : 0) | (rm > 7 ? 1 : 0)));
+		emit(0x0F);
+		emit(op);
+	}
+
+	void vex(bool is_double, int reg, int index, int rm, int v)
+	{
+		emit(0xC4);
+		emit((unsigned char) ((reg > 7 ? 0 : 0x80) | (index > 7 ? 0 : 0x40) | (rm > 7 ? 0 : 0x20) | 1)); //map 0F
+		emit((unsigned char) ((~v & 0xF) << 3 | 4 | (is_double ? 1 : 0))); //W0, L1 (256 bits), pp: none or 66
+	}
+
+	void memory(int reg, gpr base, int disp) //mod 10: [base + disp32]
+	{
+		emit((unsigned char) (0x80 | (reg & 7) << 3 | (base & 7)));
+		if (rsp == base)
+			emit(0x24); //SIB: no index, base rsp
+		emit32(disp);
+	}
+
+	void rip(int reg, size_t pos, int imm_size) //mod 00, rm 101: [rip + disp32]
+	{
+		emit((unsigned char) ((reg & 7) << 3 | 5));
+		emit32((int) pos - (int) (size() + 4 + imm_size));
+	}
+
+private:
+	std::vector<unsigned char> code;
+};
+
+//compile a program (lowered from an optimized expression, or from a rule_set) into native x86-64 code in executable pages:
+// a scalar function with SSE2 instructions, and a batch function with AVX2 instructions (8 floats or 4 doubles at a time).
+//the native functions never throw exceptions, they return 1 on divide zero and 0 on success, the member functions of jit convert
+// them to exceptions just like the interpreter.
+//anything unsupported (integers, stacks deeper than 13 registers, libm pow for big exponents, and for the batch function, branches,
+// cached sub expressions, multiple outputs and exponents of float other than 2) falls back to the interpreter (qme::program).
+template <typename T> class jit
+{
+public:
+	typedef int (*function)(const T* values, T* outputs); //values are indexed by slots
+	typedef int (*batch_function)(const T* const* columns, size_t rows, T* outputs); //only handles rows - rows % lanes rows
+
+	static const int max_stack_size = 13; //xmm0 ~ xmm12, xmm13 and xmm14 are scratch registers, xmm15 is always zero
+	static const size_t lanes = 32 / sizeof(T);
+
+public:
+	jit(exp_ctype<T>& exp) : prog(exp), native(nullptr), native_batch(nullptr), memory(nullptr), memory_size(0) {compile();}
+	jit(const program<T>& _prog) : prog(_prog), native(nullptr), native_batch(nullptr), memory(nullptr), memory_size(0) {compile();}
+	jit(const jit&) = delete;
+	jit& operator=(const jit&) = delete;
+	~jit()
+	{
+#ifdef QME_JIT
+		if (nullptr != memory)
+			munmap(memory, memory_size);
+#endif
+	}
+
+	bool is_native() const {return nullptr != native;}
+	bool is_native_batch() const {return nullptr != native_batch;}
+	function get_function() const {return native;}
+	batch_function get_batch_function() const {return native_batch;}
+	const program<T>& get_program() const {return prog;}
+
+	inline T operator()(const T* values) const {return data(values);}
+	T data(const T* values) const {T re; execute(values, &re); return re;}
+	bool judge(const T* values) const {return 0 != data(values);}
+	//outputs must be able to hold get_program().output_size() values at least.
+	void execute(const T* values, T* outputs) const
+	{
+		if (nullptr == native)
+			prog.execute_all(values, outputs);
+		else if (0 != native(values, outputs))
+			throw("divide zero");
+	}
+
+	//one column per slot, output n of row r will be put into outputs[n * rows + r].
+	void batch_data(const T* const* columns, size_t rows, T* outputs) const
+	{
+		size_t r = 0;
+		if (nullptr != native_batch)
+		{
+			if (0 != native_batch(columns, rows, outputs))
+				throw("divide zero");
+			r = rows - rows % lanes;
+		}
+
+		std::vector<T> values(prog.get_variable_names().size()), re(prog.output_size());
+		for (; r < rows; ++r)
+		{
+			for (size_t slot = 0; slot < values.size(); ++slot)
+				if (nullptr != columns[slot])
+					values[slot] = columns[slot][r];
+			execute(values.data(), re.data());
+			for (size_t n = 0; n < re.size(); ++n)
+				outputs[n * rows + r] = re[n];
+		}
+	}
+
+private:
+	enum constant {one, sign_mask, one_wide, first_immediate}; //indexes of constants, each of them takes 32 bytes
+
+	static bool is_double() {return std::is_same<T, double>::value;}
+	static x86_64_assembler::sse_prefix scalar_prefix() {return is_double() ? x86_64_assembler::sd : x86_64_assembler::ss;}
+	static size_t constant_pos(size_t index) {return 32 * index;}
+
+	void compile()
+	{
+#ifdef QME_JIT
+		if (!std::is_same<T, float>::value && !is_double())
+			return;
+
+		std::vector<int> depths;
+		if (!get_depths(depths))
+			return;
+
+		x86_64_assembler a;
+		//constants, 32 bytes each (broadcasted), so they can be used by both SSE and AVX instructions
+		auto put = [&](const void* v, size_t size) {
+			for (size_t n = 0; n < 32; ++n)
+				a.emit(((const unsigned char*) v)[n % size]);
+		};
+		T one_value = 1, mask;
+		double one_double = 1;
+		memset(&mask, 0, sizeof(mask));
+		((unsigned char*) &mask)[sizeof(T) - 1] = 0x80;
+		put(&one_value, sizeof(T));
+		put(&mask, sizeof(T));
+		put(&one_double, sizeof(double));
+		for (auto& c : prog.get_consts())
+			put(&c, sizeof(T));
+
+		auto entry = a.size();
+		if (!emit_scalar(a, depths))
+			return;
+
+		auto batch_entry = a.size();
+		auto has_batch = best_simd_isa() >= simd_isa::avx2 && emit_batch(a, depths);
+
+		auto page_size = (size_t) sysconf(_SC_PAGESIZE);
+		auto size = (a.size() + page_size - 1) / page_size * page_size;
+		auto m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (MAP_FAILED == m)
+			return;
+
+		memcpy(m, a.get_code().data(), a.size());
+		if (0 != mprotect(m, size, PROT_READ | PROT_EXEC))
+		{
+			munmap(m, size);
+			return;
+		}
+
+		memory = m;
+		memory_size = size;
+		native = (function) ((char*) m + entry);
+		if (has_batch)
+			native_batch = (batch_function) ((char*) m + batch_entry);
+#endif
+	}
+
+	//the depth of the stack before each instruction (-1 means unreachable), which maps the stack to registers.
+	bool get_depths(std::vector<int>& depths) const
+	{
+		auto& code = prog.get_code();
+		depths.assign(code.size() + 1, -1);
+		std::vector<std::pair<size_t, int>> todo(1, std::make_pair((size_t) 0, 0));
+		while (!todo.empty())
+		{
+			auto pc = todo.back().first;
+			auto depth = todo.back().second;
+			todo.pop_back();
+			if (pc > code.size() || depth < 0 || depth > max_stack_size)
+				return false;
+			else if (depths[pc] >= 0)
+			{
+				if (depths[pc] != depth)
+					return false;
+				continue;
+			}
+
+			depths[pc] = depth;
+			if (pc == code.size())
+				continue;
+
+			auto& i = code[pc];
+			switch (i.code)
+			{
+			case opcode::immediate: case opcode::load: todo.emplace_back(pc + 1, depth + 1); break;
+			case opcode::power:
+				if (power<T>::get(i.arg) == &power<T>::libm)
+					return false;
+				//fall through
+			case opcode::negate: case opcode::to_not: case opcode::to_bool: case opcode::square: case opcode::cube:
+			case opcode::reciprocal: case opcode::store_cache:
+				todo.emplace_back(pc + 1, depth);
+				break;
+			case opcode::add: case opcode::sub: case opcode::multi: case opcode::div: case opcode::bigger: case opcode::bigger_equal:
+			case opcode::smaller: case opcode::smaller_equal: case opcode::equal: case opcode::not_equal: case opcode::store_output:
+				todo.emplace_back(pc + 1, depth - 1);
+				break;
+			case opcode::jump: todo.emplace_back((size_t) i.arg, depth); break;
+			case opcode::jump_if_zero:
+				todo.emplace_back(pc + 1, depth - 1);
+				todo.emplace_back((size_t) i.arg, depth - 1);
+				break;
+			case opcode::jump_if_zero_or_pop: case opcode::jump_if_not_zero_or_pop:
+				todo.emplace_back(pc + 1, depth - 1);
+				todo.emplace_back((size_t) i.arg, depth);
+				break;
+			case opcode::load_cache: //push and execute the next instruction (a jump), or skip it
+				todo.emplace_back(pc + 1, depth + 1);
+				todo.emplace_back(pc + 2, depth);
+				break;
+			default: return false;
+			}
+		}
+
+		return true;
+	}
+
+	//raise xmm14 (in wide type) to the exponent, return the register which holds the result (in wide type).
+	int emit_power(x86_64_assembler& a, int exponent, bool vectorized) const
+	{
+		auto op = [&](unsigned char c, int reg, int rm) {
+			if (vectorized)
+				a.avx(true, c, reg, reg, rm);
+			else
+				a.sse(x86_64_assembler::sd, c, reg, rm);
+		};
+		auto load_one = [&](int reg) {
+			if (vectorized)
+				a.avx_rip(true, 0x10, reg, 0, constant_pos(one_wide));
+			else
+				a.sse_rip(x86_64_assembler::sd, 0x10, reg, constant_pos(one_wide));
+		};
+		auto copy = [&](int reg, int rm) {
+			if (vectorized)
+				a.avx(true, 0x28, reg, 0, rm);
+			else
+				a.sse(x86_64_assembler::ps, 0x28, reg, rm);
+		};
+
+		auto raise = power<T>::get(exponent);
+		if (&power<T>::square == raise)
+			op(0x59, 14, 14);
+		else if (&power<T>::cube == raise)
+		{
+			copy(13, 14);
+			op(0x59, 13, 14);
+			op(0x59, 13, 14);
+			return 13;
+		}
+		else if (&power<T>::reciprocal == raise)
+		{
+			load_one(13);
+			op(0x5E, 13, 14);
+			return 13;
+		}
+		else if (&power<T>::by_squaring == raise) //unrolled
+		{
+			load_one(13);
+			for (auto n = exponent < 0 ? -exponent : exponent; n > 0;)
+			{
+				if (n & 1)
+					op(0x59, 13, 14);
+				if ((n >>= 1) > 0)
+					op(0x59, 14, 14);
+			}
+			if (exponent > 0)
+				return 13;
+
+			load_one(14);
+			op(0x5E, 14, 13);
+		}
+
+		return 14;
+	}
+
+	bool emit_scalar(x86_64_assembler& a, const std::vector<int>& depths) const
+	{
+		typedef x86_64_assembler as;
+		auto& code = prog.get_code();
+		auto p = scalar_prefix();
+
+		//caches (8 bytes each) and their flags live in the native stack
+		size_t caches = 0;
+		for (auto& i : code)
+			if (opcode::store_cache == i.code || opcode::load_cache == i.code)
+				caches = std::max(caches, (size_t) i.arg + 1);
+		auto frame_size = (int) ((9 * caches + 15) / 16 * 16);
+		auto cache_disp = [](int k) {return 8 * k;};
+		auto flag_disp = [=](int k) {return (int) (8 * caches) + k;};
+
+		if (frame_size > 0)
+			a.sub_rsp(frame_size);
+		for (size_t k = 0; k < caches; ++k)
+			a.mov_byte(flag_disp((int) k), 0);
+		a.sse(as::ps, 0x57, 15, 15); //xorps xmm15, xmm15
+
+		std::vector<size_t> addresses(code.size() + 1);
+		std::vector<std::pair<size_t, size_t>> jumps; //position of rel32, target instruction
+		std::vector<size_t> errors; //positions of rel32 which jump to the error handler
+		auto and_one = [&](int reg) {a.sse_rip(as::ps, 0x54, reg, constant_pos(one));};
+		for (size_t pc = 0; pc < code.size(); ++pc)
+		{
+			addresses[pc] = a.size();
+			auto d = depths[pc];
+			if (d < 0) //unreachable
+				continue;
+
+			auto top = d - 1, second = d - 2;
+			auto& i = code[pc];
+			switch (i.code)
+			{
+			case opcode::immediate: a.sse_rip(p, 0x10, d, constant_pos(first_immediate + i.arg)); break;
+			case opcode::load: a.sse(p, 0x10, d, as::rdi, i.arg * (int) sizeof(T)); break;
+			case opcode::power: case opcode::square: case opcode::cube: case opcode::reciprocal:
+			{
+				auto exponent = opcode::power == i.code ? i.arg : opcode::square == i.code ? 2 : opcode::cube == i.code ? 3 : -1;
+				if (0 == exponent)
+				{
+					a.sse_rip(p, 0x10, top, constant_pos(one));
+					break;
+				}
+
+				if (is_double())
+					a.sse(as::ps, 0x28, 14, top);
+				else
+					a.sse(as::ss, 0x5A, 14, top); //cvtss2sd
+				auto re = emit_power(a, exponent, false);
+				if (is_double())
+					a.sse(as::ps, 0x28, top, re);
+				else
+					a.sse(as::sd, 0x5A, top, re); //cvtsd2ss
+				break;
+			}
+			case opcode::negate: a.sse_rip(as::ps, 0x57, top, constant_pos(sign_mask)); break;
+			case opcode::to_not: a.cmp_sse(p, top, 15, 0); and_one(top); break;
+			case opcode::to_bool: a.cmp_sse(p, top, 15, 4); and_one(top); break;
+			case opcode::add: a.sse(p, 0x58, second, top); break;
+			case opcode::sub: a.sse(p, 0x5C, second, top); break;
+			case opcode::multi: a.sse(p, 0x59, second, top); break;
+			case opcode::div:
+				a.ucomi(is_double(), top, 15);
+				a.emit(0x7A); a.emit(6); //jp +6 (NaN is not zero)
+				errors.push_back(a.jcc(as::je));
+				a.sse(p, 0x5E, second, top);
+				break;
+			case opcode::bigger: case opcode::bigger_equal: //b < a, b <= a
+				a.sse(as::ps, 0x28, 14, top);
+				a.cmp_sse(p, 14, second, opcode::bigger == i.code ? 1 : 2);
+				and_one(14);
+				a.sse(as::ps, 0x28, second, 14);
+				break;
+			case opcode::smaller: a.cmp_sse(p, second, top, 1); and_one(second); break;
+			case opcode::smaller_equal: a.cmp_sse(p, second, top, 2); and_one(second); break;
+			case opcode::equal: a.cmp_sse(p, second, top, 0); and_one(second); break;
+			case opcode::not_equal: a.cmp_sse(p, second, top, 4); and_one(second); break;
+			case opcode::jump: jumps.emplace_back(a.jmp(), (size_t) i.arg); break;
+			case opcode::jump_if_zero: case opcode::jump_if_zero_or_pop:
+				a.ucomi(is_double(), top, 15);
+				a.emit(0x7A); a.emit(6); //jp +6
+				jumps.emplace_back(a.jcc(as::je), (size_t) i.arg);
+				break;
+			case opcode::jump_if_not_zero_or_pop:
+				a.ucomi(is_double(), top, 15);
+				jumps.emplace_back(a.jcc(as::jne), (size_t) i.arg);
+				jumps.emplace_back(a.jcc(as::jp), (size_t) i.arg);
+				break;
+			case opcode::load_cache:
+				a.cmp_byte(flag_disp(i.arg), 0);
+				jumps.emplace_back(a.jcc(as::je), pc + 2);
+				a.sse(p, 0x10, d, as::rsp, cache_disp(i.arg));
+				break;
+			case opcode::store_cache:
+				a.sse(p, 0x11, top, as::rsp, cache_disp(i.arg));
+				a.mov_byte(flag_disp(i.arg), 1);
+				break;
+			case opcode::store_output: a.sse(p, 0x11, top, as::rsi, i.arg * (int) sizeof(T)); break;
+			default: return false;
+			}
+		}
+		addresses[code.size()] = a.size();
+
+		if (frame_size > 0)
+			a.add_rsp(frame_size);
+		a.mov_eax(0);
+		a.ret();
+
+		auto error = a.size();
+		if (frame_size > 0)
+			a.add_rsp(frame_size);
+		a.mov_eax(1);
+		a.ret();
+
+		for (auto& j : jumps)
+			a.patch_jump(j.first, addresses[j.second]);
+		for (auto& e : errors)
+			a.patch_jump(e, error);
+		return true;
+	}
+
+	//branch free programs with only one output, all rows are handled with the same instructions.
+	bool emit_batch(x86_64_assembler& a, const std::vector<int>& depths) const
+	{
+		typedef x86_64_assembler as;
+		auto& code = prog.get_code();
+		if (1 != prog.output_size())
+			return false;
+		for (auto& i : code)
+			if (opcode::jump == i.code || opcode::jump_if_zero == i.code || opcode::jump_if_zero_or_pop == i.code ||
+				opcode::jump_if_not_zero_or_pop == i.code || opcode::load_cache == i.code || opcode::store_cache == i.code)
+				return false;
+			//float is raised in double precision, only square gets the same result in single precision
+			else if (!is_double() && (opcode::cube == i.code || opcode::reciprocal == i.code ||
+				(opcode::power == i.code && 0 != i.arg && 1 != i.arg && 2 != i.arg)))
+				return false;
+
+		auto pd = is_double();
+		auto and_one = [&](int reg) {a.avx_rip(pd, 0x54, reg, reg, constant_pos(one));};
+		std::vector<size_t> errors;
+		a.avx(pd, 0x57, 15, 15, 15); //vxorps ymm15, ymm15, ymm15
+		a.emit(0x31); a.emit(0xC9); //xor ecx, ecx
+
+		auto loop = a.size();
+		a.emit(0x48); a.emit(0x8D); a.emit(0x41); a.emit((unsigned char) lanes); //lea rax, [rcx + lanes]
+		a.emit(0x48); a.emit(0x39); a.emit(0xF0); //cmp rax, rsi
+		auto done = a.jcc(as::ja);
+		for (size_t pc = 0; pc < code.size(); ++pc)
+		{
+			auto d = depths[pc], top = d - 1, second = d - 2;
+			auto& i = code[pc];
+			switch (i.code)
+			{
+			case opcode::immediate: a.avx_rip(pd, 0x10, d, 0, constant_pos(first_immediate + i.arg)); break;
+			case opcode::load:
+				a.mov_load(as::rax, as::rdi, i.arg * 8);
+				a.avx_sib(pd, 0x10, d, as::rax, as::rcx, sizeof(T));
+				break;
+			case opcode::power: case opcode::square: case opcode::cube: case opcode::reciprocal:
+			{
+				auto exponent = opcode::power == i.code ? i.arg : opcode::square == i.code ? 2 : opcode::cube == i.code ? 3 : -1;
+				if (0 == exponent)
+					a.avx_rip(pd, 0x10, top, 0, constant_pos(one));
+				else if (1 == exponent)
+					break;
+				else if (!pd) //square only
+					a.avx(false, 0x59, top, top, top);
+				else
+				{
+					a.avx(true, 0x28, 14, 0, top);
+					a.avx(true, 0x28, top, 0, emit_power(a, exponent, true));
+				}
+				break;
+			}
+			case opcode::negate: a.avx_rip(pd, 0x57, top, top, constant_pos(sign_mask)); break;
+			case opcode::to_not: a.cmp_avx(pd, top, top, 15, 0); and_one(top); break;
+			case opcode::to_bool: a.cmp_avx(pd, top, top, 15, 4); and_one(top); break;
+			case opcode::add: a.avx(pd, 0x58, second, second, top); break;
+			case opcode::sub: a.avx(pd, 0x5C, second, second, top); break;
+			case opcode::multi: a.avx(pd, 0x59, second, second, top); break;
+			case opcode::div:
+				a.cmp_avx(pd, 14, top, 15, 0);
+				a.avx(pd, 0x50, as::rax, 0, 14); //vmovmskps eax, ymm14
+				a.emit(0x85); a.emit(0xC0); //test eax, eax
+				errors.push_back(a.jcc(as::jne));
+				a.avx(pd, 0x5E, second, second, top);
+				break;
+			case opcode::bigger: a.cmp_avx(pd, second, top, second, 1); and_one(second); break; //b < a
+			case opcode::bigger_equal: a.cmp_avx(pd, second, top, second, 2); and_one(second); break; //b <= a
+			case opcode::smaller: a.cmp_avx(pd, second, second, top, 1); and_one(second); break;
+			case opcode::smaller_equal: a.cmp_avx(pd, second, second, top, 2); and_one(second); break;
+			case opcode::equal: a.cmp_avx(pd, second, second, top, 0); and_one(second); break;
+			case opcode::not_equal: a.cmp_avx(pd, second, second, top, 4); and_one(second); break;
+			case opcode::store_output: a.avx_sib(pd, 0x11, top, as::rdx, as::rcx, sizeof(T)); break;
+			default: return false;
+			}
+		}
+		a.emit(0x48); a.emit(0x83); a.emit(0xC1); a.emit((unsigned char) lanes); //add rcx, lanes
+		a.patch_jump(a.jmp(), loop);
+
+		a.patch_jump(done, a.size());
+		a.vzeroupper();
+		a.mov_eax(0);
+		a.ret();
+
+		auto error = a.size();
+		a.vzeroupper();
+		a.mov_eax(1);
+		a.ret();
+		for (auto& e : errors)
+			a.patch_jump(e, error);
+		return true;
+	}
+
+private:
+	program<T> prog;
+	function native;
+	batch_function native_batch;
+	void* memory;
+	size_t memory_size;
+};
+template <typename T> const size_t jit<T>::lanes;
+
+} //namespace
+
+#endif /* _QUESTION_EXP_JIT_H_ */
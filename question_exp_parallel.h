@@ -0,0 +1,205 @@
+#ifndef _QUESTION_EXP_PARALLEL_H_
+#define _QUESTION_EXP_PARALLEL_H_
+
+#include "question_exp.h"
+
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+
+namespace qme
+{
+
+//a work-stealing thread pool, each worker (the thread which calls run included) owns a deque of tasks, it takes tasks from the back
+// of its own deque and steals from the front of the others when its own deque is empty.
+//run can only be called by one thread at a time.
+class thread_pool
+{
+public:
+	typedef std::function<void()> task;
+
+	//threads includes the caller of run, so threads - 1 workers will be created.
+	explicit thread_pool(size_t threads = std::thread::hardware_concurrency()) : generation(0), pending(0), stopped(false)
+	{
+		threads = std::max((size_t) 1, threads);
+		for (size_t n = 0; n < threads; ++n)
+			queues.emplace_back(new queue);
+		for (size_t n = 1; n < threads; ++n)
+			workers.emplace_back([this, n]() {this->work(n);});
+	}
+	~thread_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopped = true;
+		}
+		wake_up.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	size_t size() const {return queues.size();}
+
+	//execute all tasks and wait for them, adjacent tasks are given to the same worker, if any task throws an exception,
+	// the first one will be rethrown after all tasks have finished.
+	void run(std::vector<task>& tasks)
+	{
+		if (tasks.empty())
+			return;
+
+		pending = tasks.size();
+		for (size_t n = 0; n < queues.size(); ++n)
+		{
+			std::lock_guard<std::mutex> lock(queues[n]->mutex);
+			for (auto i = n * tasks.size() / queues.size(); i < (n + 1) * tasks.size() / queues.size(); ++i)
+				queues[n]->tasks.push_back(&tasks[i]);
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++generation;
+		}
+		wake_up.notify_all();
+
+		execute(0);
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this]() {return 0 == pending;});
+		if (error)
+		{
+			auto e = error;
+			error = nullptr;
+			std::rethrow_exception(e);
+		}
+	}
+
+private:
+	void work(size_t index)
+	{
+		for (size_t handled_generation = 0;;)
+		{
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake_up.wait(lock, [&]() {return stopped || handled_generation != generation;});
+				if (stopped)
+					return;
+				handled_generation = generation;
+			}
+			execute(index);
+		}
+	}
+
+	void execute(size_t index) //until all deques are empty
+	{
+		for (auto t = take(index); nullptr != t; t = take(index))
+		{
+			try {(*t)();}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!error)
+					error = std::current_exception();
+			}
+
+			if (1 == pending--)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done.notify_all();
+			}
+		}
+	}
+
+	task* take(size_t index)
+	{
+		for (size_t n = 0; n < queues.size(); ++n)
+		{
+			auto& q = *queues[(index + n) % queues.size()];
+			std::lock_guard<std::mutex> lock(q.mutex);
+			if (q.tasks.empty())
+				continue;
+
+			task* t;
+			if (0 == n) //my own deque
+			{
+				t = q.tasks.back();
+				q.tasks.pop_back();
+			}
+			else
+			{
+				t = q.tasks.front();
+				q.tasks.pop_front();
+			}
+			return t;
+		}
+
+		return nullptr;
+	}
+
+private:
+	struct queue {std::mutex mutex; std::deque<task*> tasks;};
+	std::vector<std::unique_ptr<queue>> queues; //index 0 is for the caller of run
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wake_up, done;
+	size_t generation;
+	std::atomic_size_t pending;
+	std::exception_ptr error;
+	bool stopped;
+};
+
+//split rows into chunks of about chunk_rows rows (rounded up to whole blocks, see batch), boundaries of chunks (except the first one)
+// are aligned to cache lines of out, so no cache line of out will be written by more than one thread.
+template <typename O> inline std::vector<std::pair<size_t, size_t>> split_rows(const O* out, size_t rows, size_t chunk_rows, size_t block_size)
+{
+	const size_t cache_line = 64;
+	chunk_rows = std::max((size_t) 1, (chunk_rows + block_size - 1) / block_size) * block_size;
+	auto head = (cache_line - (size_t) ((uintptr_t) out % cache_line)) % cache_line / sizeof(O);
+
+	std::vector<std::pair<size_t, size_t>> chunks; //first and last (exclusive)
+	for (size_t first = 0, last = std::min(rows, head + chunk_rows); first < rows; first = last, last = std::min(rows, last + chunk_rows))
+		chunks.emplace_back(first, last);
+	return chunks;
+}
+
+//execute the expression on many rows with all threads of the pool, see batch_data and batch_judge for parameters, each chunk
+// of rows is executed block by block just like batch_data and outcomes are written in place.
+//compiled expressions are immutable (see qme::exp), so they can be executed by many threads at the same time.
+template <typename T> inline void parallel_batch_data(thread_pool& pool, exp_ctype<T>& exp, const T* const* columns, size_t rows, T* out,
+	size_t chunk_rows = 16 * batch<T>::block_size, simd_isa isa = best_simd_isa())
+{
+	std::vector<thread_pool::task> tasks;
+	for (auto& chunk : split_rows(out, rows, chunk_rows, batch<T>::block_size))
+		tasks.emplace_back([&exp, columns, out, isa, chunk]() {
+			batch<T> b(columns, isa);
+			for (auto first = chunk.first; first < chunk.second; first += batch<T>::block_size)
+			{
+				b.select(first, std::min(batch<T>::block_size, chunk.second - first));
+				exp->data(b, nullptr, std::next(out, first));
+			}
+		});
+	pool.run(tasks);
+}
+
+template <typename T> inline void parallel_batch_judge(thread_pool& pool, exp_ctype<T>& exp, const T* const* columns, size_t rows, bool* out,
+	size_t chunk_rows = 16 * batch<T>::block_size, simd_isa isa = best_simd_isa())
+{
+	std::vector<thread_pool::task> tasks;
+	for (auto& chunk : split_rows(out, rows, chunk_rows, batch<T>::block_size))
+		tasks.emplace_back([&exp, columns, out, isa, chunk]() {
+			batch<T> b(columns, isa);
+			typename batch<T>::buffer re(b);
+			for (auto first = chunk.first; first < chunk.second; first += batch<T>::block_size)
+			{
+				b.select(first, std::min(batch<T>::block_size, chunk.second - first));
+				exp->judge(b, nullptr, re);
+				for (size_t n = 0; n < b.size(); ++n)
+					out[first + n] = 0 != re[n];
+			}
+		});
+	pool.run(tasks);
+}
+
+} //namespace
+
+#endif /* _QUESTION_EXP_PARALLEL_H_ */
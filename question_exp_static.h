@@ -0,0 +1,450 @@
+#ifndef _QUESTION_EXP_STATIC_H_
+#define _QUESTION_EXP_STATIC_H_
+
+#include "question_exp.h"
+
+//compile question mark expressions which are string literals at compile time (with c++11 constexpr and templates), for example:
+// typedef QME_STATIC_EXP(float, "a > 0 ? b : c + 1") rule;
+// auto re = rule::data(values); //values are indexed by slots, slots are assigned in the order of first appearance
+//an expression becomes a type (expression templates), its evaluation is fully inlined, no parsing at runtime, no virtual function
+// calls nor dispatching. the semantics are the same as compiler<T, O0> (which keeps the order of all data, so the results are
+// exactly the same). with QME_STATIC_OPT_EXP(T, O, s), O1 and above fold immediate values at compile time like compiler<T, O1>
+// (see static_optimize), other rewritings of O2 and O3 (exchanging data, merging variables) are not performed.
+//invalid expressions (and divide zero while folding) fail to compile. at most 255 characters are supported.
+namespace qme
+{
+
+template <char... C> struct static_string
+{
+	static constexpr char value[sizeof...(C) + 1] = {C..., '\0'};
+};
+template <char... C> constexpr char static_string<C...>::value[sizeof...(C) + 1];
+
+#define QME_STATIC_CHAR(s, i) ((i) < sizeof(s) ? (s)[(i) < sizeof(s) ? (i) : 0] : '\0')
+#define QME_STATIC_CHARS_16(s, n) \
+	QME_STATIC_CHAR(s, 16 * n + 0), QME_STATIC_CHAR(s, 16 * n + 1), QME_STATIC_CHAR(s, 16 * n + 2), QME_STATIC_CHAR(s, 16 * n + 3), \
+	QME_STATIC_CHAR(s, 16 * n + 4), QME_STATIC_CHAR(s, 16 * n + 5), QME_STATIC_CHAR(s, 16 * n + 6), QME_STATIC_CHAR(s, 16 * n + 7), \
+	QME_STATIC_CHAR(s, 16 * n + 8), QME_STATIC_CHAR(s, 16 * n + 9), QME_STATIC_CHAR(s, 16 * n + 10), QME_STATIC_CHAR(s, 16 * n + 11), \
+	QME_STATIC_CHAR(s, 16 * n + 12), QME_STATIC_CHAR(s, 16 * n + 13), QME_STATIC_CHAR(s, 16 * n + 14), QME_STATIC_CHAR(s, 16 * n + 15)
+#define QME_STATIC_STRING(s) qme::static_string< \
+	QME_STATIC_CHARS_16(s, 0), QME_STATIC_CHARS_16(s, 1), QME_STATIC_CHARS_16(s, 2), QME_STATIC_CHARS_16(s, 3), \
+	QME_STATIC_CHARS_16(s, 4), QME_STATIC_CHARS_16(s, 5), QME_STATIC_CHARS_16(s, 6), QME_STATIC_CHARS_16(s, 7), \
+	QME_STATIC_CHARS_16(s, 8), QME_STATIC_CHARS_16(s, 9), QME_STATIC_CHARS_16(s, 10), QME_STATIC_CHARS_16(s, 11), \
+	QME_STATIC_CHARS_16(s, 12), QME_STATIC_CHARS_16(s, 13), QME_STATIC_CHARS_16(s, 14), QME_STATIC_CHARS_16(s, 15)>
+#define QME_STATIC_EXP(T, s) qme::static_exp<T, QME_STATIC_STRING(s), sizeof(s)>
+#define QME_STATIC_OPT_EXP(T, O, s) qme::static_exp<T, QME_STATIC_STRING(s), sizeof(s), O>
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//constexpr helpers (c++11, one return statement each, so loops are recursions), s is always null terminated.
+constexpr bool static_is_blank(char c) {return ' ' == c || '\t' == c || '\n' == c || '\r' == c;}
+constexpr bool static_is_digit(char c) {return c >= '0' && c <= '9';}
+constexpr int static_hex_digit(char c)
+	{return static_is_digit(c) ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;}
+constexpr bool static_is_key_1(char c)
+{
+	return '!' == c || '(' == c || ')' == c || '>' == c || '<' == c || '?' == c || ':' == c ||
+		'+' == c || '-' == c || '*' == c || '/' == c;
+}
+constexpr bool static_is_key_2(const char* s, int p)
+{
+	return ('>' == s[p] || '<' == s[p] || '=' == s[p] || '!' == s[p]) && '=' == s[p + 1] ?
+		true : ('&' == s[p] || '|' == s[p]) && s[p] == s[p + 1];
+}
+constexpr bool static_is_key(const char* s, int p) {return static_is_key_1(s[p]) || static_is_key_2(s, p);}
+constexpr int static_depth(const char* s, int p, int depth) {return '(' == s[p] ? depth + 1 : ')' == s[p] ? depth - 1 : depth;}
+
+//the n-th non-blank character (blanks are removed just like compiler::remove_blanks)
+constexpr char static_nth_char(const char* s, int p, int n)
+	{return '\0' == s[p] ? '\0' : static_is_blank(s[p]) ? static_nth_char(s, p + 1, n) : 0 == n ? s[p] : static_nth_char(s, p + 1, n - 1);}
+constexpr int static_length(const char* s, int p) {return '\0' == s[p] ? p : static_length(s, p + 1);}
+
+//following find functions return e if nothing was found, only characters out of parentheses are considered.
+constexpr int static_find_question(const char* s, int p, int e, int depth)
+	{return p >= e ? e : 0 == depth && '?' == s[p] ? p : static_find_question(s, p + 1, e, static_depth(s, p, depth));}
+//the colon which matches a question mark, nested question marks need to be skipped
+constexpr int static_find_colon(const char* s, int p, int e, int depth, int nested)
+{
+	return p >= e ? e : 0 == depth && ':' == s[p] ?
+		(0 == nested ? p : static_find_colon(s, p + 1, e, depth, nested - 1)) :
+		static_find_colon(s, p + 1, e, static_depth(s, p, depth), nested + (0 == depth && '?' == s[p] ? 1 : 0));
+}
+//c is '&' or '|'
+constexpr int static_find_logical_operator(const char* s, int p, int e, int depth, char c)
+{
+	return p >= e ? e : 0 == depth && c == s[p] && c == s[p + 1] ?
+		p : static_find_logical_operator(s, p + 1, e, static_depth(s, p, depth), c);
+}
+//0 - not a comparer, 1 or 2 - the length of the comparer
+constexpr int static_comparer_length(const char* s, int p)
+{
+	return ('>' == s[p] || '<' == s[p] || '=' == s[p] || '!' == s[p]) && '=' == s[p + 1] ? 2 : '>' == s[p] || '<' == s[p] ? 1 : 0;
+}
+constexpr int static_find_comparer(const char* s, int p, int e, int depth)
+	{return p >= e ? e : 0 == depth && static_comparer_length(s, p) > 0 ? p : static_find_comparer(s, p + 1, e, static_depth(s, p, depth));}
+//binary + and - (follow a data), the last one
+constexpr int static_find_operator_1(const char* s, int b, int p, int e, int depth, int last)
+{
+	return p >= e ? last : static_find_operator_1(s, b, p + 1, e, static_depth(s, p, depth),
+		0 == depth && p > b && ('+' == s[p] || '-' == s[p]) && (')' == s[p - 1] || !static_is_key_1(s[p - 1])) ? p : last);
+}
+//* and /, the last one
+constexpr int static_find_operator_2(const char* s, int p, int e, int depth, int last)
+{
+	return p >= e ? last :
+		static_find_operator_2(s, p + 1, e, static_depth(s, p, depth), 0 == depth && ('*' == s[p] || '/' == s[p]) ? p : last);
+}
+constexpr int static_find_right_parenthesis(const char* s, int p, int e, int depth)
+{
+	return p >= e ? e : ')' == s[p] && 0 == depth ?
+		p : static_find_right_parenthesis(s, p + 1, e, '(' == s[p] ? depth + 1 : ')' == s[p] ? depth - 1 : depth);
+}
+constexpr int static_find_key(const char* s, int p, int e) {return p >= e ? e : static_is_key(s, p) ? p : static_find_key(s, p + 1, e);}
+
+constexpr operator_type static_to_operator_type(const char* s, int p)
+{
+	return '+' == s[p] ? operator_type::add : '-' == s[p] ? operator_type::sub :
+		'*' == s[p] ? operator_type::multi : '/' == s[p] ? operator_type::div :
+		'&' == s[p] ? operator_type::logical_and : '|' == s[p] ? operator_type::logical_or :
+		'=' == s[p] ? operator_type::equal : '!' == s[p] ? operator_type::not_equal :
+		'>' == s[p] ? ('=' == s[p + 1] ? operator_type::bigger_equal : operator_type::bigger) :
+		'=' == s[p + 1] ? operator_type::smaller_equal : operator_type::smaller;
+}
+
+//immediate values, the same as strtod (decimal, or hexadecimal integer), and strtoll with base 0 for integers (fall back to strtod).
+constexpr int static_skip_digits(const char* s, int p, int e) {return p < e && static_is_digit(s[p]) ? static_skip_digits(s, p + 1, e) : p;}
+constexpr int static_skip_digits(const char* s, int p, int e, int base)
+	{return p < e && static_hex_digit(s[p]) >= 0 && static_hex_digit(s[p]) < base ? static_skip_digits(s, p + 1, e, base) : p;}
+constexpr bool static_is_hex(const char* s, int b, int e) {return b + 2 < e && '0' == s[b] && ('x' == s[b + 1] || 'X' == s[b + 1]);}
+constexpr int static_exponent_end(const char* s, int p, int e)
+	{return p + 1 < e && ('e' == s[p] || 'E' == s[p]) && static_is_digit(s[p + 1]) ? static_skip_digits(s, p + 1, e) : p;}
+constexpr int static_decimal_end(const char* s, int p, int e) //p is the end of the integer part
+	{return static_exponent_end(s, p < e && '.' == s[p] ? static_skip_digits(s, p + 1, e) : p, e);}
+constexpr bool static_is_valid_decimal(const char* s, int b, int e)
+	{return static_is_hex(s, b, e) ? e == static_skip_digits(s, b + 2, e, 16) : e == static_decimal_end(s, static_skip_digits(s, b, e), e);}
+constexpr long double static_pow10(int n) {return n <= 0 ? 1.L : 10.L * static_pow10(n - 1);}
+constexpr double static_exact_pow10(int n) {return n <= 0 ? 1. : 10. * static_exact_pow10(n - 1);} //exact if n <= 22
+//the significand (all digits), the number of fraction digits and the exponent
+constexpr long double static_significand(const char* s, int p, int e, long double re)
+{
+	return p >= e || 'e' == s[p] || 'E' == s[p] ? re :
+		'.' == s[p] ? static_significand(s, p + 1, e, re) : static_significand(s, p + 1, e, re * 10 + (s[p] - '0'));
+}
+constexpr int static_fraction_digits(const char* s, int p, int e, int n, bool fraction)
+{
+	return p >= e || 'e' == s[p] || 'E' == s[p] ? n :
+		static_fraction_digits(s, p + 1, e, fraction ? n + 1 : n, fraction || '.' == s[p]);
+}
+constexpr int static_exponent(const char* s, int p, int e, int re) {return p >= e ? re : static_exponent(s, p + 1, e, re * 10 + (s[p] - '0'));}
+constexpr int static_find_exponent(const char* s, int p, int e)
+	{return p >= e ? e : 'e' == s[p] || 'E' == s[p] ? p + 1 : static_find_exponent(s, p + 1, e);}
+//a power of ten and a significand below 2^53 are exact in double, so one division or multiplication rounds correctly (like strtod)
+constexpr double static_scale(long double significand, int exponent)
+{
+	return significand <= 9007199254740992.L && exponent >= -22 && exponent <= 22 ?
+		(exponent < 0 ? (double) significand / static_exact_pow10(-exponent) : (double) significand * static_exact_pow10(exponent)) :
+		(double) (exponent < 0 ? significand / static_pow10(-exponent) : significand * static_pow10(exponent));
+}
+constexpr long double static_integer(const char* s, int p, int e, int base, long double re)
+	{return p >= e ? re : static_integer(s, p + 1, e, base, re * base + static_hex_digit(s[p]));}
+constexpr double static_to_double(const char* s, int b, int e)
+{
+	return static_is_hex(s, b, e) ? (double) static_integer(s, b + 2, e, 16, 0) :
+		static_scale(static_significand(s, b, e, 0), static_exponent(s, static_find_exponent(s, b, e), e, 0) -
+			static_fraction_digits(s, b, e, 0, false));
+}
+constexpr int static_integer_base(const char* s, int b, int e) {return static_is_hex(s, b, e) ? 16 : '0' == s[b] && b + 1 < e ? 8 : 10;}
+constexpr int static_integer_begin(const char* s, int b, int e) {return static_is_hex(s, b, e) ? b + 2 : b;}
+constexpr bool static_is_valid_integer(const char* s, int b, int e)
+	{return e == static_skip_digits(s, static_integer_begin(s, b, e), e, static_integer_base(s, b, e));}
+template <typename T> constexpr T static_to_immediate(const char* s, int b, int e)
+{
+	return std::is_floating_point<T>::value || !static_is_valid_integer(s, b, e) ? (T) static_to_double(s, b, e) :
+		(T) static_integer(s, static_integer_begin(s, b, e), e, static_integer_base(s, b, e), 0);
+}
+
+//variables, slots are assigned in the order of first appearance.
+constexpr int static_variable_end(const char* s, int p) {return '\0' == s[p] || static_is_key(s, p) ? p : static_variable_end(s, p + 1);}
+constexpr int static_token_end(const char* s, int p)
+	{return '\0' == s[p] ? p : static_is_key_2(s, p) ? p + 2 : static_is_key_1(s[p]) ? p + 1 : static_variable_end(s, p);}
+constexpr bool static_is_variable(const char* s, int p) {return '\0' != s[p] && !static_is_key(s, p) && !static_is_digit(s[p]);}
+constexpr bool static_equal(const char* s, int p1, int e1, int p2, int e2)
+	{return e1 - p1 != e2 - p2 ? false : p1 >= e1 ? true : s[p1] == s[p2] && static_equal(s, p1 + 1, e1, p2 + 1, e2);}
+//whether the variable [b, e) appears in the tokens before the token at e
+constexpr bool static_appears(const char* s, int p, int b, int e)
+{
+	return p >= b ? false : static_is_variable(s, p) && static_equal(s, p, static_token_end(s, p), b, e) ?
+		true : static_appears(s, static_token_end(s, p), b, e);
+}
+//count the variables which appear for the first time until [b, e) appears
+constexpr int static_slot(const char* s, int p, int b, int e, int slot)
+{
+	return '\0' == s[p] ? slot : static_is_variable(s, p) && static_equal(s, p, static_token_end(s, p), b, e) ? slot :
+		static_slot(s, static_token_end(s, p), b, e,
+			static_is_variable(s, p) && !static_appears(s, 0, p, static_token_end(s, p)) ? slot + 1 : slot);
+}
+constexpr int static_variable_count(const char* s, int p, int count)
+{
+	return '\0' == s[p] ? count : static_variable_count(s, static_token_end(s, p),
+		static_is_variable(s, p) && !static_appears(s, 0, p, static_token_end(s, p)) ? count + 1 : count);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//expressions, V is the source of variables, either values indexed by slots or a callback which accepts variable names.
+template <typename T, typename S> struct static_fetcher
+{
+	static const std::vector<std::string>& variable_names()
+	{
+		static const std::vector<std::string> names = []() {
+			std::vector<std::string> re;
+			auto s = S::value;
+			for (int p = 0; '\0' != s[p]; p = static_token_end(s, p))
+				if (static_is_variable(s, p) && !static_appears(s, 0, p, static_token_end(s, p)))
+					re.push_back(std::string(s + p, s + static_token_end(s, p)));
+			return re;
+		}();
+		return names;
+	}
+
+	static T fetch(const T* values, size_t slot) {return values[slot];}
+	template <typename F, typename = typename std::enable_if<!std::is_pointer<F>::value>::type>
+	static T fetch(const F& cb, size_t slot) {return cb(variable_names()[slot]);}
+};
+
+template <typename T> struct static_invalid_exp
+{
+	static constexpr bool valid = false, immediate = false;
+	template <typename V> static T data(const V&) {return 0;}
+};
+
+template <typename T, typename S, int B, int E> struct static_immediate_exp
+{
+	static constexpr bool valid = static_is_valid_decimal(S::value, B, E) || static_is_valid_integer(S::value, B, E), immediate = true;
+	static constexpr T value = static_to_immediate<T>(S::value, B, E);
+	template <typename V> static T data(const V&) {return value;}
+};
+
+template <typename T, typename S, int Slot> struct static_variable_exp
+{
+	static constexpr bool valid = true, immediate = false;
+	template <typename V> static T data(const V& v) {return static_fetcher<T, S>::fetch(v, Slot);}
+};
+
+template <typename T, char Op, typename X> struct static_unitary_exp
+{
+	static constexpr bool valid = X::valid, immediate = false;
+	template <typename V> static T data(const V& v)
+	{
+		auto re = X::data(v);
+		return '-' == Op ? negate(re) : '!' == Op ? (T) to_not(re) : re;
+	}
+};
+
+template <typename T, operator_type Op, typename L, typename R> struct static_binary_exp
+{
+	typedef L left_type;
+	typedef R right_type;
+	static constexpr bool valid = L::valid && R::valid, immediate = false;
+	template <typename V> static T data(const V& v)
+	{
+		if (operator_type::logical_and == Op)
+			return (T) (0 != L::data(v) && 0 != R::data(v));
+		else if (operator_type::logical_or == Op)
+			return (T) (0 != L::data(v) || 0 != R::data(v));
+
+		auto re = L::data(v);
+		if (is_comparer(Op))
+			compare(re, Op, R::data(v));
+		else
+			calculate(re, Op, R::data(v));
+		return re;
+	}
+};
+
+template <typename T, typename C, typename L, typename R> struct static_question_exp
+{
+	static constexpr bool valid = C::valid && L::valid && R::valid, immediate = false;
+	template <typename V> static T data(const V& v) {return 0 != C::data(v) ? L::data(v) : R::data(v);}
+};
+
+//immediate values folded at compile time (O1 and above), L and R are immediate values too.
+constexpr bool static_is_calculator(operator_type op)
+	{return operator_type::add == op || operator_type::sub == op || operator_type::multi == op || operator_type::div == op;}
+template <typename T> constexpr T static_calculate(operator_type op, T l, T r)
+{
+	return operator_type::add == op ? (T) (l + r) : operator_type::sub == op ? (T) (l - r) :
+		operator_type::multi == op ? (T) (l * r) : 0 == r ? (T) 0 : (T) (l / r);
+}
+
+template <typename T, operator_type Op, typename L, typename R> struct static_folded_exp
+{
+	static constexpr bool valid = L::valid && R::valid && (operator_type::div != Op || 0 != R::value), immediate = true; //divide zero
+	static constexpr T value = static_calculate<T>(Op, L::value, R::value);
+	template <typename V> static T data(const V&) {return value;}
+};
+
+template <typename T, typename X> struct static_negative_exp
+{
+	static constexpr bool valid = X::valid, immediate = true;
+	static constexpr T value = (T) -X::value;
+	template <typename V> static T data(const V&) {return value;}
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//parsers, one for each priority, [B, E) is the range of the expression. the selected parser is instantiated only (lazy).
+template <typename X> struct static_identity {typedef X type;};
+template <typename T, typename S, int B, int E> struct static_parse_question;
+
+template <typename T, typename S, int B, int E> struct static_parse_primary
+{
+	static constexpr int r = '(' == S::value[B] ? static_find_right_parenthesis(S::value, B + 1, E, 0) : E;
+	typedef typename std::conditional<'(' == S::value[B],
+		typename std::conditional<E - 1 == r && B + 1 < r, static_parse_question<T, S, B + 1, E - 1>, static_identity<static_invalid_exp<T>>>::type,
+		typename std::conditional<E != static_find_key(S::value, B, E), static_identity<static_invalid_exp<T>>,
+			typename std::conditional<static_is_digit(S::value[B]), static_identity<static_immediate_exp<T, S, B, E>>,
+				static_identity<static_variable_exp<T, S, static_slot(S::value, 0, B, E, 0)>>>::type>::type>::type::type type;
+};
+
+template <typename T, typename S, int B, int E> struct static_parse_unitary
+{
+	template <typename X> struct make {typedef static_unitary_exp<T, S::value[B], typename X::type> type;};
+
+	static constexpr char c = S::value[B];
+	static constexpr bool is_unitary = ('!' == c && '=' != S::value[B + 1]) || '+' == c || '-' == c;
+	typedef typename std::conditional<B >= E, static_identity<static_invalid_exp<T>>,
+		typename std::conditional<!is_unitary, static_parse_primary<T, S, B, E>,
+			typename std::conditional<'!' != c && c == S::value[B + 1], static_identity<static_invalid_exp<T>>, //redundant + or -
+				make<static_parse_unitary<T, S, B + 1, E>>>::type>::type>::type::type type;
+};
+
+//L and R are parsers of the left and right operands, P is the position of the operator
+template <typename T, typename S, int P, typename L, typename R> struct static_make_binary
+	{typedef static_binary_exp<T, static_to_operator_type(S::value, P), typename L::type, typename R::type> type;};
+
+template <typename T, typename S, int B, int E> struct static_parse_multiplicative
+{
+	static constexpr int p = static_find_operator_2(S::value, B, E, 0, E);
+	typedef typename std::conditional<E == p, static_parse_unitary<T, S, B, E>,
+		static_make_binary<T, S, p, static_parse_multiplicative<T, S, B, p>, static_parse_unitary<T, S, p + 1, E>>>::type::type type;
+};
+
+template <typename T, typename S, int B, int E> struct static_parse_additive
+{
+	static constexpr int p = static_find_operator_1(S::value, B, B, E, 0, E);
+	typedef typename std::conditional<E == p, static_parse_multiplicative<T, S, B, E>,
+		static_make_binary<T, S, p, static_parse_additive<T, S, B, p>, static_parse_multiplicative<T, S, p + 1, E>>>::type::type type;
+};
+
+template <typename T, typename S, int B, int E> struct static_parse_comparison
+{
+	static constexpr int p = static_find_comparer(S::value, B, E, 0);
+	static constexpr int r = E == p ? E : p + static_comparer_length(S::value, p);
+	typedef typename std::conditional<E == p, static_parse_additive<T, S, B, E>,
+		typename std::conditional<E != static_find_comparer(S::value, r, E, 0), static_identity<static_invalid_exp<T>>, //redundant comparer
+			static_make_binary<T, S, p, static_parse_additive<T, S, B, p>, static_parse_additive<T, S, r, E>>>::type>::type::type type;
+};
+
+//&& has higher priority than || (just like c++), since they return 0 or 1 only, the associativity doesn't matter.
+template <typename T, typename S, int B, int E> struct static_parse_logical_and
+{
+	static constexpr int p = static_find_logical_operator(S::value, B, E, 0, '&');
+	typedef typename std::conditional<E == p, static_parse_comparison<T, S, B, E>,
+		static_make_binary<T, S, p, static_parse_comparison<T, S, B, p>, static_parse_logical_and<T, S, p + 2, E>>>::type::type type;
+};
+
+template <typename T, typename S, int B, int E> struct static_parse_logical_or
+{
+	static constexpr int p = static_find_logical_operator(S::value, B, E, 0, '|');
+	typedef typename std::conditional<E == p, static_parse_logical_and<T, S, B, E>,
+		static_make_binary<T, S, p, static_parse_logical_and<T, S, B, p>, static_parse_logical_or<T, S, p + 2, E>>>::type::type type;
+};
+
+template <typename T, typename S, int B, int Q, int C, int E> struct static_make_question
+{
+	typedef static_question_exp<T, typename static_parse_logical_or<T, S, B, Q>::type,
+		typename static_parse_question<T, S, Q + 1, C>::type, typename static_parse_question<T, S, C + 1, E>::type> type;
+};
+
+template <typename T, typename S, int B, int E> struct static_parse_question
+{
+	static constexpr int q = static_find_question(S::value, B, E, 0);
+	static constexpr int c = E == q ? E : static_find_colon(S::value, q + 1, E, 0, 0);
+	typedef typename std::conditional<B >= E, static_identity<static_invalid_exp<T>>,
+		typename std::conditional<E == q, static_parse_logical_or<T, S, B, E>,
+			typename std::conditional<E == c, static_identity<static_invalid_exp<T>>,
+				static_make_question<T, S, B, q, c, E>>::type>::type>::type::type type;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+//optimizers, Level is O::level(), expressions are optimized from bottom to top. for O1 and above (like compiler<T, O1>):
+// '1 + 2 * 3' -> '7', '-(1 + 2)' -> '-3', 'a + 1 - 2' -> 'a + -1', 'a - 1 - 2' -> 'a - 3', 'a * 2 * 3' -> 'a * 6'
+template <int Level, typename X> struct static_optimize {typedef X type;};
+
+//+ and - are of the same level, * is only of the same level as itself (just like is_same_operator_level with O1 and O2).
+constexpr bool static_is_same_level(operator_type op_1, operator_type op_2)
+{
+	return ((operator_type::add == op_1 || operator_type::sub == op_1) && (operator_type::add == op_2 || operator_type::sub == op_2)) ||
+		(operator_type::multi == op_1 && operator_type::multi == op_2);
+}
+//'X op_1 C1 op C2' -> 'X op_1 (C1 op_2 C2)'
+constexpr operator_type static_merged_operator(operator_type op_1, operator_type op)
+	{return operator_type::sub != op_1 ? op : operator_type::add == op ? operator_type::sub : operator_type::add;}
+
+template <typename T, int Level, operator_type Op, typename L, typename R, typename = void> struct static_fold
+	{typedef static_binary_exp<T, Op, L, R> type;};
+template <typename T, int Level, operator_type Op, typename L, typename R>
+struct static_fold<T, Level, Op, L, R, typename std::enable_if<(Level > 0) && static_is_calculator(Op) && L::immediate && R::immediate>::type>
+	{typedef static_folded_exp<T, Op, L, R> type;};
+template <typename T, int Level, operator_type Op, operator_type Op_1, typename X, typename C, typename R>
+struct static_fold<T, Level, Op, static_binary_exp<T, Op_1, X, C>, R,
+	typename std::enable_if<(Level > 0) && static_is_same_level(Op_1, Op) && C::immediate && R::immediate>::type>
+	{typedef static_binary_exp<T, Op_1, X, static_folded_exp<T, static_merged_operator(Op_1, Op), C, R>> type;};
+
+template <int Level, typename T, operator_type Op, typename L, typename R> struct static_optimize<Level, static_binary_exp<T, Op, L, R>>
+	{typedef typename static_fold<T, Level, Op, typename static_optimize<Level, L>::type, typename static_optimize<Level, R>::type>::type type;};
+
+template <int Level, typename T, char Op, typename X> struct static_optimize<Level, static_unitary_exp<T, Op, X>>
+{
+	typedef typename static_optimize<Level, X>::type x;
+	typedef typename std::conditional<(Level > 0) && '-' == Op && x::immediate, static_negative_exp<T, x>,
+		typename std::conditional<(Level > 0) && '+' == Op, x, static_unitary_exp<T, Op, x>>::type>::type type;
+};
+
+template <int Level, typename T, typename C, typename L, typename R> struct static_optimize<Level, static_question_exp<T, C, L, R>>
+{
+	typedef static_question_exp<T, typename static_optimize<Level, C>::type,
+		typename static_optimize<Level, L>::type, typename static_optimize<Level, R>::type> type;
+};
+
+/////////////////////////////////////////////////////////////////////////////////////////
+template <size_t... I> struct static_index_list {};
+template <size_t N, size_t... I> struct static_indexes : static_indexes<N - 1, N - 1, I...> {};
+template <size_t... I> struct static_indexes<0, I...> {typedef static_index_list<I...> type;};
+template <typename S, typename I> struct static_strip;
+template <typename S, size_t... I> struct static_strip<S, static_index_list<I...>>
+	{typedef static_string<static_nth_char(S::value, 0, (int) I)...> type;};
+
+//the question mark expression, N is the size of the literal (including '\0'), O is the optimization level (see static_optimize).
+template <typename T, typename S, size_t N, typename O = O0> class static_exp
+{
+	static_assert(N <= 256, "the question mark expression is too long, at most 255 characters are supported!");
+
+public:
+	typedef typename static_strip<S, typename static_indexes<N>::type>::type string;
+	typedef typename static_optimize<O::level(),
+		typename static_parse_question<T, string, 0, static_length(string::value, 0)>::type>::type type;
+	static_assert(type::valid, "invalid question mark expression!");
+
+	static constexpr size_t variable_count = (size_t) static_variable_count(string::value, 0, 0);
+	static const std::vector<std::string>& variable_names() {return static_fetcher<T, string>::variable_names();} //indexed by slots
+
+	static inline T data(const T* values) {return type::data(values);} //values are indexed by slots
+	template <typename F, typename = typename std::enable_if<!std::is_pointer<F>::value>::type>
+	static inline T data(const F& cb) {return type::data(cb);} //cb accepts variable names
+	static inline bool judge(const T* values) {return 0 != data(values);}
+	template <typename F, typename = typename std::enable_if<!std::is_pointer<F>::value>::type>
+	static inline bool judge(const F& cb) {return 0 != data(cb);}
+};
+
+} //namespace
+
+#endif /* _QUESTION_EXP_STATIC_H_ */
@@ -0,0 +1,59 @@
+#include "question_exp.h"
+#include <sstream>
+#include "sample_rules.h" //generated by qme_gen from sample_rules.txt
+
+//verify the generated functions against the interpreter on sample inputs
+int main(int argc, const char* argv[])
+{
+	typedef sample_rules::value_type D;
+	const D samples[] = {-100, -3, -1, -.5f, 0, .5f, 1, 3, 100};
+	const size_t sample_num = sizeof(samples) / sizeof(D);
+
+	auto match = 0, total = 0;
+	for (size_t n = 0; n < sample_rules::rule_count; ++n)
+	{
+		qme::symbol_table symbols; //use the same slots as the generated functions
+		for (size_t slot = 0; slot < sample_rules::variable_count; ++slot)
+			symbols.insert(sample_rules::variable_names[slot]);
+		auto exp = qme::compiler<D>::compile(sample_rules::statements[n], symbols);
+		if (!exp)
+		{
+			std::cout << " UT failed, cannot compile " << sample_rules::statements[n] << std::endl;
+			continue;
+		}
+
+		//all combinations of the samples
+		std::vector<D> values(sample_rules::variable_count);
+		size_t combinations = 1;
+		for (size_t slot = 0; slot < values.size(); ++slot)
+			combinations *= sample_num;
+		for (size_t c = 0; c < combinations; ++c)
+		{
+			for (size_t slot = 0, i = c; slot < values.size(); ++slot, i /= sample_num)
+				values[slot] = samples[i % sample_num];
+
+			std::ostringstream re_1, re_2; //results (all digits) or exceptions
+			re_1.precision(17);
+			re_2.precision(17);
+			try {re_1 << (*exp)(values.data());} catch (const char* e) {re_1 << e;}
+			try {re_2 << sample_rules::functions[n](values.data());} catch (const char* e) {re_2 << e;}
+			++total;
+			if (re_1.str() == re_2.str())
+				++match;
+			else
+				std::cout << " UT failed, " << sample_rules::rule_names[n] << " returns \033[31m" << re_2.str() << "\033[0m, expected result: \033[32m"
+					<< re_1.str() << "\033[0m" << std::endl;
+		}
+	}
+
+	sample_rules::record r {3, -1, .5f};
+	auto struct_match = sample_rules::risk(r) == 100 && sample_rules::shared(r) == 5;
+	if (!struct_match)
+		std::cout << " UT failed, the struct-field signature returns different results" << std::endl;
+
+	std::cout << "summary:" << std::endl
+		<< " total rules: " << sample_rules::rule_count << std::endl
+		<< " successfully matched: " << match << '/' << total << std::endl;
+
+	return match == total && struct_match ? 0 : 1;
+}
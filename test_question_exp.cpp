@@ -1,7 +1,11 @@
 
-#include "question_exp.h"
+#include "question_exp_jit.h"
+#include "question_exp_static.h"
+#include "question_exp_parallel.h"
+#include "question_exp_image.h"
 
 #include <chrono>
+#include <random>
 class cpu_timer //a substitute of boost::timer::cpu_timer
 {
 public:
@@ -27,27 +31,203 @@ template <typename T = float> struct ut_input_and_expectation
 	T exp_1, exp_2;
 };
 
-template<typename T> void execute_qme(cpu_timer& timer, qme::exp_ctype<T>& exp,
-	const std::function<T(const std::string&)>& cb, T exp_re, int& exec_succ, int& match)
+template<typename T, typename V> std::vector<T> to_values(const qme::symbol_table& symbols, const std::map<std::string, V>& dm)
+{
+	std::vector<T> values;
+	for (auto& variable_name : symbols.names())
+	{
+		auto iter = dm.find(variable_name);
+		values.push_back(iter == std::end(dm) ? T() : (T) iter->second); //undefined symbols will not be fetched
+	}
+	return values;
+}
+
+//execute the expression with qme::fetch_once, each variable must be fetched at most once.
+template<typename T> bool execute_once(qme::exp_ctype<T>& exp, const std::function<T(const std::string&)>& cb, size_t variable_num, T re)
+{
+	size_t fetched = 0;
+	auto counted_cb = [&](const std::string& variable_name) {++fetched; return cb(variable_name);};
+	if ((*exp)(qme::fetch_once<T>(counted_cb)) != re || fetched > variable_num)
+		return false;
+
+	fetched = 0;
+	return qme::safe_data(exp, qme::fetch_once<T>(counted_cb)).first == re && fetched <= variable_num;
+}
+
+//execute the expression twice with one qme::eval_context, it must get the same results as the recursive execution.
+template<typename T> bool execute_safely(qme::exp_ctype<T>& exp, const std::vector<T>& values, T re)
+{
+	qme::eval_context<T> context(exp);
+	return qme::safe_data(exp, values.data(), context).first == re && qme::safe_judge(exp, values.data(), context).first == (0 != re);
+}
+
+template<typename T> T execute_qme(cpu_timer& timer, qme::exp_ctype<T>& exp, const qme::program<T>& prog,
+	const std::function<T(const std::string&)>& cb, const std::vector<T>& values, T exp_re, int& exec_succ, int& match)
 {
 	timer.restart();
 	auto re = (*exp)(cb); //to calculate 'exp' as a judgement, use 'exp->judge(cb)'
-	//since recursion is used during the whole compilation and execution, if your expression is too complicated to
-	// be compiled and executed (stack overflow), use
-	// qme::O0/qme::O1 to compile it,
-	// qme::safe_data/qme::safe_judge to execute it and
-	// qme::safe_delete to delete it,
-	// then recursion will be eliminated.
+	//since recursion is used during the execution, if your expression is too complicated to be executed (stack overflow),
+	// use qme::safe_data/qme::safe_judge to execute it, then recursion will be eliminated.
 	//auto re = qme::safe_data(exp, cb).first;
 	printf("spent %f seconds.\n", timer.elapsed());
 	++exec_succ;
-	if (re == exp_re)
+	auto slot_re = (*exp)(values.data()); //execute with slot-indexed values
+	auto prog_re = prog(values.data()); //execute the lowered program
+	if (slot_re != re)
+		std::cout << " UT failed, slot-indexed execution returns: \033[31m" << slot_re << "\033[0m" << std::endl;
+	else if (prog_re != re || prog(cb) != re)
+		std::cout << " UT failed, the lowered program returns: \033[31m" << prog_re << "\033[0m" << std::endl;
+	else if (!execute_once(exp, cb, values.size(), re))
+		std::cout << " UT failed, variables are fetched more than once" << std::endl;
+	else if (!execute_safely(exp, values, re))
+		std::cout << " UT failed, the safe execution returns different result" << std::endl;
+	else if (re == exp_re)
 	{
 		++match;
 		std::cout << ' ' << re << std::endl;
 	}
 	else
 		std::cout << " UT failed, expected result: \033[31m" << exp_re << "\033[0m, actual result: \033[32m" << re << "\033[0m" << std::endl;
+
+	return re;
+}
+
+//rows of values_1 and values_2 alternately, stored by columns (one column per slot), pointers refer to data (they're still
+// valid after the columns are moved).
+template<typename T> struct columns_of_rows {std::vector<T> data; std::vector<const T*> pointers;};
+template<typename T> columns_of_rows<T> make_columns(const std::vector<T>& values_1, const std::vector<T>& values_2, size_t rows)
+{
+	columns_of_rows<T> columns;
+	for (size_t i = 0; i < values_1.size(); ++i)
+		for (size_t r = 0; r < rows; ++r)
+			columns.data.push_back(r % 2 ? values_2[i] : values_1[i]);
+	for (size_t i = 0; i < values_1.size(); ++i)
+		columns.pointers.push_back(std::next(columns.data.data(), rows * i));
+	return columns;
+}
+
+//execute the expression on many rows (values_1 and values_2 alternately) at once with every SIMD instruction set the CPU supports,
+// they must get the same results as the one by one execution. the number of rows is not a multiple of any vector width.
+template<typename T> void execute_qme_in_batch(qme::exp_ctype<T>& exp,
+	const std::vector<T>& values_1, const std::vector<T>& values_2, T re_1, T re_2, int& match)
+{
+	const size_t rows = qme::batch<T>::block_size + 37;
+	auto columns = make_columns(values_1, values_2, rows);
+
+	const qme::simd_isa isas[] = {qme::simd_isa::scalar, qme::simd_isa::sse2, qme::simd_isa::avx2, qme::simd_isa::avx512};
+	for (auto isa : isas)
+		if (isa <= qme::best_simd_isa())
+		{
+			std::vector<T> re(rows);
+			std::unique_ptr<bool[]> judgments(new bool[rows]);
+			qme::batch_data(exp, columns.pointers.data(), rows, re.data(), isa);
+			qme::batch_judge(exp, columns.pointers.data(), rows, judgments.get(), isa);
+			auto ok = true;
+			for (size_t r = 0; r < rows; ++r)
+				ok = ok && re[r] == (r % 2 ? re_2 : re_1) && judgments[r] == (0 != re[r]);
+
+			if (!ok)
+			{
+				std::cout << " UT failed, batch execution returns: \033[31m" << re[0] << ", " << re[1] << "\033[0m with SIMD instruction set "
+					<< (int) isa << std::endl;
+				return;
+			}
+		}
+
+	++match;
+}
+
+//execute the expression on many rows (values_1 and values_2 alternately) with all threads of the pool, they must get the same
+// results as the one by one execution.
+template<typename T> void execute_qme_in_parallel(qme::thread_pool& pool, qme::exp_ctype<T>& exp,
+	const std::vector<T>& values_1, const std::vector<T>& values_2, T re_1, T re_2, int& match)
+{
+	const size_t rows = 10000;
+	auto columns = make_columns(values_1, values_2, rows);
+
+	std::vector<T> re(rows);
+	std::unique_ptr<bool[]> judgments(new bool[rows]);
+	qme::parallel_batch_data(pool, exp, columns.pointers.data(), rows, re.data(), 512);
+	qme::parallel_batch_judge(pool, exp, columns.pointers.data(), rows, judgments.get(), 512);
+	auto ok = true;
+	for (size_t r = 0; r < rows; ++r)
+		ok = ok && re[r] == (r % 2 ? re_2 : re_1) && judgments[r] == (0 != re[r]);
+
+	if (ok)
+		++match;
+	else
+		std::cout << " UT failed, parallel execution returns different results" << std::endl;
+}
+
+//execute the program with native code, one by one and in batch (16 rows, values_1 and values_2 alternately),
+// they must get the same results as the interpreter (programs which can't be compiled fall back to the interpreter).
+template<typename T> void execute_qme_with_jit(const qme::program<T>& prog,
+	const std::vector<T>& values_1, const std::vector<T>& values_2, T re_1, T re_2, int& match, int& native)
+{
+	const size_t rows = 16;
+	qme::jit<T> j(prog);
+	auto columns = make_columns(values_1, values_2, rows);
+
+	std::vector<T> re(rows);
+	j.batch_data(columns.pointers.data(), rows, re.data());
+	auto batch_ok = true;
+	for (size_t r = 0; r < rows; ++r)
+		batch_ok = batch_ok && re[r] == (r % 2 ? re_2 : re_1);
+
+	if (j(values_1.data()) != re_1 || j(values_2.data()) != re_2)
+		std::cout << " UT failed, jit returns: \033[31m" << j(values_1.data()) << ", " << j(values_2.data()) << "\033[0m" << std::endl;
+	else if (!batch_ok)
+		std::cout << " UT failed, jit returns different results in batch" << std::endl;
+	else
+	{
+		++match;
+		if (j.is_native())
+			++native;
+	}
+}
+
+//an expression compiled at compile time (E) must get the same results as the one compiled by compiler<T, O>.
+template<typename E, typename T, typename O = qme::O0> void execute_static_qme(const char* statement,
+	const std::function<T(const std::string&)>& cb_1, const std::function<T(const std::string&)>& cb_2, int& match)
+{
+	auto exp = qme::compiler<T, O>::compile(statement);
+	auto to_string = [](const std::function<T()>& f) {
+		try {return std::to_string(f());}
+		catch (const char* e) {return std::string(e);}
+	};
+	auto re_1 = to_string([&]() {return (*exp)(cb_1);}), re_2 = to_string([&]() {return (*exp)(cb_2);});
+	if (re_1 == to_string([&]() {return E::data(cb_1);}) && re_2 == to_string([&]() {return E::data(cb_2);}))
+		++match;
+	else
+		std::cout << " UT failed, the expression compiled at compile time returns different results: " << statement << std::endl;
+}
+
+//a random statement of variables a ~ d and small immediate values, leaves like '2 * a * a' are merged into one variable with
+// a multiplier and an exponent by O3.
+std::string random_statement(std::mt19937& gen, int depth)
+{
+	static const char* leaves[] = {"a", "b", "c", "d", "0", "0.5", "1", "2", "10", "(2 * a * a)", "(3 * b)", "(-c * c / 2)", "(d / 4)"};
+	static const char* binary_operators[] = {" + ", " - ", " * ", " / ", " > ", " >= ", " < ", " == ", " != ", " && ", " || "};
+	auto pick = [&](size_t n) {return std::uniform_int_distribution<size_t>(0, n - 1)(gen);};
+	if (depth <= 0 || 0 == pick(5))
+		return leaves[pick(sizeof(leaves) / sizeof(leaves[0]))];
+
+	std::string statement = "(";
+	switch (pick(5))
+	{
+	case 0:
+		statement += random_statement(gen, depth - 1) + " ? ";
+		statement += random_statement(gen, depth - 1) + " : ";
+		statement += random_statement(gen, depth - 1);
+		break;
+	case 1: statement += (pick(2) ? "!" : "-") + random_statement(gen, depth - 1); break;
+	default:
+		statement += random_statement(gen, depth - 1);
+		statement += binary_operators[pick(sizeof(binary_operators) / sizeof(binary_operators[0]))];
+		statement += random_statement(gen, depth - 1);
+		break;
+	}
+	return statement + ')';
 }
 
 int main(int argc, const char* argv[])
@@ -265,57 +445,576 @@ int main(int argc, const char* argv[])
 	auto cb_2 = [&](const std::string& variable_name) {return cb(dm_2, variable_name);};
 
 	cpu_timer timer;
-	auto compile_succ = 0, exec_succ = 0, match = 0;
+	auto compile_succ = 0, exec_succ = 0, match = 0, batch_match = 0, parallel_match = 0, jit_match = 0, jit_native = 0;
+	qme::thread_pool pool(4);
+#if 0
+	typedef int D;
+	//typedef qme::O0 O; //for integer (1 ~ 8 bytes), optimization level 0 is OK
+	//typedef qme::O1 O; //for integer (1 ~ 8 bytes), optimization level 1 is OK
+	typedef qme::O2 O; //for integer (1 ~ 8 bytes), optimization level 2 is OK and suggested
+	//typedef qme::O3 O; //for integer (1 ~ 8 bytes), do not use optimization level 3
+#else
+	typedef float D;
+	//typedef qme::O0 O; //for float (4 ~ 8 bytes), any optimization level is OK
+	//typedef qme::O1 O; //for float (4 ~ 8 bytes), any optimization level is OK
+	//typedef qme::O2 O; //for float (4 ~ 8 bytes), any optimization level is OK
+	typedef qme::O3 O; //for float (4 ~ 8 bytes), the default and suggested optimization level is 3
+#endif
+	std::vector<std::string> statements; //successfully executed ones, they will be evaluated together by a rule set
+	std::vector<D> results_1, results_2;
 	for (size_t i = 0; i < sizeof(inputs) / sizeof(ut_input_and_expectation<>); ++i)
 	{
 		printf("compile the question mark expression: %s\n", inputs[i].input);
 		timer.restart();
-#if 0
-		typedef int D;
-		//typedef qme::O0 O; //for integer (1 ~ 8 bytes), optimization level 0 is OK
-		//typedef qme::O1 O; //for integer (1 ~ 8 bytes), optimization level 1 is OK
-		typedef qme::O2 O; //for integer (1 ~ 8 bytes), optimization level 2 is OK and suggested
-		//typedef qme::O3 O; //for integer (1 ~ 8 bytes), do not use optimization level 3
-#else
-		typedef float D;
-		//typedef qme::O0 O; //for float (4 ~ 8 bytes), any optimization level is OK
-		//typedef qme::O1 O; //for float (4 ~ 8 bytes), any optimization level is OK
-		//typedef qme::O2 O; //for float (4 ~ 8 bytes), any optimization level is OK
-		typedef qme::O3 O; //for float (4 ~ 8 bytes), the default and suggested optimization level is 3
-#endif
-		auto exp = qme::compiler<D, O>::compile(inputs[i].input);
+		qme::symbol_table symbols;
+		auto exp = qme::compiler<D, O>::compile(inputs[i].input, symbols);
 		printf("spent %f seconds.\n", timer.elapsed());
 		if (exp)
 		{
 			++compile_succ;
 			try
 			{
+				qme::program<D> prog(exp);
+				auto values_1 = to_values<D>(symbols, dm_1), values_2 = to_values<D>(symbols, dm_2);
 				puts("perform the question mark expression:");
-				execute_qme<D>(timer, exp, cb_1, inputs[i].exp_1, exec_succ, match);
+				auto re_1 = execute_qme<D>(timer, exp, prog, cb_1, values_1, inputs[i].exp_1, exec_succ, match);
 
 				puts("perform the question mark expression again:");
-				execute_qme<D>(timer, exp, cb_2, inputs[i].exp_2, exec_succ, match);
+				auto re_2 = execute_qme<D>(timer, exp, prog, cb_2, values_2, inputs[i].exp_2, exec_succ, match);
+
+				execute_qme_in_batch<D>(exp, values_1, values_2, re_1, re_2, batch_match);
+				execute_qme_in_parallel<D>(pool, exp, values_1, values_2, re_1, re_2, parallel_match);
+				execute_qme_with_jit<D>(prog, values_1, values_2, re_1, re_2, jit_match, jit_native);
+				statements.push_back(inputs[i].input);
+				results_1.push_back(re_1);
+				results_2.push_back(re_2);
 			}
 			catch (const std::exception& e) {printf("\033[31m%s\033[0m\n", e.what());}
 			catch (const std::string& e) {printf("\033[31m%s\033[0m\n", e.data());}
 			catch (const char* e) {printf("\033[31m%s\033[0m\n", e);}
 			catch (...) {puts("\033[31munknown exception happened!\033[0m");}
-
-			//since recursion is used during the whole compilation and execution, if your expression is too complicated to
-			// be compiled and executed (stack overflow), use
-			// qme::O0/qme::O1 to compile it,
-			// qme::safe_data/qme::safe_judge to execute it and
-			// qme::safe_delete to delete it,
-			// then recursion will be eliminated.
-			//qme::safe_delete(exp);
 		}
 		putchar('\n');
 	}
+
+	//exceptions thrown by any thread must be rethrown by the parallel execution
+	{
+		qme::symbol_table symbols;
+		auto exp = qme::compiler<D, O>::compile("a / b", symbols);
+		std::vector<D> column_a(10000, (D) 1), column_b(10000, (D) 1), re(10000);
+		column_b[7777] = 0;
+		const D* columns[] = {column_a.data(), column_b.data()};
+		try {qme::parallel_batch_data(pool, exp, columns, re.size(), re.data(), 512); std::cout << " UT failed, divide zero is swallowed" << std::endl;}
+		catch (const char* e) {++parallel_match;}
+	}
+
+	//evaluate all successfully executed expressions together, they must get the same results as the one by one execution
+	puts("evaluate all question mark expressions together in a rule set:");
+	qme::rule_set<D, O> rules(statements);
+	auto values_1 = to_values<D>(rules.get_symbols(), dm_1), values_2 = to_values<D>(rules.get_symbols(), dm_2);
+	std::vector<D> outputs_1(rules.size()), outputs_2(rules.size()), cb_outputs_1(rules.size()), cb_outputs_2(rules.size());
+	rules.evaluate(values_1.data(), outputs_1.data());
+	rules.evaluate(values_2.data(), outputs_2.data());
+	rules.evaluate(cb_1, cb_outputs_1.data());
+	rules.evaluate(cb_2, cb_outputs_2.data());
+	auto rule_set_match = 0;
+	for (size_t i = 0; i < rules.size(); ++i)
+		if (outputs_1[i] == results_1[i] && outputs_2[i] == results_2[i] && cb_outputs_1[i] == results_1[i] && cb_outputs_2[i] == results_2[i])
+			++rule_set_match;
+		else
+			std::cout << " UT failed, rule set returns: \033[31m" << outputs_1[i] << ", " << outputs_2[i] << "\033[0m for " << statements[i] << std::endl;
+	putchar('\n');
+
+	//lower random expressions (with shared sub expressions and leaves with multipliers at the deepest places), the programs must
+	// get the same results (or exceptions) as the expressions
+	puts("execute random question mark expressions as programs:");
+	std::vector<std::string> random_statements;
+	random_statements.push_back("(a * b > 1) + (c > (d > 2 * a * a)) + (a * b > 1)");
+	random_statements.push_back("(a * b) * (c - (d - 2 * a * a)) - (a * b)");
+	std::mt19937 gen(20240607);
+	while (random_statements.size() < 2000)
+		random_statements.push_back(random_statement(gen, 6));
+	auto make_random_record = [](size_t n) {
+		std::map<std::string, D> record;
+		record["a"] = (D) (n % 5) - 2; record["b"] = (D) (n % 3); record["c"] = (D) (n % 7) - 1; record["d"] = (D) (n % 4) * 3;
+		return record;
+	};
+	auto outcome = [](const std::function<D()>& f) { //the result or the exception
+		try {return std::make_pair(f(), std::string());}
+		catch (const char* e) {return std::make_pair(D(), std::string(e));}
+		catch (const std::string& e) {return std::make_pair(D(), e);}
+	};
+	auto same_outcome = [](const std::pair<D, std::string>& l, const std::pair<D, std::string>& r) { //NaN (like -inf * 0) equals NaN
+		return l.second == r.second && (l.first == r.first || (l.first != l.first && r.first != r.first));
+	};
+	auto random_match = 0;
+	for (auto& statement : random_statements)
+	{
+		qme::symbol_table symbols;
+		auto exp = qme::compiler<D, O>::compile(statement.data(), symbols);
+		if (!exp) //divide zero by immediate values is refused by the compiler
+			continue;
+
+		qme::program<D> prog(exp);
+		auto matched = true;
+		for (size_t n = 0; matched && n < 12; ++n)
+		{
+			auto values = to_values<D>(symbols, make_random_record(n));
+			std::vector<D> stack(prog.stack_size()), outputs(prog.output_size());
+			matched = same_outcome(outcome([&]() {return qme::safe_data(exp, values.data()).first;}),
+				outcome([&]() {prog.execute(values.data(), stack.data(), outputs.data()); return outputs[0];}));
+		}
+		if (matched)
+			++random_match;
+		else
+			std::cout << " UT failed, the lowered program returns \033[31mdifferent results\033[0m for " << statement << std::endl;
+	}
+	putchar('\n');
+
+	//write programs of all successfully executed expressions into an image file, then map it and execute them from the mapped bytes
+	puts("execute question mark expressions mapped from an image file:");
+	auto image_match = 0;
+	try
+	{
+		auto symbols = rules.get_symbols(); //the same slots as values_1 and values_2
+		std::vector<qme::program<D>> progs;
+		for (auto& statement : statements)
+			progs.emplace_back(qme::compiler<D, O>::compile(statement, symbols));
+		std::vector<const qme::program<D>*> prog_ptrs;
+		for (auto& prog : progs)
+			prog_ptrs.push_back(&prog);
+
+		const char* image_file = "test_question_exp.img";
+		qme::save_image(image_file, qme::to_image(prog_ptrs));
+		{
+			qme::mapped_file f(image_file);
+			qme::image<D> img(f.data(), f.size());
+			for (size_t i = 0; i < img.size(); ++i)
+				if (img[i](values_1.data()) == results_1[i] && img[i](values_2.data()) == results_2[i] && img[i](cb_1) == results_1[i])
+					++image_match;
+				else
+					std::cout << " UT failed, mapped program returns: \033[31m" << img[i](values_1.data()) << "\033[0m for " << statements[i] << std::endl;
+		}
+		remove(image_file);
+
+		//corrupted images must be rejected
+		auto reject = [&](const std::function<void(std::string&, size_t)>& corrupt) { //the second is the offset of the last program
+			auto bytes = qme::to_image(prog_ptrs);
+			uint64_t offset;
+			memcpy(&offset, &bytes[sizeof(qme::image_header) + (progs.size() - 1) * sizeof(uint64_t)], sizeof(offset));
+			corrupt(bytes, (size_t) offset);
+			try {qme::image<D> img(bytes.data(), bytes.size()); std::cout << " UT failed, corrupted image is accepted" << std::endl;}
+			catch (const std::string&) {++image_match;}
+		};
+		reject([](std::string& bytes, size_t) {bytes[sizeof(qme::image_header)] ^= 0x7F;}); //the offset of the first program
+		reject([](std::string& bytes, size_t offset) { //a smaller max stack size, the stack would overflow
+			qme::image_program_header h;
+			memcpy(&h, &bytes[offset], sizeof(h));
+			--h.max_stack_size;
+			memcpy(&bytes[offset], &h, sizeof(h));
+		});
+		reject([](std::string& bytes, size_t offset) { //the first instruction pops two values from the empty stack
+			qme::image_program_header h;
+			memcpy(&h, &bytes[offset], sizeof(h));
+			bytes[offset + qme::image_layout<D>::code_offset((size_t) h.const_num) + offsetof(qme::instruction, code)] = (char) qme::opcode::add;
+		});
+		reject([](std::string& bytes, size_t) { //the number of offsets wraps around
+			qme::image_header h;
+			memcpy(&h, &bytes[0], sizeof(h));
+			h.program_num = (uint64_t) -1;
+			memcpy(&bytes[0], &h, sizeof(h));
+		});
+
+		//programs of random expressions must be saved and loaded again, and get the same results (or exceptions)
+		qme::symbol_table random_symbols;
+		std::vector<qme::program<D>> random_progs;
+		for (auto& statement : random_statements)
+		{
+			auto exp = qme::compiler<D, O>::compile(statement.data(), random_symbols);
+			if (exp)
+				random_progs.emplace_back(exp);
+		}
+		std::vector<const qme::program<D>*> random_prog_ptrs;
+		for (auto& prog : random_progs)
+			random_prog_ptrs.push_back(&prog);
+
+		auto bytes = qme::to_image(random_prog_ptrs);
+		qme::image<D> random_img(bytes.data(), bytes.size());
+		auto matched = random_img.size() == random_progs.size();
+		for (size_t n = 0; matched && n < 12; ++n)
+		{
+			auto values = to_values<D>(random_symbols, make_random_record(n));
+			for (size_t i = 0; matched && i < random_progs.size(); ++i)
+				matched = same_outcome(outcome([&]() {return random_progs[i](values.data());}), outcome([&]() {return random_img[i](values.data());}));
+		}
+		if (matched)
+			++image_match;
+		else
+			std::cout << " UT failed, programs of random expressions \033[31mare changed\033[0m by the image" << std::endl;
+	}
+	catch (const char* e) {std::cout << " UT failed, \033[31m" << e << "\033[0m" << std::endl;}
+	catch (const std::string& e) {std::cout << " UT failed, \033[31m" << e << "\033[0m" << std::endl;}
+	putchar('\n');
+
+	//hard-coded expressions can be compiled at compile time
+	puts("evaluate question mark expressions compiled at compile time:");
+	auto static_match = 0;
+#define EXECUTE_STATIC_QME(s) execute_static_qme<QME_STATIC_EXP(D, s), D>(s, cb_1, cb_2, static_match)
+	EXECUTE_STATIC_QME("a ? a + 1 / 2 + 3 : 0");
+	EXECUTE_STATIC_QME("a ? 2 * a * a * a / (3 * a * a) : 0");
+	EXECUTE_STATIC_QME("a > 0 ? (b < 0 ? b : -b) + 1 >= 0 ? c : -c : c > 0 ? -c : c");
+	EXECUTE_STATIC_QME("(a + b > 0 && b > 0 || c > 0) ? ((a > 0 && b > 0) ? +a + b + 1 : - c + 1 + 2) : ((a < 0 || b < 0) ? a - b : c)");
+	EXECUTE_STATIC_QME("!(a > 0) ? a : b ? c : 0");
+	EXECUTE_STATIC_QME("-(1 + -(2 + -(3 + -(4 + -(5 + 6)))))");
+	EXECUTE_STATIC_QME("-+-!-!!!a");
+	EXECUTE_STATIC_QME("a ? 20 + (a > 0 ? a : 0xA) : 0");
+	EXECUTE_STATIC_QME("a ? b * 2 * a / c * 10 * b * a : 0");
+	EXECUTE_STATIC_QME("(a > 0 ? (b > 0 ? (c > 0 ? 1 : 2) : 3) : 4) + 10 + (a < 0 ? (b < 0 ? (c < 0 ? 1 : 2) : 3) : 4) + 100");
+#undef EXECUTE_STATIC_QME
+#define EXECUTE_STATIC_OPT_QME(s) execute_static_qme<QME_STATIC_OPT_EXP(D, qme::O1, s), D, qme::O1>(s, cb_1, cb_2, static_match)
+	EXECUTE_STATIC_OPT_QME("a ? a + 1 / 2 + 3 : 0");
+	EXECUTE_STATIC_OPT_QME("a ? a - 1 - 2 + 3 * 4 : -(1 + 2)");
+	EXECUTE_STATIC_OPT_QME("a ? a * 2 * 3 + 1 - 2 : 0");
+	EXECUTE_STATIC_OPT_QME("(a > 0 ? (b > 0 ? (c > 0 ? 1 : 2) : 3) : 4) + 10 + (a < 0 ? (b < 0 ? (c < 0 ? 1 : 2) : 3) : 4) + 100");
+#undef EXECUTE_STATIC_OPT_QME
+	//immediate values are folded with O1, 'a + 1 - 2' -> 'a + -1'
+	typedef QME_STATIC_OPT_EXP(D, qme::O1, "1 + 2 * 3")::type folded_exp;
+	typedef QME_STATIC_OPT_EXP(D, qme::O1, "a + 1 - 2")::type folded_chain_exp;
+	if (folded_exp::immediate && 7 == folded_exp::value && folded_chain_exp::right_type::immediate && -1 == folded_chain_exp::right_type::value)
+		++static_match;
+	else
+		std::cout << " UT failed, \033[31mimmediate values are not folded at compile time\033[0m" << std::endl;
+	putchar('\n');
+
+	//compilation never recurses, so expressions with any depth can be compiled with any optimization level
+	puts("compile and execute deep question mark expressions:");
+	const size_t depth = 10000;
+	std::string nested(depth, '('), chain = "a", questions, logical = "a > 0";
+	nested += "a";
+	for (size_t i = 0; i < depth; ++i)
+	{
+		nested += i % 2 ? " - 1)" : " + 1)";
+		chain += " + b - a";
+		questions += "(b ? ";
+		logical += " && a > 0";
+	}
+	questions += "a";
+	for (size_t i = 0; i < depth; ++i)
+		questions += " : c)";
+
+	auto a = dm_1["a"], b = dm_1["b"], c = dm_1["c"];
+	const std::pair<std::string, D> deep_inputs[] = {
+		std::make_pair(nested, a),
+		std::make_pair(chain, a + (D) depth * (b - a)),
+		std::make_pair(questions, 0 != b ? a : c),
+		std::make_pair(logical, (D) (a > 0)),
+	};
+	auto deep_match = 0;
+	for (auto& item : deep_inputs)
+	{
+		auto exp = qme::compiler<D, O>::compile(item.first);
+		if (exp && qme::safe_data(exp, std::function<D(const std::string&)>(cb_1)).first == item.second)
+			++deep_match;
+		else
+			std::cout << " UT failed, deep expression (" << item.first.size() << " characters) doesn't return: \033[31m" << item.second << "\033[0m" << std::endl;
+	}
+	//depth and node count are cached by each expression, so they're available without traveling the whole expression
+	auto deep_exp = qme::compiler<D, O>::compile(questions);
+	if (!deep_exp || (size_t) deep_exp->get_depth() != depth + 1 || deep_exp->get_node_count() != 3 * depth + 1)
+		std::cout << " UT failed, wrong depth or node count of deep expression: \033[31m" << depth + 1 << ' ' << 3 * depth + 1 << "\033[0m" << std::endl;
+	putchar('\n');
+
+	//small integer exponents are raised by multiplications and reciprocals, results are pinned to exact values
+	puts("raise variables to integer exponents:");
+	auto power_match = 0;
+	{
+		struct {const char* statement; double a, re;} power_inputs[] = { //a = 0.5 is skipped for integers
+			{"a * a", 3, 9},
+			{"a * a * a", -3, -27},
+			{"a * a * a * a * a", -3, -243},
+			{"1 / a", .5, 2},
+			{"1 / (a * a * a * a)", .5, 16},
+		};
+		for (auto& item : power_inputs)
+		{
+			if (item.a != (D) item.a)
+				continue;
+
+			auto exp = qme::compiler<D, O>::compile(item.statement);
+			auto v = (D) item.a;
+			if (exp && (*exp)(&v) == (D) item.re && qme::program<D>(exp)(&v) == (D) item.re)
+				++power_match;
+			else
+				std::cout << " UT failed, " << item.statement << " doesn't return: \033[31m" << item.re << "\033[0m" << std::endl;
+		}
+
+		typedef qme::power<double> P;
+		if (&P::square == P::get(2) && &P::cube == P::get(3) && &P::reciprocal == P::get(-1) && &P::by_squaring == P::get(5) &&
+			&P::by_squaring == P::get(-32) && &P::libm == P::get(33) && &qme::power<int>::libm == qme::power<int>::get(-2) &&
+			1.1 * 1.1 == P::raise(1.1, 2) && 1.1 * 1.1 * 1.1 == P::raise(1.1, 3) && 1 / 1.1 == P::raise(1.1, -1) &&
+			1.1 * ((1.1 * 1.1) * (1.1 * 1.1)) == P::raise(1.1, 5) && -32768 == qme::power<int>::raise(-2, 15))
+			++power_match;
+		else
+			std::cout << " UT failed, \033[31mwrong power functions\033[0m" << std::endl;
+
+		typedef qme::power<int> I; //overflows of integers wrap around (3^21 = 10460353203 = 2 * 2^32 + 1870418611)
+		if (0 == I::raise(65536, 2) && 0 == I::raise(-65536, 3) && 1870418611 == I::raise(3, 21) && -1870418611 == I::raise(-3, 21))
+			++power_match;
+		else
+			std::cout << " UT failed, \033[31mwrong overflows of integer powers\033[0m" << std::endl;
+	}
+	putchar('\n');
+
+	//with declared bounds, judgments which become constant are folded and dead branches are pruned, the results must not change
+	puts("compile question mark expressions with declared bounds:");
+	qme::variable_bounds<D> bounds;
+	bounds["b"] = std::make_pair((D) 1, (D) 2);
+	bounds["c"] = std::make_pair((D) 10, (D) 20);
+	const std::pair<const char*, bool> bounded_inputs[] = { //the second means whether the expression becomes smaller
+		std::make_pair("b > 0 ? a : c", true),
+		std::make_pair("c < 10 || b > 2 ? a : c + 1", true),
+		std::make_pair("a > 0 && b >= 1 ? a : b", true),
+		std::make_pair("b * c <= 40 && b / c < 1 ? a : b", true),
+		std::make_pair("-b < 0 ? b * b : a", true),
+		std::make_pair("c != 5 ? a : b", true),
+		std::make_pair("b > 0 || a / (c - 11) > 1", true),
+		std::make_pair("b >= 1 && a", true),
+		std::make_pair("a / (c - 10) > 1 || b", false), //the left item may throw divide zero, so it must be kept
+		std::make_pair("b == 1 ? a : c", false),
+		std::make_pair("a > b ? a : c", false),
+	};
+	auto bounds_match = 0;
+	for (auto& item : bounded_inputs)
+	{
+		auto exp = qme::compiler<D, O>::compile(item.first);
+		auto bounded_exp = qme::compiler<D, O>::compile(item.first, bounds);
+		if (exp && bounded_exp && (bounded_exp->get_node_count() < exp->get_node_count()) == item.second &&
+			qme::safe_data(exp, std::function<D(const std::string&)>(cb_1)).first ==
+			qme::safe_data(bounded_exp, std::function<D(const std::string&)>(cb_1)).first)
+			++bounds_match;
+		else
+			std::cout << " UT failed, " << item.first << " with declared bounds \033[31m" << (item.second ? "is not" : "is") << " smaller\033[0m" << std::endl;
+	}
+	{ //'c * (3 + 3 == a + c)' is folded to 0, then O2 and O3 transform '0 / x' to 0, so divide zero is not thrown anymore
+		qme::variable_bounds<D> unit_bounds;
+		unit_bounds["a"] = unit_bounds["b"] = unit_bounds["c"] = std::make_pair((D) 0, (D) 1);
+		const char* statement = "3 - b - c * (3 + 3 == a + c) / -(3 * b + a)";
+		qme::symbol_table symbols;
+		auto exp = qme::compiler<D, O>::compile(statement, symbols);
+		auto bounded_exp = qme::compiler<D, O>::compile(statement, symbols, unit_bounds);
+		const D zeros[] = {0, 0, 0};
+		auto divide_zero = [&](qme::exp_ctype<D>& e) {
+			try {qme::safe_data(e, zeros); return false;}
+			catch (const char*) {return true;}
+		};
+		if (exp && bounded_exp && divide_zero(exp) && (O::level() > 1 ? 3 == qme::safe_data(bounded_exp, zeros).first : divide_zero(bounded_exp)))
+			++bounds_match;
+		else
+			std::cout << " UT failed, " << statement << " with declared bounds \033[31mis not folded as documented\033[0m" << std::endl;
+	}
+	putchar('\n');
+
+	//specialize expressions with known b and c, the residual expressions must be smaller and get the same results
+	puts("specialize question mark expressions with known variables:");
+	std::map<std::string, D> bindings;
+	bindings["b"] = (D) dm_1["b"];
+	bindings["c"] = (D) dm_1["c"];
+	const char* specialized_inputs[] = {
+		"b > 0 ? a : c",
+		"c < 10 || b > 2 ? a : c + a",
+		"a > 0 && b >= 1 ? a * c : b",
+		"a + b * c - c",
+		"(a > c ? a : b) * (c - b)",
+		"!(b == 1) && a > 0 || a < c",
+	};
+	auto specialized_match = 0;
+	for (auto item : specialized_inputs)
+	{
+		auto exp = qme::compiler<D, O>::compile(item);
+		qme::symbol_table symbols;
+		auto specialized_exp = exp ? qme::compiler<D, O>::specialize(exp, bindings, symbols) : qme::exp_type<D>();
+		if (specialized_exp && specialized_exp->get_node_count() < exp->get_node_count() && 1 == symbols.size() &&
+			qme::safe_data(exp, std::function<D(const std::string&)>(cb_1)).first ==
+			qme::safe_data(specialized_exp, std::function<D(const std::string&)>(cb_1)).first)
+			++specialized_match;
+		else
+			std::cout << " UT failed, " << item << " \033[31mis not specialized\033[0m" << std::endl;
+	}
+	putchar('\n');
+
+	//profile expressions on generated records, then reorder them, the results must not change
+	puts("reorder question mark expressions by profiling:");
+	const std::pair<const char*, bool> profiled_inputs[] = { //the second means whether the cheap operand should be on the left
+		std::make_pair("a * a + c * c > 10 && b > 8", true),
+		std::make_pair("a * a + c * c > 10 || b < 8", true),
+		std::make_pair("b > 8 && a * a + c * c > 10", true), //already in the best order
+		std::make_pair("a / c > 1 && b > 8", false), //the left item may throw divide zero
+	};
+	auto make_record = [](size_t n) {std::map<std::string, D> record; record["a"] = (D) (n % 7) - 3; record["b"] = (D) (n % 10); record["c"] = (D) (n % 5 + 1); return record;};
+	auto reorder_match = 0;
+	for (auto& item : profiled_inputs)
+	{
+		qme::symbol_table symbols;
+		auto exp = qme::compiler<D, O>::compile(item.first, symbols);
+		qme::profiler<D> p;
+		for (size_t n = 0; n < 100; ++n)
+			p.judge(exp, to_values<D>(symbols, make_record(n)).data());
+
+		auto reordered_exp = qme::reorder(exp, p);
+		auto matched = (reordered_exp->get_left_item()->get_node_count() < reordered_exp->get_right_item()->get_node_count()) == item.second;
+		for (size_t n = 0; matched && n < 100; ++n)
+		{
+			auto values = to_values<D>(symbols, make_record(n));
+			matched = (*exp)(values.data()) == (*reordered_exp)(values.data());
+		}
+		if (matched)
+			++reorder_match;
+		else
+			std::cout << " UT failed, " << item.first << " \033[31mis not reordered as expected\033[0m" << std::endl;
+	}
+	{ //the false branch is more likely, so it should be laid out first
+		qme::symbol_table symbols;
+		auto exp = qme::compiler<D, O>::compile("b > 8 ? a : c", symbols);
+		qme::profiler<D> p;
+		for (size_t n = 0; n < 100; ++n)
+			p.data(exp, to_values<D>(symbols, make_record(n)).data());
+
+		auto reordered_exp = qme::reorder(exp, p);
+		auto values = to_values<D>(symbols, make_record(9));
+		if ("<=" == reordered_exp->get_road_map()->get_operator() && (*exp)(values.data()) == (*reordered_exp)(values.data()))
+			++reorder_match;
+		else
+			std::cout << " UT failed, b > 8 ? a : c \033[31mis not reordered as expected\033[0m" << std::endl;
+	}
+	putchar('\n');
+
+	//statements printed from compiled expressions must be compiled again with the same results
+	puts("print and compile all question mark expressions again:");
+	std::vector<const char*> printed_inputs;
+	for (auto& item : inputs)
+		printed_inputs.push_back(item.input);
+	//immediate values which cannot be printed exactly with a few digits
+	printed_inputs.push_back("a + 16777217");
+	printed_inputs.push_back("a / 3 + 1");
+	printed_inputs.push_back("b * 123456789 - a / 7");
+	printed_inputs.push_back("a * 0.1 + 340282346638528859811704183484516925440");
+	printed_inputs.push_back("a / 300000000 + c / 0.0000003");
+	auto statement_match = 0;
+	for (auto item : printed_inputs)
+	{
+		auto exp = qme::compiler<D, O>::compile(item);
+		if (!exp)
+			continue;
+
+		auto statement = qme::to_statement(exp);
+		auto printed_exp = qme::compiler<D, O>::compile(statement);
+		auto execute = [](qme::exp_ctype<D>& e, const std::function<D(const std::string&)>& cb) { //the outcome or the exception
+			try {return std::make_pair(qme::safe_data(e, cb).first, std::string());}
+			catch (const char* e) {return std::make_pair(D(), std::string(e));}
+			catch (const std::string& e) {return std::make_pair(D(), e);}
+		};
+		auto matched = printed_exp && execute(exp, cb_1) == execute(printed_exp, cb_1) && execute(exp, cb_2) == execute(printed_exp, cb_2);
+		if (matched)
+			++statement_match;
+		else
+			std::cout << " UT failed, " << item << " is printed as \033[31m" << statement << "\033[0m" << std::endl;
+	}
+	if (std::numeric_limits<D>::has_infinity) //infinities and NaN can't be parsed, so they must not be printed (except in reports)
+	{
+		auto infinity = std::numeric_limits<D>::infinity();
+		for (auto v : {infinity, -infinity, std::numeric_limits<D>::quiet_NaN()})
+		{
+			auto immediate = qme::make_exp<qme::immediate_data_exp<D>>(v);
+			qme::exp_type<D> exp = qme::make_exp<qme::multi_data_exp<D, O>>(immediate, qme::compiler<D, O>::compile("a"));
+			std::ostringstream os;
+			qme::profiler<D>().report(os, exp);
+			try
+			{
+				auto statement = qme::to_statement(exp);
+				std::cout << " UT failed, " << v << " is printed as \033[31m" << statement << "\033[0m" << std::endl;
+			}
+			catch (const std::string&)
+			{
+				if (std::string::npos != os.str().find(qme::to_immediate_text(v, false)))
+					++statement_match;
+				else
+					std::cout << " UT failed, " << v << " is reported as \033[31m" << os.str() << "\033[0m" << std::endl;
+			}
+		}
+	}
+	{ //per node statistics
+		qme::symbol_table symbols;
+		auto exp = qme::compiler<D, O>::compile("a > 0 && b > 8 ? a : c", symbols);
+		qme::profiler<D> p(true);
+		for (size_t n = 0; n < 100; ++n)
+			p.data(exp, to_values<D>(symbols, make_record(n)).data());
+
+		auto s = p.find(exp.get()), j = p.find(exp->get_road_map().get());
+		std::ostringstream os;
+		p.report(os, exp);
+		auto report = os.str();
+		auto lines = std::count(std::begin(report), std::end(report), '\n'); //the statement and 10 nodes (a is shared)
+		if (s && j && 100 == s->visits && s->true_branches == j->trues && j->short_circuits > 0 && j->short_circuits < 100 &&
+			0 == report.find(qme::to_statement(exp) + '\n') && 11 == lines && std::string::npos != report.find("\n  &&: visits 100"))
+			++statement_match;
+		else
+			std::cout << " UT failed, \033[31mwrong statistics of a > 0 && b > 8 ? a : c\033[0m" << std::endl << report;
+	}
+	putchar('\n');
+
+	//compile all expressions twice with the compile cache, the second round should hit for all valid expressions
+	puts("compile all question mark expressions twice with the compile cache:");
+	qme::compiler<>::enable_cache(sizeof(inputs) / sizeof(ut_input_and_expectation<>));
+	auto base_stats = qme::compiler<>::get_cache_stats();
+	size_t cached_num = 0; //successfully compiled ones
+	for (auto round = 0; round < 2; ++round)
+		for (size_t i = 0; i < sizeof(inputs) / sizeof(ut_input_and_expectation<>); ++i)
+			if (qme::compiler<>::compile(inputs[i].input) && 0 == round)
+				++cached_num;
+	auto stats = qme::compiler<>::get_cache_stats();
+	stats.hits -= base_stats.hits;
+	stats.misses -= base_stats.misses;
+	qme::compiler<>::enable_cache(stats.size / 2); //evict half of them
+	auto evictions = qme::compiler<>::get_cache_stats().evictions - stats.evictions;
+	if (stats.hits != cached_num || stats.size != cached_num || evictions != stats.size - stats.size / 2)
+		std::cout << " UT failed, compile cache (hits/size/evictions): \033[31m" << stats.hits << '/' << stats.size << '/' << evictions
+			<< "\033[0m, expected: " << cached_num << '/' << cached_num << '/' << cached_num - cached_num / 2 << std::endl;
+	{ //cached expressions are shared, rebinding them to other slots must be refused, so other callers are not affected
+		qme::symbol_table symbols_1, symbols_2, reversed;
+		auto exp_1 = qme::compiler<>::compile("a - b", symbols_1);
+		reversed.insert("b");
+		reversed.insert("a");
+		try {qme::bind_symbols(exp_1, reversed); std::cout << " UT failed, \033[31ma cached expression is rebound\033[0m" << std::endl;}
+		catch (const std::string&) {}
+		qme::bind_symbols(exp_1, symbols_1); //the same slots
+
+		auto exp_2 = qme::compiler<>::compile("a - b", symbols_2);
+		const float values[] = {10, 1};
+		if (exp_1 != exp_2 || 9 != (*exp_2)(values))
+			std::cout << " UT failed, \033[31ma shared expression is changed\033[0m" << std::endl;
+	}
+	qme::compiler<>::enable_cache(0);
+	putchar('\n');
+
 	std::cout << "summary:" << std::endl
 		<< " total qme: " << sizeof(inputs) / sizeof(ut_input_and_expectation<>) << std::endl
 		<< " successfully compiled: " << compile_succ << std::endl
 		<< " successfully executed: " << exec_succ << std::endl
-		<< " successfully matched: " << match << std::endl;
+		<< " successfully matched: " << match << std::endl
+		<< " successfully matched in batch: " << batch_match << std::endl
+		<< " successfully matched in parallel: " << parallel_match << std::endl
+		<< " successfully matched in rule set: " << rule_set_match << std::endl
+		<< " successfully matched in random programs: " << random_match << std::endl
+		<< " successfully matched from image: " << image_match << std::endl
+		<< " successfully matched by jit: " << jit_match << " (native: " << jit_native << ')' << std::endl
+		<< " successfully matched at compile time: " << static_match << std::endl
+		<< " successfully matched in deep expressions: " << deep_match << std::endl
+		<< " successfully matched with exponents: " << power_match << std::endl
+		<< " successfully matched with declared bounds: " << bounds_match << std::endl
+		<< " successfully matched after specialization: " << specialized_match << std::endl
+		<< " successfully matched after reordering: " << reorder_match << std::endl
+		<< " successfully matched after printing: " << statement_match << std::endl
+		<< " compile cache (hits/misses/evictions): " << stats.hits << '/' << stats.misses << '/' << evictions << std::endl;
 
 	return 0;
 }